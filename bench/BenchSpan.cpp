@@ -1,6 +1,9 @@
 #include <benchmark/benchmark_api.h>
 
+#include <atomic>
+#include <new>
 #include <utility>
+#include <vector>
 
 #include <thrift/transport/TBufferTransports.h>
 #include <thrift/protocol/TBinaryProtocol.h>
@@ -11,10 +14,29 @@
 
 #include "Span.h"
 #include "Tracer.h"
+#include "Collector.h"
+
+static std::atomic<size_t> g_allocs(0);
+
+void *operator new(size_t size)
+{
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+
+    if (void *p = malloc(size))
+        return p;
+
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
 
 void bench_span_reuse(benchmark::State &state)
 {
-    std::unique_ptr<zipkin::Tracer> tracer(zipkin::Tracer::create(nullptr));
+    // shared by all the threads, like the tracer of a server
+    static zipkin::Tracer *tracer = zipkin::Tracer::create(nullptr);
     std::vector<zipkin::Span *> spans(state.range(0));
 
     while (state.KeepRunning())
@@ -34,6 +56,309 @@ void bench_span_reuse(benchmark::State &state)
 
 BENCHMARK(bench_span_reuse)->RangeMultiplier(4)->Range(1, 512)->ThreadPerCpu();
 
+void bench_span_release_batch(benchmark::State &state)
+{
+    static zipkin::Tracer *tracer = zipkin::Tracer::create(nullptr);
+    std::vector<zipkin::Span *> spans(state.range(0));
+
+    while (state.KeepRunning())
+    {
+        for (int i = 0; i < spans.size(); i++)
+        {
+            spans[i] = tracer->span("bench");
+        }
+
+        tracer->release(spans.data(), spans.size());
+    }
+
+    state.SetItemsProcessed(state.iterations() * spans.size());
+}
+
+BENCHMARK(bench_span_release_batch)->RangeMultiplier(4)->Range(16, 256)->ThreadPerCpu();
+
+class NullCollector : public zipkin::BaseCollector
+{
+  public:
+    NullCollector(zipkin::BaseConf *conf) : BaseCollector(conf) {}
+
+    virtual const char *name(void) const override { return "null"; }
+
+    virtual void send_message(const uint8_t *msg, size_t size) override {}
+};
+
+static NullCollector *null_collector(size_t thread_batch_size)
+{
+    zipkin::BaseConf *conf = new zipkin::BaseConf();
+
+    conf->thread_batch_size = thread_batch_size;
+
+    return new NullCollector(conf);
+}
+
+void bench_collector_submit(benchmark::State &state)
+{
+    // without and with the thread batches
+    static NullCollector *collectors[] = {null_collector(1), null_collector(16)};
+    static zipkin::Tracer *tracers[] = {zipkin::Tracer::create(collectors[0]), zipkin::Tracer::create(collectors[1])};
+
+    NullCollector *collector = collectors[state.range(0) > 1];
+    zipkin::Tracer *tracer = tracers[state.range(0) > 1];
+
+    while (state.KeepRunning())
+    {
+        collector->submit(tracer->span("bench"));
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(bench_collector_submit)->Arg(1)->Arg(16)->ThreadPerCpu();
+
+static const int CACHE_FLAGS[] = {
+    0,
+    zipkin::CachedTracer::CACHE_PREWARM,
+    zipkin::CachedTracer::CACHE_SLAB,
+    zipkin::CachedTracer::CACHE_SLAB | zipkin::CachedTracer::CACHE_PREWARM,
+    zipkin::CachedTracer::CACHE_HUGEPAGE | zipkin::CachedTracer::CACHE_PREWARM,
+};
+
+static void cache_flags_args(benchmark::internal::Benchmark *bench)
+{
+    for (int flags : CACHE_FLAGS)
+    {
+        bench->Arg(flags);
+    }
+}
+
+static void bench_spans(zipkin::Tracer *tracer, std::vector<zipkin::Span *> &spans)
+{
+    for (auto &span : spans)
+    {
+        span = tracer->span("bench");
+
+        *span << zipkin::TraceKeys::CLIENT_SEND << std::make_pair(zipkin::TraceKeys::HTTP_STATUS_CODE, (int32_t)200);
+    }
+
+    tracer->release(spans.data(), spans.size());
+}
+
+void bench_tracer_startup(benchmark::State &state)
+{
+    std::vector<zipkin::Span *> spans(zipkin::CachedTracer::DEFAULT_CACHE_MESSAGE_COUNT);
+
+    while (state.KeepRunning())
+    {
+        state.PauseTiming();
+
+        zipkin::Tracer *tracer = new zipkin::CachedTracer(nullptr, 1,
+                                                          zipkin::CachedTracer::DEFAULT_CACHE_MESSAGE_SIZE,
+                                                          zipkin::CachedTracer::DEFAULT_CACHE_MESSAGE_COUNT,
+                                                          state.range(0));
+
+        state.ResumeTiming();
+
+        // the first requests after the deploy
+        bench_spans(tracer, spans);
+
+        state.PauseTiming();
+
+        delete tracer;
+
+        state.ResumeTiming();
+    }
+
+    state.SetItemsProcessed(state.iterations() * spans.size());
+}
+
+BENCHMARK(bench_tracer_startup)->Apply(cache_flags_args);
+
+void bench_tracer_steady_state(benchmark::State &state)
+{
+    std::unique_ptr<zipkin::Tracer> tracer(new zipkin::CachedTracer(nullptr, 1,
+                                                                    zipkin::CachedTracer::DEFAULT_CACHE_MESSAGE_SIZE,
+                                                                    zipkin::CachedTracer::DEFAULT_CACHE_MESSAGE_COUNT,
+                                                                    state.range(0)));
+    std::vector<zipkin::Span *> spans(zipkin::CachedTracer::DEFAULT_CACHE_MESSAGE_COUNT * 4);
+
+    while (state.KeepRunning())
+    {
+        bench_spans(tracer.get(), spans);
+    }
+
+    state.SetItemsProcessed(state.iterations() * spans.size());
+}
+
+BENCHMARK(bench_tracer_steady_state)->Apply(cache_flags_args);
+
+void bench_id_generator_random(benchmark::State &state)
+{
+    zipkin::IdGenerator *generator = zipkin::IdGenerator::random();
+
+    while (state.KeepRunning())
+    {
+        benchmark::DoNotOptimize(generator->next_id());
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(bench_id_generator_random)->ThreadPerCpu();
+
+void bench_id_generator_timestamp(benchmark::State &state)
+{
+    zipkin::IdGenerator *generator = zipkin::IdGenerator::timestamp();
+
+    while (state.KeepRunning())
+    {
+        benchmark::DoNotOptimize(generator->next_trace_id());
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(bench_id_generator_timestamp)->ThreadPerCpu();
+
+void bench_id_generator_batch(benchmark::State &state)
+{
+    zipkin::IdGenerator *generator = zipkin::IdGenerator::random();
+    std::vector<uint64_t> ids(state.range(0));
+
+    while (state.KeepRunning())
+    {
+        generator->next_ids(ids.data(), ids.size());
+    }
+
+    state.SetItemsProcessed(state.iterations() * ids.size());
+}
+
+BENCHMARK(bench_id_generator_batch)->RangeMultiplier(4)->Range(4, 256)->ThreadPerCpu();
+
+void bench_sampler(benchmark::State &state)
+{
+    static zipkin::CountingSampler counting(100);
+    static zipkin::ProbabilisticSampler probabilistic(0.01);
+    static zipkin::RateLimitingSampler rate_limiting(100);
+    static zipkin::AdaptiveSampler adaptive;
+    static zipkin::Sampler *samplers[] = {zipkin::Sampler::always(), &counting, &probabilistic, &rate_limiting, &adaptive};
+
+    zipkin::Sampler *sampler = samplers[state.range(0)];
+    trace_id_t trace_id = 0;
+
+    while (state.KeepRunning())
+    {
+        benchmark::DoNotOptimize(sampler->sample(++trace_id, "bench"));
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(bench_sampler)->DenseRange(0, 4)->ThreadPerCpu();
+
+void bench_span_root(benchmark::State &state)
+{
+    std::unique_ptr<zipkin::Tracer> tracer(zipkin::Tracer::create(nullptr));
+
+    while (state.KeepRunning())
+    {
+        tracer->span("bench")->release();
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(bench_span_root);
+
+void bench_span_child(benchmark::State &state)
+{
+    std::unique_ptr<zipkin::Tracer> tracer(zipkin::Tracer::create(nullptr));
+    zipkin::Span *root = tracer->span("bench");
+    zipkin::SpanContext parent = root->context();
+
+    while (state.KeepRunning())
+    {
+        tracer->span("bench", parent)->release();
+    }
+
+    state.SetItemsProcessed(state.iterations());
+
+    root->release();
+}
+
+BENCHMARK(bench_span_child);
+
+void bench_span_reuse_annotate(benchmark::State &state)
+{
+    std::unique_ptr<zipkin::Tracer> tracer(zipkin::Tracer::create(nullptr));
+    zipkin::Endpoint endpoint("bench");
+    std::string value("hello world");
+
+    size_t allocs = g_allocs.load(std::memory_order_relaxed);
+
+    while (state.KeepRunning())
+    {
+        zipkin::Span *span = tracer->span("bench");
+
+        for (int i = 0; i < state.range(0); i++)
+        {
+            *span << zipkin::TraceKeys::CLIENT_SEND << endpoint
+                  << std::make_pair(zipkin::TraceKeys::HTTP_URL, value)
+                  << std::make_pair(zipkin::TraceKeys::HTTP_STATUS_CODE, (int32_t)200);
+        }
+
+        span->release();
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    state.counters["allocs_per_span"] = double(g_allocs.load(std::memory_order_relaxed) - allocs) / state.iterations();
+}
+
+BENCHMARK(bench_span_reuse_annotate)->RangeMultiplier(4)->Range(1, 64);
+
+void bench_span_sampled_annotate(benchmark::State &state)
+{
+    std::unique_ptr<zipkin::Tracer> tracer(zipkin::Tracer::create(nullptr));
+    zipkin::Endpoint endpoint("bench");
+    std::string value("hello world");
+
+    tracer->set_sampler(state.range(0) ? zipkin::Sampler::always() : zipkin::Sampler::never());
+
+    while (state.KeepRunning())
+    {
+        zipkin::Span *span = tracer->span("bench");
+
+        *span << zipkin::TraceKeys::SERVER_RECV << endpoint
+              << std::make_pair(zipkin::TraceKeys::HTTP_URL, value)
+              << std::make_pair(zipkin::TraceKeys::HTTP_STATUS_CODE, (int32_t)200)
+              << zipkin::TraceKeys::SERVER_SEND << endpoint;
+
+        span->release();
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(bench_span_sampled_annotate)->Arg(0)->Arg(1);
+
+void bench_span_metrics(benchmark::State &state)
+{
+    zipkin::CachedTracer tracer(nullptr);
+    zipkin::SpanMetrics metrics;
+
+    tracer.set_sampler(zipkin::Sampler::never());
+
+    if (state.range(0))
+        tracer.set_metrics(&metrics);
+
+    while (state.KeepRunning())
+    {
+        tracer.span("bench")->submit();
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(bench_span_metrics)->Arg(0)->Arg(1);
+
 void bench_span_annonate(benchmark::State &state)
 {
     zipkin::Span span(nullptr, "bench");
@@ -43,11 +368,31 @@ void bench_span_annonate(benchmark::State &state)
         span << zipkin::TraceKeys::CLIENT_SEND;
     }
 
-    state.SetItemsProcessed(span.message().annotations.size());
+    state.SetItemsProcessed(state.iterations());
 }
 
 BENCHMARK(bench_span_annonate);
 
+void bench_span_annonate_with_clock(benchmark::State &state)
+{
+    std::unique_ptr<zipkin::Tracer> tracer(zipkin::Tracer::create(nullptr));
+
+    tracer->set_clock(zipkin::Clock::get(static_cast<zipkin::Clock::Mode>(state.range(0))));
+
+    zipkin::Span *span = tracer->span("bench");
+
+    while (state.KeepRunning())
+    {
+        *span << zipkin::TraceKeys::CLIENT_SEND;
+    }
+
+    state.SetItemsProcessed(state.iterations());
+
+    span->release();
+}
+
+BENCHMARK(bench_span_annonate_with_clock)->Arg(zipkin::Clock::PRECISE)->Arg(zipkin::Clock::COARSE)->Arg(zipkin::Clock::TSC);
+
 void bench_span_annonate_with_endpoint(benchmark::State &state)
 {
     zipkin::Span span(nullptr, "bench");
@@ -58,11 +403,30 @@ void bench_span_annonate_with_endpoint(benchmark::State &state)
         span << zipkin::TraceKeys::CLIENT_SEND << endpoint;
     }
 
-    state.SetItemsProcessed(span.message().annotations.size());
+    state.SetItemsProcessed(state.iterations());
 }
 
 BENCHMARK(bench_span_annonate_with_endpoint);
 
+void bench_span_annonate_with_registered_endpoint(benchmark::State &state)
+{
+    zipkin::Span span(nullptr, "bench");
+    const zipkin::Endpoint *endpoint = zipkin::EndpointRegistry::instance().acquire(zipkin::Endpoint("bench"));
+
+    while (state.KeepRunning())
+    {
+        span << zipkin::TraceKeys::CLIENT_SEND << *endpoint;
+    }
+
+    state.SetItemsProcessed(state.iterations());
+
+    span.reset("bench");
+
+    zipkin::EndpointRegistry::instance().release(endpoint);
+}
+
+BENCHMARK(bench_span_annonate_with_registered_endpoint);
+
 void bench_span_annonate_bool(benchmark::State &state)
 {
     zipkin::Span span(nullptr, "bench");
@@ -72,7 +436,7 @@ void bench_span_annonate_bool(benchmark::State &state)
         span << std::make_pair(zipkin::TraceKeys::CLIENT_SEND, false);
     }
 
-    state.SetItemsProcessed(span.message().binary_annotations.size());
+    state.SetItemsProcessed(state.iterations());
 }
 
 BENCHMARK(bench_span_annonate_bool);
@@ -87,7 +451,7 @@ void bench_span_annonate_bool_with_endpoint(benchmark::State &state)
         span << std::make_pair(zipkin::TraceKeys::CLIENT_SEND, false) << endpoint;
     }
 
-    state.SetItemsProcessed(span.message().binary_annotations.size());
+    state.SetItemsProcessed(state.iterations());
 }
 
 BENCHMARK(bench_span_annonate_bool_with_endpoint);
@@ -101,7 +465,7 @@ void bench_span_annonate_int16(benchmark::State &state)
         span << std::make_pair(zipkin::TraceKeys::CLIENT_SEND, (int16_t)123);
     }
 
-    state.SetItemsProcessed(span.message().binary_annotations.size());
+    state.SetItemsProcessed(state.iterations());
 }
 
 BENCHMARK(bench_span_annonate_int16);
@@ -115,7 +479,7 @@ void bench_span_annonate_int32(benchmark::State &state)
         span << std::make_pair(zipkin::TraceKeys::CLIENT_SEND, (int32_t)123);
     }
 
-    state.SetItemsProcessed(span.message().binary_annotations.size());
+    state.SetItemsProcessed(state.iterations());
 }
 
 BENCHMARK(bench_span_annonate_int32);
@@ -129,7 +493,7 @@ void bench_span_annonate_int64(benchmark::State &state)
         span << std::make_pair(zipkin::TraceKeys::CLIENT_SEND, (int64_t)123);
     }
 
-    state.SetItemsProcessed(span.message().binary_annotations.size());
+    state.SetItemsProcessed(state.iterations());
 }
 
 BENCHMARK(bench_span_annonate_int64);
@@ -143,7 +507,7 @@ void bench_span_annonate_double(benchmark::State &state)
         span << std::make_pair(zipkin::TraceKeys::CLIENT_SEND, (double)12.3);
     }
 
-    state.SetItemsProcessed(span.message().binary_annotations.size());
+    state.SetItemsProcessed(state.iterations());
 }
 
 BENCHMARK(bench_span_annonate_double);
@@ -157,7 +521,7 @@ void bench_span_annonate_cstr(benchmark::State &state)
         span << std::make_pair(zipkin::TraceKeys::CLIENT_SEND, "hello world");
     }
 
-    state.SetItemsProcessed(span.message().binary_annotations.size());
+    state.SetItemsProcessed(state.iterations());
 }
 
 BENCHMARK(bench_span_annonate_cstr);
@@ -172,7 +536,7 @@ void bench_span_annonate_string(benchmark::State &state)
         span << std::make_pair(zipkin::TraceKeys::CLIENT_SEND, value);
     }
 
-    state.SetItemsProcessed(span.message().binary_annotations.size());
+    state.SetItemsProcessed(state.iterations());
 }
 
 BENCHMARK(bench_span_annonate_string);
@@ -188,11 +552,89 @@ void bench_span_annonate_string_with_endpoint(benchmark::State &state)
         span << std::make_pair(zipkin::TraceKeys::CLIENT_SEND, value) << endpoint;
     }
 
-    state.SetItemsProcessed(span.message().binary_annotations.size());
+    state.SetItemsProcessed(state.iterations());
 }
 
 BENCHMARK(bench_span_annonate_string_with_endpoint);
 
+void bench_span_annonate_literal(benchmark::State &state)
+{
+    std::unique_ptr<zipkin::Tracer> tracer(zipkin::Tracer::create(nullptr));
+
+    size_t allocs = g_allocs.load(std::memory_order_relaxed);
+
+    while (state.KeepRunning())
+    {
+        zipkin::Span *span = tracer->span("bench.literal.span.name");
+
+        span->annotate("bench.literal.key", "hello world, a literal longer than SSO");
+
+        span->release();
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    state.counters["allocs_per_span"] = double(g_allocs.load(std::memory_order_relaxed) - allocs) / state.iterations();
+}
+
+BENCHMARK(bench_span_annonate_literal);
+
+void bench_span_annonate_string_view(benchmark::State &state)
+{
+    zipkin::Span span(nullptr, "bench");
+    const char buf[] = "http.url=http://www.google.com/";
+    zipkin::string_view key(buf, 8), value(buf + 9, sizeof(buf) - 10);
+
+    while (state.KeepRunning())
+    {
+        span << std::make_pair(key, value);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(bench_span_annonate_string_view);
+
+void bench_span_annonate_moved_string(benchmark::State &state)
+{
+    zipkin::Span span(nullptr, "bench");
+    const std::string value("hello world, a value longer than SSO");
+
+    while (state.KeepRunning())
+    {
+        std::string tmp(value);
+
+        span.annotate(zipkin::TraceKeys::HTTP_URL, std::move(tmp));
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(bench_span_annonate_moved_string);
+
+void bench_span_with_name(benchmark::State &state)
+{
+    zipkin::Span span(nullptr, "bench");
+    const std::string name("bench.span.name.longer.than.sso");
+
+    while (state.KeepRunning())
+    {
+        if (state.range(0))
+        {
+            std::string tmp(name);
+
+            span.with_name(std::move(tmp));
+        }
+        else
+        {
+            span.with_name("bench.span.name.longer.than.sso");
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(bench_span_with_name)->Arg(0)->Arg(1);
+
 void bench_span_annonate_wcstr(benchmark::State &state)
 {
     zipkin::Span span(nullptr, "bench");
@@ -202,7 +644,7 @@ void bench_span_annonate_wcstr(benchmark::State &state)
         span << std::make_pair(zipkin::TraceKeys::CLIENT_SEND, L"hello world");
     }
 
-    state.SetItemsProcessed(span.message().binary_annotations.size());
+    state.SetItemsProcessed(state.iterations());
 }
 
 BENCHMARK(bench_span_annonate_wcstr);
@@ -217,7 +659,7 @@ void bench_span_annonate_wstring(benchmark::State &state)
         span << std::make_pair(zipkin::TraceKeys::CLIENT_SEND, value);
     }
 
-    state.SetItemsProcessed(span.message().binary_annotations.size());
+    state.SetItemsProcessed(state.iterations());
 }
 
 BENCHMARK(bench_span_annonate_wstring);
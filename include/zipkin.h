@@ -127,93 +127,102 @@ zipkin_span_t zipkin_span_set_debug(zipkin_span_t span, int debug);
 int zipkin_span_sampled(zipkin_span_t span);
 zipkin_span_t zipkin_span_set_sampled(zipkin_span_t span, int sampled);
 
+/**
+ * \brief The span records its annotations, when it is sampled or debug
+ *
+ * The ANNOTATE macros skip the unsampled spans without evaluating their arguments.
+ */
+int zipkin_span_recording(zipkin_span_t span);
+
+#define ZIPKIN_SPAN_RECORDING(span) ((span) && zipkin_span_recording(span))
+
 zipkin_userdata_t zipkin_span_userdata(zipkin_span_t span);
 zipkin_span_t zipkin_span_set_userdata(zipkin_span_t span, zipkin_userdata_t userdata);
 
 #define ANNOTATE(span, value, endpoint)                  \
-    if (span)                                            \
+    if (ZIPKIN_SPAN_RECORDING(span))                     \
     {                                                    \
         zipkin_span_annotate(span, value, -1, endpoint); \
     }
 #define ANNOTATE_IF(expr, span, value, endpoint)         \
-    if (span && (expr))                                  \
+    if (ZIPKIN_SPAN_RECORDING(span) && (expr))           \
     {                                                    \
         zipkin_span_annotate(span, value, -1, endpoint); \
     }
 
 #define ANNOTATE_BOOL(span, key, value, endpoint)              \
-    if (span)                                                  \
+    if (ZIPKIN_SPAN_RECORDING(span))                           \
     {                                                          \
         zipkin_span_annotate_bool(span, key, value, endpoint); \
     }
 #define ANNOTATE_BOOL_IF(expr, span, key, value, endpoint)     \
-    if (span && (expr))                                        \
+    if (ZIPKIN_SPAN_RECORDING(span) && (expr))                 \
     {                                                          \
         zipkin_span_annotate_bool(span, key, value, endpoint); \
     }
 
 #define ANNOTATE_BYTES(span, key, value, len, endpoint)              \
-    if (span)                                                        \
+    if (ZIPKIN_SPAN_RECORDING(span))                                 \
     {                                                                \
         zipkin_span_annotate_bytes(span, key, value, len, endpoint); \
     }
 #define ANNOTATE_BYTES_IF(expr, span, key, value, len, endpoint)     \
-    if (span && (expr))                                              \
+    if (ZIPKIN_SPAN_RECORDING(span) && (expr))                       \
     {                                                                \
         zipkin_span_annotate_bytes(span, key, value, len, endpoint); \
     }
 
 #define ANNOTATE_INT16(span, key, value, endpoint)              \
-    if (span)                                                   \
+    if (ZIPKIN_SPAN_RECORDING(span))                            \
     {                                                           \
         zipkin_span_annotate_int16(span, key, value, endpoint); \
     }
 #define ANNOTATE_INT16_IF(expr, span, key, value, endpoint)     \
-    if (span && (expr))                                         \
+    if (ZIPKIN_SPAN_RECORDING(span) && (expr))                  \
     {                                                           \
         zipkin_span_annotate_int16(span, key, value, endpoint); \
     }
 
 #define ANNOTATE_INT32(span, key, value, endpoint)              \
-    if (span)                                                   \
+    if (ZIPKIN_SPAN_RECORDING(span))                            \
     {                                                           \
         zipkin_span_annotate_int32(span, key, value, endpoint); \
     }
 #define ANNOTATE_INT32_IF(expr, span, key, value, endpoint)     \
-    if (span && (expr))                                         \
+    if (ZIPKIN_SPAN_RECORDING(span) && (expr))                  \
     {                                                           \
         zipkin_span_annotate_int32(span, key, value, endpoint); \
     }
 
 #define ANNOTATE_INT64(span, key, value, endpoint)              \
-    if (span)                                                   \
+    if (ZIPKIN_SPAN_RECORDING(span))                            \
     {                                                           \
         zipkin_span_annotate_int64(span, key, value, endpoint); \
     }
 #define ANNOTATE_INT64_IF(expr, span, key, value, endpoint)     \
-    if (span && (expr))                                         \
+    if (ZIPKIN_SPAN_RECORDING(span) && (expr))                  \
     {                                                           \
         zipkin_span_annotate_int64(span, key, value, endpoint); \
     }
 
 #define ANNOTATE_DOUBLE(span, key, value, endpoint)              \
-    if (span)                                                    \
+    if (ZIPKIN_SPAN_RECORDING(span))                             \
     {                                                            \
         zipkin_span_annotate_double(span, key, value, endpoint); \
     }
 #define ANNOTATE_DOUBLE_IF(expr, span, key, value, endpoint)     \
-    if (span && (expr))                                          \
+    if (ZIPKIN_SPAN_RECORDING(span) && (expr))                   \
     {                                                            \
         zipkin_span_annotate_double(span, key, value, endpoint); \
     }
 
 #define ANNOTATE_STR(span, key, value, len, endpoint)              \
-    if (span)                                                      \
+    if (ZIPKIN_SPAN_RECORDING(span))                               \
     {                                                              \
         zipkin_span_annotate_str(span, key, value, len, endpoint); \
     }
 #define ANNOTATE_STR_IF(expr, span, key, value, len, endpoint)     \
-    if (span && (expr))                                            \
+    if (ZIPKIN_SPAN_RECORDING(span) && (expr))                     \
     {                                                              \
         zipkin_span_annotate_str(span, key, value, len, endpoint); \
     }
@@ -0,0 +1,141 @@
+#include "Arena.h"
+
+#include <algorithm>
+
+#include <glog/logging.h>
+
+namespace zipkin
+{
+
+constexpr size_t Arena::DEFAULT_ALIGN;
+constexpr size_t Arena::DEFAULT_BLOCK_SIZE;
+
+size_t Arena::reserved(void) const
+{
+    size_t size = 0;
+
+    for (Block *block = m_blocks; block; block = block->next)
+    {
+        size += block->size;
+    }
+
+    return size;
+}
+
+size_t Arena::allocated(void) const
+{
+    size_t size = used();
+
+    for (Block *block = m_blocks; block; block = block->next)
+    {
+        size += block->used;
+    }
+
+    return size;
+}
+
+void Arena::reserve(size_t size)
+{
+    size_t free = available();
+    Block *last = nullptr;
+
+    for (Block *block = m_current; block && free < size; block = block->next)
+    {
+        free += block->size - block->used;
+        last = block;
+    }
+
+    if (free >= size)
+        return;
+
+    while (last && last->next)
+    {
+        last = last->next;
+    }
+
+    Block *block = grow(std::max(DEFAULT_BLOCK_SIZE, size - free), last);
+
+    if (!m_current)
+        m_current = block;
+}
+
+Arena::Block *Arena::grow(size_t size, Block *last)
+{
+    Block *block = static_cast<Block *>(::operator new(sizeof(Block) + size));
+
+    block->next = nullptr;
+    block->size = size;
+    block->used = 0;
+
+    VLOG(3) << "Arena @ " << this << " allocated block @ " << block << " with " << size << " bytes";
+
+    if (last)
+    {
+        last->next = block;
+    }
+    else
+    {
+        m_blocks = block;
+    }
+
+    return block;
+}
+
+void *Arena::allocate_slow(size_t size, size_t align)
+{
+    Block *last = nullptr;
+
+    for (Block *block = m_current; block; block = block->next)
+    {
+        uintptr_t base = reinterpret_cast<uintptr_t>(block->data);
+        uintptr_t p = (base + block->used + align - 1) & ~(align - 1);
+
+        if (p + size <= base + block->size)
+        {
+            block->used = p + size - base;
+            m_current = block;
+
+            return reinterpret_cast<void *>(p);
+        }
+
+        last = block;
+    }
+
+    size_t block_size = std::max(DEFAULT_BLOCK_SIZE, size + align);
+
+    if (last)
+        block_size = std::max(block_size, last->size * 2);
+
+    m_current = grow(block_size, last);
+
+    return allocate_slow(size, align);
+}
+
+void Arena::reset(void)
+{
+    m_top = m_end;
+
+    for (Block *block = m_blocks; block; block = block->next)
+    {
+        block->used = 0;
+    }
+
+    m_current = m_blocks;
+}
+
+void Arena::purge(void)
+{
+    while (m_blocks)
+    {
+        Block *block = m_blocks;
+
+        m_blocks = block->next;
+
+        ::operator delete(block);
+    }
+
+    m_current = nullptr;
+    m_top = m_end;
+}
+
+} // namespace zipkin
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+namespace zipkin
+{
+
+/**
+* \brief Bump allocator for the per-span annotation storage.
+*
+* Arena hands out memory from an optional borrowed buffer first, for example the trailing buffer of CachedSpan,
+* and spills to heap blocks once it is exhausted. The borrowed buffer is consumed from its end downward,
+* so the free space left at its beginning can still be used as a contiguous scratch buffer.
+*
+* Heap blocks are retained across #reset, a reused span records annotations without touching the heap
+* after it has seen its largest shape once.
+*/
+class Arena
+{
+    struct Block
+    {
+        Block *next;
+        size_t size;
+        size_t used;
+        uint8_t data[0] __attribute__((aligned));
+    };
+
+    uint8_t *m_base = nullptr;
+    uint8_t *m_end = nullptr;
+    uint8_t *m_top = nullptr;
+
+    Block *m_blocks = nullptr;
+    Block *m_current = nullptr;
+
+    void *allocate_slow(size_t size, size_t align);
+
+    Block *grow(size_t size, Block *last);
+
+  public:
+    static constexpr size_t DEFAULT_ALIGN = alignof(uint64_t);
+    static constexpr size_t DEFAULT_BLOCK_SIZE = 1024;
+
+    Arena(uint8_t *buf = nullptr, size_t size = 0) { assign(buf, size); }
+
+    ~Arena() { purge(); }
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    /**
+    * \brief Use a borrowed buffer before falling back to the heap
+    */
+    inline void assign(uint8_t *buf, size_t size)
+    {
+        m_base = buf;
+        m_end = m_top = buf + size;
+    }
+
+    /**
+    * \brief Free space left in the borrowed buffer, starting at its beginning
+    */
+    inline size_t available(void) const { return m_top - m_base; }
+
+    /**
+    * \brief Bytes of the borrowed buffer in use
+    */
+    inline size_t used(void) const { return m_end - m_top; }
+
+    /**
+    * \brief Bytes reserved in heap blocks
+    */
+    size_t reserved(void) const;
+
+    /**
+    * \brief Bytes in use, in the borrowed buffer and the heap blocks
+    */
+    size_t allocated(void) const;
+
+    /**
+    * \brief Make sure at least \p size bytes could be allocated without growing later
+    *
+    * The shortfall is allocated as one heap block, instead of the doubling blocks of the slow path.
+    */
+    void reserve(size_t size);
+
+    inline void *allocate(size_t size, size_t align = DEFAULT_ALIGN)
+    {
+        uintptr_t p = (reinterpret_cast<uintptr_t>(m_top) - size) & ~(align - 1);
+
+        if (size <= available() && p >= reinterpret_cast<uintptr_t>(m_base))
+        {
+            m_top = reinterpret_cast<uint8_t *>(p);
+
+            return m_top;
+        }
+
+        return allocate_slow(size, align);
+    }
+
+    template <typename T>
+    inline T *create(void)
+    {
+        return new (allocate(sizeof(T), alignof(T))) T();
+    }
+
+    inline const char *copy(const char *str, size_t len)
+    {
+        if (!len)
+            return "";
+
+        char *p = static_cast<char *>(allocate(len, 1));
+
+        memcpy(p, str, len);
+
+        return p;
+    }
+
+    /**
+    * \brief Release all the allocations but keep the heap blocks for reusing
+    */
+    void reset(void);
+
+    /**
+    * \brief Release all the heap blocks
+    */
+    void purge(void);
+};
+
+} // namespace zipkin
@@ -27,13 +27,15 @@ void zipkin_set_logging_level(enum zipkin_logger_level_t level)
 
 zipkin_endpoint_t zipkin_endpoint_new(const char *service, struct sockaddr *addr)
 {
-    return new zipkin::Endpoint(service ? std::string(service) : std::string(), addr);
+    zipkin::Endpoint endpoint(service ? std::string(service) : std::string(), addr);
+
+    return const_cast<zipkin::Endpoint *>(zipkin::EndpointRegistry::instance().acquire(endpoint));
 }
 void zipkin_endpoint_free(zipkin_endpoint_t endpoint)
 {
     assert(endpoint);
 
-    delete static_cast<zipkin::Endpoint *>(endpoint);
+    zipkin::EndpointRegistry::instance().release(static_cast<zipkin::Endpoint *>(endpoint));
 }
 const char *zipkin_endpoint_service_name(zipkin_endpoint_t endpoint)
 {
@@ -165,6 +167,10 @@ zipkin_span_t zipkin_span_set_sampled(zipkin_span_t span, int sampled)
 
     return span;
 }
+int zipkin_span_recording(zipkin_span_t span)
+{
+    return span ? static_cast<zipkin::Span *>(span)->recording() : false;
+}
 zipkin_userdata_t zipkin_span_userdata(zipkin_span_t span)
 {
     if (span)
@@ -185,7 +191,7 @@ void zipkin_span_annotate(zipkin_span_t span, const char *value, int len, zipkin
     assert(span);
     assert(value);
 
-    static_cast<zipkin::Span *>(span)->annotate(std::string(value, len < 0 ? strlen(value) : len),
+    static_cast<zipkin::Span *>(span)->annotate(zipkin::string_view(value, len < 0 ? strlen(value) : len),
                                                 static_cast<const zipkin::Endpoint *>(endpoint));
 }
 void zipkin_span_annotate_bool(zipkin_span_t span, const char *key, int value, zipkin_endpoint_t endpoint)
@@ -202,7 +208,7 @@ void zipkin_span_annotate_bytes(zipkin_span_t span, const char *key, const char
     assert(value);
     assert(len);
 
-    static_cast<zipkin::Span *>(span)->annotate(key, std::vector<uint8_t>(value, value + len), static_cast<zipkin::Endpoint *>(endpoint));
+    static_cast<zipkin::Span *>(span)->annotate(key, reinterpret_cast<const uint8_t *>(value), len, static_cast<zipkin::Endpoint *>(endpoint));
 }
 void zipkin_span_annotate_int16(zipkin_span_t span, const char *key, int16_t value, zipkin_endpoint_t endpoint)
 {
@@ -240,7 +246,7 @@ void zipkin_span_annotate_str(zipkin_span_t span, const char *key, const char *v
     assert(len);
 
     static_cast<zipkin::Span *>(span)->annotate(key,
-                                                std::string(value, len < 0 ? strlen(value) : len),
+                                                zipkin::string_view(value, len < 0 ? strlen(value) : len),
                                                 static_cast<zipkin::Endpoint *>(endpoint));
 }
 
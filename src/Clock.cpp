@@ -0,0 +1,95 @@
+#include "Clock.h"
+
+#include <chrono>
+#include <thread>
+
+#ifdef ZIPKIN_HAS_TSC
+#include <cpuid.h>
+#endif
+
+#include <glog/logging.h>
+
+namespace zipkin
+{
+
+#ifdef ZIPKIN_HAS_TSC
+static bool invariant_tsc(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    // CPUID.80000007H:EDX[8], the TSC ticks at a constant rate in all the ACPI P-, C- and T-states
+    return __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && (edx & (1 << 8));
+}
+#endif
+
+Clock::Clock(Mode mode) : m_mode(mode), m_realtime(CLOCK_REALTIME), m_monotonic(CLOCK_MONOTONIC), m_ticks_per_usec(0)
+{
+    switch (mode)
+    {
+    case PRECISE:
+        break;
+
+    case COARSE:
+#ifdef CLOCK_REALTIME_COARSE
+        m_realtime = CLOCK_REALTIME_COARSE;
+        m_monotonic = CLOCK_MONOTONIC_COARSE;
+#else
+        LOG(WARNING) << "coarse clock is not supported, fallback to the precise clock";
+
+        m_mode = PRECISE;
+#endif
+        break;
+
+    case TSC:
+#ifdef ZIPKIN_HAS_TSC
+        if (invariant_tsc())
+        {
+            int64_t start_ns = read(CLOCK_MONOTONIC);
+            uint64_t start_ticks = __rdtsc();
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+            int64_t end_ns = read(CLOCK_MONOTONIC);
+            uint64_t end_ticks = __rdtsc();
+
+            m_ticks_per_usec = static_cast<double>(end_ticks - start_ticks) * 1000 / (end_ns - start_ns);
+
+            VLOG(1) << "TSC clock calibrated, " << m_ticks_per_usec << " ticks/us";
+        }
+        else
+        {
+            LOG(WARNING) << "TSC is not invariant, fallback to the precise clock";
+
+            m_mode = PRECISE;
+        }
+#else
+        LOG(WARNING) << "TSC clock is not supported, fallback to the precise clock";
+
+        m_mode = PRECISE;
+#endif
+        break;
+    }
+}
+
+Clock *Clock::get(Mode mode)
+{
+    static Clock precise(PRECISE), coarse(COARSE);
+
+    switch (mode)
+    {
+    case COARSE:
+        return &coarse;
+
+    case TSC:
+    {
+        static Clock tsc(TSC);
+
+        return &tsc;
+    }
+
+    default:
+        return &precise;
+    }
+}
+
+} // namespace zipkin
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstdint>
+
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define ZIPKIN_HAS_TSC 1
+#endif
+
+namespace zipkin
+{
+
+/**
+* \brief Time source of the spans
+*
+* A span anchors one wall-clock timestamp when it starts, the annotation timestamps and the duration
+* are derived from a monotonic counter, so they are cheap to read and never go backward on NTP steps.
+*
+* \sa Tracer#set_clock
+*/
+class Clock
+{
+  public:
+    enum Mode
+    {
+        PRECISE, ///< `CLOCK_REALTIME` anchor and `CLOCK_MONOTONIC` counter
+        COARSE,  ///< `CLOCK_REALTIME_COARSE` anchor and `CLOCK_MONOTONIC_COARSE` counter, a few milliseconds resolution
+        TSC      ///< `CLOCK_REALTIME` anchor and the calibrated CPU timestamp counter, PRECISE without an invariant TSC
+    };
+
+  private:
+    Mode m_mode;
+    clockid_t m_realtime, m_monotonic;
+    double m_ticks_per_usec;
+
+    Clock(Mode mode);
+
+    static inline int64_t read(clockid_t clock)
+    {
+        struct timespec ts;
+
+        clock_gettime(clock, &ts);
+
+        return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+
+  public:
+    /**
+    * \brief The shared clock of the mode
+    *
+    * The TSC clock is calibrated for 10 milliseconds on its first get, so it is selected when the tracer is configured,
+    * see Tracer#set_clock, never on the path of a request. It falls back to PRECISE on the CPUs without
+    * an invariant TSC (`CPUID.80000007H:EDX[8]`).
+    */
+    static Clock *get(Mode mode);
+
+    static Clock *precise(void) { return get(PRECISE); }
+
+    inline Mode mode(void) const { return m_mode; }
+
+    /**
+    * \brief Wall-clock time since epoch, in microseconds
+    */
+    inline int64_t wall(void) const { return read(m_realtime) / 1000; }
+
+    /**
+    * \brief Monotonic counter, in the unit of the mode
+    */
+    inline uint64_t ticks(void) const
+    {
+#ifdef ZIPKIN_HAS_TSC
+        if (m_mode == TSC)
+            return __rdtsc();
+#endif
+        return read(m_monotonic);
+    }
+
+    /**
+    * \brief Microseconds elapsed since the ticks was read
+    */
+    inline int64_t elapsed(uint64_t since) const
+    {
+        uint64_t now = ticks();
+
+        if (now <= since)
+            return 0;
+
+        return m_mode == TSC ? static_cast<int64_t>((now - since) / m_ticks_per_usec) : static_cast<int64_t>((now - since) / 1000);
+    }
+};
+
+} // namespace zipkin
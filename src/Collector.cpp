@@ -1,5 +1,8 @@
 #include "Collector.h"
 
+#include <random>
+#include <functional>
+
 #include <thrift/protocol/TBinaryProtocol.h>
 
 #define RAPIDJSON_HAS_STDSTRING 1
@@ -8,6 +11,7 @@
 
 #include <folly/Uri.h>
 
+#include "Tracer.h"
 #include "KafkaCollector.h"
 #ifdef WITH_CURL
 #include "HttpCollector.h"
@@ -49,6 +53,37 @@ const std::string to_string(CompressionCodec codec)
     }
 }
 
+BaseConf::OverflowPolicy parse_overflow_policy(const std::string &policy)
+{
+    if (policy == "drop_oldest")
+        return BaseConf::DROP_OLDEST;
+    if (policy == "block")
+        return BaseConf::BLOCK;
+    if (policy == "shed")
+        return BaseConf::SHED;
+    if (policy != "drop_newest")
+        LOG(WARNING) << "unknown overflow policy `" << policy << "`, drop the newest spans";
+
+    return BaseConf::DROP_NEWEST;
+}
+
+const std::string to_string(BaseConf::OverflowPolicy policy)
+{
+    switch (policy)
+    {
+    case BaseConf::DROP_NEWEST:
+        return "drop_newest";
+    case BaseConf::DROP_OLDEST:
+        return "drop_oldest";
+    case BaseConf::BLOCK:
+        return "block";
+    case BaseConf::SHED:
+        return "shed";
+    }
+
+    return "unknown";
+}
+
 std::shared_ptr<MessageCodec> MessageCodec::parse(const std::string &codec)
 {
     if (codec == "binary")
@@ -61,6 +96,37 @@ std::shared_ptr<MessageCodec> MessageCodec::parse(const std::string &codec)
     return nullptr;
 }
 
+size_t MessageCodec::estimate(const Span *span) const
+{
+    size_t endpoints, text = span->text_size(&endpoints);
+
+    return 256 + text * 2 + 128 * (span->annotations_size() + span->binary_annotations_size()) + 160 * endpoints;
+}
+
+size_t BinaryCodec::estimate(const Span *span) const
+{
+    size_t endpoints, text = span->text_size(&endpoints);
+
+    // the thrift fields of the header, the annotations and their endpoints
+    return 96 + text + 20 * span->annotations_size() + 24 * span->binary_annotations_size() + 24 * endpoints;
+}
+
+size_t JsonCodec::estimate(const Span *span) const
+{
+    size_t endpoints, text = span->text_size(&endpoints);
+
+    // the escaped characters and the base64 values are longer than the text
+    return 192 + text + text / 8 + 48 * span->annotations_size() + 32 * span->binary_annotations_size() + 72 * endpoints;
+}
+
+size_t PrettyJsonCodec::estimate(const Span *span) const
+{
+    size_t endpoints, text = span->text_size(&endpoints);
+
+    // the indents of each line
+    return 288 + text + text / 8 + 112 * span->annotations_size() + 104 * span->binary_annotations_size() + 168 * endpoints;
+}
+
 size_t BinaryCodec::encode(boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> buf, const std::vector<Span *> &spans)
 {
     apache::thrift::protocol::TBinaryProtocol protocol(buf);
@@ -152,140 +218,713 @@ Collector *Collector::create(const std::string &uri)
     return nullptr;
 }
 
+constexpr size_t BaseCollector::MAX_THREAD_BATCHES;
+
+std::mutex &BaseCollector::registry(void)
+{
+    // never destroyed, the batches of the exiting threads are handed over during the static destruction
+    static std::mutex *mutex = new std::mutex();
+
+    return *mutex;
+}
+
+BaseCollector::ThreadBatches &BaseCollector::thread_batches(void)
+{
+    static thread_local ThreadBatches batches;
+
+    return batches;
+}
+
+BaseCollector::ThreadBatches::~ThreadBatches()
+{
+    std::lock_guard<std::mutex> lock(registry());
+
+    for (ThreadBatch &batch : slots)
+    {
+        BaseCollector *collector = batch.collector.load(std::memory_order_relaxed);
+
+        if (!collector)
+            continue;
+
+        collector->hand_over(batch);
+
+        for (ThreadBatch **p = &collector->m_batches; *p; p = &(*p)->next)
+        {
+            if (*p == &batch)
+            {
+                *p = batch.next;
+                break;
+            }
+        }
+
+        batch.collector.store(nullptr, std::memory_order_relaxed);
+        batch.next = nullptr;
+    }
+}
+
+BaseCollector::ThreadBatch *BaseCollector::thread_batch(void)
+{
+    ThreadBatches &batches = thread_batches();
+    ThreadBatch *unused = nullptr;
+
+    for (ThreadBatch &batch : batches.slots)
+    {
+        BaseCollector *collector = batch.collector.load(std::memory_order_acquire);
+
+        if (collector == this)
+            return &batch;
+
+        if (!collector && !unused)
+            unused = &batch;
+    }
+
+    if (unused)
+    {
+        std::lock_guard<std::mutex> lock(registry());
+
+        for (ThreadSpans &buffer : unused->buffers)
+        {
+            buffer.spans.reserve(m_conf->thread_batch_size);
+        }
+
+        unused->last = &unused->buffers[0];
+        unused->published.store(unused->last, std::memory_order_release);
+        unused->next = m_batches;
+        unused->collector.store(this, std::memory_order_release);
+
+        m_batches = unused;
+    }
+
+    return unused;
+}
+
+void BaseCollector::unregister_batches(void)
+{
+    std::lock_guard<std::mutex> lock(registry());
+
+    for (ThreadBatch *batch = m_batches, *next; batch; batch = next)
+    {
+        // the collector thread is gone, nobody would send them
+        if (ThreadSpans *spans = batch->published.exchange(nullptr, std::memory_order_acq_rel))
+        {
+            for (Span *span : spans->spans)
+            {
+                span->release();
+            }
+
+            spans->spans.clear();
+            spans->bytes = 0;
+        }
+
+        batch->collector.store(nullptr, std::memory_order_release);
+
+        next = batch->next;
+        batch->next = nullptr;
+    }
+
+    m_batches = nullptr;
+}
+
 void BaseCollector::submit(Span *span)
 {
-    while (m_queued_spans >= m_conf->backlog)
+    ThreadBatch *batch = m_conf->thread_batch_size > 1 ? thread_batch() : nullptr;
+
+    // the submitted span is finished, it is estimated once and the estimate is reused when it is queued and popped
+    if (m_conf->max_batch_bytes || m_conf->max_message_bytes)
+        span->with_estimated_bytes(m_conf->message_codec->estimate(span));
+
+    size_t bytes = m_conf->max_batch_bytes ? span->estimated_bytes() : 0;
+
+    if (!batch)
     {
-        if (drop_front_span())
-            m_queued_spans--;
+        push_spans(&span, 1, bytes, true);
+
+        return;
+    }
+
+    // the spans are owned by this thread until they are published again, a hand-over meanwhile finds nothing
+    ThreadSpans *spans = batch->published.exchange(nullptr, std::memory_order_acquire);
+
+    if (!spans)
+    {
+        // handed over by another thread since the last submit, continue with the other buffer
+        spans = batch->last == &batch->buffers[0] ? &batch->buffers[1] : &batch->buffers[0];
+        batch->last = spans;
+    }
+
+    spans->bytes += bytes;
+
+    if (spans->spans.empty())
+    {
+        spans->since = m_clock->ticks();
+        spans->spans.push_back(span);
+
+        // start the batch interval of the first pending batch
+        if (0 == m_pending_batches.fetch_add(1, std::memory_order_relaxed))
+            m_wakeup.notify();
+    }
+    else
+    {
+        spans->spans.push_back(span);
+
+        if (spans->spans.size() >= m_conf->thread_batch_size ||
+            m_clock->elapsed(spans->since) >= std::chrono::duration_cast<std::chrono::microseconds>(m_conf->thread_batch_age).count())
+        {
+            m_pending_batches.fetch_sub(1, std::memory_order_relaxed);
+
+            // the BLOCK policy may wait for the collector thread, the spans are not published meanwhile
+            push_spans(spans->spans.data(), spans->spans.size(), spans->bytes, true);
+
+            spans->spans.clear();
+            spans->bytes = 0;
+        }
+    }
+
+    batch->published.store(spans, std::memory_order_release);
+}
+
+void BaseCollector::push_spans(Span **spans, size_t count, size_t bytes, bool wait)
+{
+    if (m_conf->overflow_policy == BaseConf::SHED)
+    {
+        count = shed_spans(spans, count, bytes);
+
+        if (!count)
+            return;
+    }
+
+    // count the bytes before the spans could be popped, the consumer never sees less bytes than the queued spans
+    size_t queued_bytes = bytes ? m_queued_bytes.fetch_add(bytes, std::memory_order_relaxed) + bytes : 0;
+    size_t queued = 0, pushed = m_spans.push(spans, count, queued);
+
+    if (pushed < count)
+        pushed += overflow(spans + pushed, count - pushed, queued, wait);
+
+    if (pushed && (queued == pushed || queued >= m_conf->batch_size ||
+                   (m_conf->max_batch_bytes && queued_bytes >= m_conf->max_batch_bytes)))
+    {
+        // start the batch interval of the first span, or send a full batch
+        m_wakeup.notify();
+    }
+}
+
+void BaseCollector::hand_over(ThreadBatch &batch)
+{
+    // the owner thread publishes the other buffer on its next submit, an empty one is taken as well
+    ThreadSpans *spans = batch.published.exchange(nullptr, std::memory_order_acq_rel);
+
+    if (!spans || spans->spans.empty())
+        return;
+
+    push_spans(spans->spans.data(), spans->spans.size(), spans->bytes, false);
+
+    spans->spans.clear();
+    spans->bytes = 0;
+
+    m_pending_batches.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void BaseCollector::hand_over_all(void)
+{
+    if (!m_pending_batches.load(std::memory_order_relaxed))
+        return;
+
+    std::lock_guard<std::mutex> lock(registry());
+
+    for (ThreadBatch *batch = m_batches; batch; batch = batch->next)
+    {
+        hand_over(*batch);
     }
+}
+
+size_t BaseCollector::shed_spans(Span **spans, size_t count, size_t &bytes)
+{
+    double capacity = m_spans.capacity(), threshold = capacity * m_conf->shed_threshold, queued = m_spans.size();
+
+    if (queued < threshold)
+        return count;
+
+    double probability = threshold < capacity ? (queued - threshold) / (capacity - threshold) : 1.0;
 
-    if (m_spans.push(span))
-        m_queued_spans++;
+    static thread_local std::minstd_rand engine(std::hash<std::thread::id>()(std::this_thread::get_id()));
+    std::uniform_real_distribution<double> uniform;
+
+    size_t kept = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (uniform(engine) < probability)
+        {
+            if (bytes)
+                bytes -= spans[i]->estimated_bytes();
+
+            drop_span(spans[i], m_shed_spans);
+        }
+        else
+        {
+            spans[kept++] = spans[i];
+        }
+    }
 
-    if (m_queued_spans >= m_conf->batch_size)
-        flush(std::chrono::milliseconds(0));
+    return kept;
 }
 
-bool BaseCollector::drop_front_span()
+size_t BaseCollector::overflow(Span **spans, size_t count, size_t &queued, bool wait)
 {
-    CachedSpan *span = nullptr;
+    size_t pushed = 0;
+    std::atomic_size_t *dropped = &m_dropped_backlog;
 
-    if (m_spans.pop(span) && span)
+    switch (m_conf->overflow_policy)
     {
-        LOG(WARNING) << "Drop Span `" << std::hex << span->id() << " exceed backlog";
+    case BaseConf::DROP_OLDEST:
+        for (; pushed < count; pushed++)
+        {
+            Span *oldest;
+
+            if (m_spans.pop(oldest))
+            {
+                unqueue_bytes(oldest);
+                drop_span(oldest, m_evicted_spans);
+
+                // the evicted span was pushed, don't let the flush wait for it
+                sent(1);
+            }
+
+            if (!m_spans.push(spans[pushed], queued))
+                break;
+        }
+        break;
+
+    case BaseConf::BLOCK:
+        if (wait)
+        {
+            typedef std::chrono::steady_clock clock;
+
+            clock::time_point deadline = clock::now() + m_conf->block_timeout;
+
+            for (clock::time_point now = clock::now(); !m_terminated && now < deadline; now = clock::now())
+            {
+                // a full backlog is a full batch
+                m_wakeup.notify();
+
+                m_space.wait(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now) + std::chrono::milliseconds(1),
+                             [this] { return m_terminated || m_spans.size() < m_spans.capacity(); });
 
-        span->release();
+                pushed += m_spans.push(spans + pushed, count - pushed, queued);
 
-        return true;
+                if (pushed == count)
+                    return pushed;
+            }
+
+            if (!m_terminated)
+                dropped = &m_timed_out_spans;
+        }
+        break;
+
+    default:
+        break;
     }
 
-    return false;
+    for (size_t i = pushed; i < count; i++)
+    {
+        unqueue_bytes(spans[i]);
+        drop_span(spans[i], *dropped);
+    }
+
+    return pushed;
+}
+
+void BaseCollector::unqueue_bytes(Span *span)
+{
+    if (m_conf->max_batch_bytes)
+        m_queued_bytes.fetch_sub(span->estimated_bytes(), std::memory_order_relaxed);
+}
+
+void BaseCollector::drop_span(Span *span, std::atomic_size_t &counter)
+{
+    VLOG(2) << "drop span `" << std::hex << span->id() << "`";
+
+    span->release();
+
+    counter.fetch_add(1, std::memory_order_relaxed);
+}
+
+BaseCollector::Drops BaseCollector::drops(void) const
+{
+    return Drops{m_dropped_backlog.load(std::memory_order_relaxed), m_evicted_spans.load(std::memory_order_relaxed),
+                 m_timed_out_spans.load(std::memory_order_relaxed), m_shed_spans.load(std::memory_order_relaxed),
+                 m_oversize_spans.load(std::memory_order_relaxed)};
+}
+
+void BaseCollector::report_drops(bool force)
+{
+    Drops drops = this->drops();
+    size_t total = drops.total();
+
+    if (total == m_reported_drops)
+        return;
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+    if (!force && now - m_drops_reported_at < m_conf->drop_log_interval)
+        return;
+
+    // the collector may be destructing, the virtual name() is not available
+    LOG(WARNING) << "Dropped " << (total - m_reported_drops) << " spans, " << total << " in total (backlog "
+                 << drops.backlog << ", evicted " << drops.evicted << ", timeout " << drops.timeout << ", shed "
+                 << drops.shed << ", oversize " << drops.oversize << ")";
+
+    m_reported_drops = total;
+    m_drops_reported_at = now;
 }
 
 bool BaseCollector::flush(std::chrono::milliseconds timeout_ms)
 {
+    hand_over_all();
+
     std::unique_lock<std::mutex> lock(m_sending);
 
-    m_flush.notify_one();
+    size_t pushed = m_spans.pushed();
 
     if (m_terminated)
     {
         VLOG(3) << "shutdown " << name() << " collector and wait " << timeout_ms.count() << " ms";
     }
-    else if (m_spans.empty())
+    else if (pushed == m_sent_spans)
     {
         VLOG(3) << "no pendding spans to flush";
     }
     else
     {
-        VLOG(3) << "flush pendding " << m_queued_spans << " spans and wait " << timeout_ms.count() << " ms";
+        VLOG(3) << "flush pendding " << m_spans.size() << " spans and wait " << timeout_ms.count() << " ms";
     }
 
-    return std::cv_status::no_timeout == m_sent.wait_for(lock, timeout_ms) && m_spans.empty();
+    if (pushed > m_flush_spans)
+        m_flush_spans = pushed;
+
+    m_wakeup.notify();
+
+    return m_sent.wait_for(lock, timeout_ms, [this, pushed] { return m_sent_spans >= pushed; });
 }
 
 void BaseCollector::shutdown(std::chrono::milliseconds timeout_ms)
 {
     if (m_terminated.exchange(true)) return;
 
-    if (!flush(timeout_ms) && m_worker.joinable())
+    m_space.notify();
+
+    bool flushed = flush(timeout_ms);
+
+    if (m_worker.joinable())
     {
-        VLOG(3) << "join thread " << m_worker.get_id();
+        if (flushed)
+        {
+            VLOG(3) << "join thread " << m_worker.get_id();
 
-        m_worker.join();
+            m_worker.join();
+        }
+        else
+        {
+            m_worker.detach();
+        }
     }
-
-    m_worker.detach();
 }
 
 void BaseCollector::run(BaseCollector *collector)
 {
-    LOG(INFO) << collector->name() << " collector started";
+    // the virtual methods are not ready before the derived collector was constructed
+    VLOG(1) << "collector thread " << std::this_thread::get_id() << " started";
+
+    std::vector<std::thread> encoders, senders;
+
+    // the collector thread only batches the spans when they are encoded by the encoding threads
+    for (size_t i = 0; collector->m_conf->encode_threads > 1 && i < collector->m_conf->encode_threads; i++)
+    {
+        encoders.emplace_back(&BaseCollector::encode_batches, collector);
+    }
+
+    for (size_t i = 0; i < collector->m_conf->send_threads; i++)
+    {
+        senders.emplace_back(&BaseCollector::send_messages, collector);
+    }
 
     do
     {
         collector->try_send_spans();
+    } while (!collector->m_terminated || !collector->m_spans.empty());
 
-        if (collector->m_terminated)
-        {
-            VLOG(3) << "collector thread " << std::this_thread::get_id() << " terminated";
+    collector->report_drops(true);
 
-            break;
-        }
+    // drain the stages in order
+    collector->m_encode_queue.close();
+
+    for (auto &encoder : encoders)
+    {
+        encoder.join();
+    }
 
-        std::this_thread::yield();
-    } while (!collector->m_terminated);
+    collector->m_send_queue.close();
+
+    for (auto &sender : senders)
+    {
+        sender.join();
+    }
+
+    VLOG(3) << "collector thread " << std::this_thread::get_id() << " terminated";
+
+    std::lock_guard<std::mutex> lock(collector->m_sending);
+
+    collector->m_sent.notify_all();
 }
 
 void BaseCollector::try_send_spans(void)
 {
-    std::unique_lock<std::mutex> lock(m_sending);
+    typedef std::chrono::steady_clock clock;
+
+    // a full backlog is a full batch
+    size_t batch_size = std::min(m_conf->batch_size, m_spans.capacity());
+    clock::time_point deadline = clock::now() + m_conf->batch_interval;
 
-    if (m_flush.wait_for(lock, m_conf->batch_interval, [this] { return m_terminated || !m_spans.empty(); }))
+    // sleep until the first span was submitted, then until the batch is full or the batch interval passed
+    while (!m_terminated && m_flush_spans <= m_spans.popped())
     {
-        if (!m_spans.empty())
+        size_t queued = m_spans.size();
+        bool idle = !queued && !m_pending_batches;
+
+        if (queued >= batch_size || over_budget())
+            break;
+
+        std::chrono::milliseconds timeout(0);
+
+        if (!idle)
         {
-            send_spans();
+            clock::time_point now = clock::now();
+
+            if (now >= deadline)
+                break;
+
+            timeout = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now) + std::chrono::milliseconds(1);
         }
-        else
+
+        m_wakeup.wait(timeout, [this, idle, batch_size] {
+            size_t size = m_spans.size();
+
+            return m_terminated || m_flush_spans > m_spans.popped() || size >= batch_size || over_budget() ||
+                   (idle && (size || m_pending_batches));
+        });
+
+        if (idle)
+            deadline = clock::now() + m_conf->batch_interval;
+    }
+
+    // the batches of the idle threads are sent at the batch interval
+    hand_over_all();
+
+    // close the batches by the span count and the estimated bytes
+    size_t max_bytes = m_conf->max_batch_bytes;
+
+    if (m_conf->max_message_bytes && (!max_bytes || m_conf->max_message_bytes < max_bytes))
+        max_bytes = m_conf->max_message_bytes;
+
+    std::vector<Span *> spans;
+    size_t bytes = 0, popped_bytes = 0;
+    Span *span;
+
+    while (m_spans.pop(span))
+    {
+        size_t estimated = max_bytes ? span->estimated_bytes() : 0;
+
+        if (!spans.empty() && (spans.size() >= batch_size || bytes + estimated > max_bytes))
         {
-            VLOG(1) << name() << " collector " << (m_terminated ? "terminated" : "flushed");
+            m_space.notify();
+
+            encode_batch(spans);
+
+            spans.clear();
+            bytes = 0;
         }
 
-        m_sent.notify_all();
+        spans.push_back(span);
+        bytes += estimated;
+        popped_bytes += estimated;
     }
+
+    if (m_conf->max_batch_bytes)
+        m_queued_bytes.fetch_sub(popped_bytes, std::memory_order_relaxed);
+
+    m_space.notify();
+
+    if (!spans.empty())
+        encode_batch(spans);
+
+    report_drops();
 }
 
-void BaseCollector::send_spans(void)
+bool BaseCollector::over_budget(void) const
 {
-    VLOG(2) << "sending " << m_queued_spans << " spans";
+    return m_conf->max_batch_bytes && m_queued_bytes.load(std::memory_order_relaxed) >= m_conf->max_batch_bytes;
+}
 
-    std::vector<Span *> spans;
+void BaseCollector::encode_batch(std::vector<Span *> &spans)
+{
+    VLOG(2) << "sending " << spans.size() << " spans";
 
-    m_queued_spans -= m_spans.consume_all([&spans](Span *span) {
-        spans.push_back(span);
-    });
+    if (m_conf->encode_threads > 1)
+    {
+        m_encode_queue.push(std::move(spans));
+    }
+    else
+    {
+        encode_spans(spans);
+    }
+}
 
-    if (!spans.empty())
+void BaseCollector::encode_spans(std::vector<Span *> &spans)
+{
+    VLOG(1) << "encode " << spans.size() << " spans with `" << m_conf->message_codec->name() << "` codec";
+
+    encode_message(spans);
+
+    release_spans(spans);
+}
+
+void BaseCollector::encode_message(const std::vector<Span *> &spans)
+{
+    Message message = {get_buffer(), spans.size()};
+
+    m_conf->message_codec->encode(message.buf, spans);
+
+    uint8_t *msg = nullptr;
+    uint32_t size = 0;
+
+    message.buf->getBuffer(&msg, &size);
+
+    if (m_conf->max_message_bytes && size > m_conf->max_message_bytes)
     {
-        boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> buf(new apache::thrift::transport::TMemoryBuffer());
+        put_buffer(message.buf);
 
-        VLOG(1) << "encode " << spans.size() << " spans with `" << m_conf->message_codec->name() << "` codec";
+        if (spans.size() > 1)
+        {
+            // the estimates missed, split the message instead of truncating it
+            auto middle = spans.begin() + spans.size() / 2;
 
-        m_conf->message_codec->encode(buf, spans);
+            encode_message(std::vector<Span *>(spans.begin(), middle));
+            encode_message(std::vector<Span *>(middle, spans.end()));
+        }
+        else
+        {
+            VLOG(2) << "drop span `" << std::hex << spans.front()->id() << "` of " << std::dec << size
+                    << " bytes exceed max message bytes";
+
+            m_oversize_spans.fetch_add(1, std::memory_order_relaxed);
+
+            sent(1);
+        }
+
+        return;
+    }
 
-        for (auto span : spans)
+    if (m_conf->send_threads)
+    {
+        m_send_queue.push(std::move(message));
+    }
+    else
+    {
+        send(message);
+    }
+}
+
+boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> BaseCollector::get_buffer(void)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_buffers_lock);
+
+        if (!m_buffers.empty())
         {
-            span->release();
+            boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> buf = std::move(m_buffers.back());
+
+            m_buffers.pop_back();
+
+            return buf;
         }
+    }
 
-        uint8_t *msg = nullptr;
-        uint32_t size = 0;
+    return boost::shared_ptr<apache::thrift::transport::TMemoryBuffer>(new apache::thrift::transport::TMemoryBuffer());
+}
+
+void BaseCollector::put_buffer(boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> &buf)
+{
+    // keep the allocation of the buffer for the next batch
+    buf->resetBuffer();
+
+    std::lock_guard<std::mutex> lock(m_buffers_lock);
+
+    m_buffers.push_back(std::move(buf));
+}
+
+void BaseCollector::sent(size_t spans)
+{
+    std::lock_guard<std::mutex> lock(m_sending);
+
+    m_sent_spans += spans;
+
+    m_sent.notify_all();
+}
+
+void BaseCollector::send(Message &message)
+{
+    uint8_t *msg = nullptr;
+    uint32_t size = 0;
+
+    message.buf->getBuffer(&msg, &size);
+
+    send_message(msg, size);
 
-        buf->getBuffer(&msg, &size);
+    put_buffer(message.buf);
+
+    sent(message.spans);
+}
+
+void BaseCollector::encode_batches(void)
+{
+    std::vector<Span *> spans;
 
-        send_message(msg, size);
+    while (m_encode_queue.pop(spans))
+    {
+        encode_spans(spans);
+    }
+}
+
+void BaseCollector::send_messages(void)
+{
+    Message message;
+
+    while (m_send_queue.pop(message))
+    {
+        send(message);
+    }
+}
+
+void BaseCollector::release_spans(const std::vector<Span *> &spans)
+{
+    for (size_t i = 0, j; i < spans.size(); i = j)
+    {
+        Tracer *tracer = spans[i]->tracer();
+
+        for (j = i + 1; j < spans.size() && spans[j]->tracer() == tracer; j++)
+            ;
+
+        if (tracer)
+        {
+            tracer->release(&spans[i], j - i);
+        }
+        else
+        {
+            for (size_t k = i; k < j; k++)
+            {
+                spans[k]->release();
+            }
+        }
     }
 }
 
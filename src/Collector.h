@@ -1,16 +1,19 @@
 #pragma once
 
+#include <algorithm>
 #include <chrono>
 #include <atomic>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
-
-#include <boost/lockfree/queue.hpp>
+#include <deque>
+#include <vector>
 
 #include <thrift/transport/TBufferTransports.h>
 
 #include "Span.h"
+#include "SpanRing.h"
+#include "Clock.h"
 
 namespace zipkin
 {
@@ -49,6 +52,14 @@ public:
 
   virtual size_t encode(boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> buf, const std::vector<Span *> &spans) = 0;
 
+  /**
+  * \brief Estimated bytes of a span in an encoded message, cheap enough to be called for each submitted span
+  *
+  * The collector calls it once per span at submit, see Span#estimated_bytes.
+  * The default estimate is a conservative one of the JSON encodings.
+  */
+  virtual size_t estimate(const Span *span) const;
+
   static std::shared_ptr<MessageCodec> parse(const std::string &codec);
 
   static std::shared_ptr<BinaryCodec> binary;
@@ -67,6 +78,8 @@ public:
   virtual const std::string mime_type(void) const override { return "application/x-thrift"; }
 
   virtual size_t encode(boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> buf, const std::vector<Span *> &spans) override;
+
+  virtual size_t estimate(const Span *span) const override;
 };
 
 /**
@@ -80,6 +93,8 @@ public:
   virtual const std::string mime_type(void) const override { return "application/json"; }
 
   virtual size_t encode(boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> buf, const std::vector<Span *> &spans) override;
+
+  virtual size_t estimate(const Span *span) const override;
 };
 
 /**
@@ -93,6 +108,8 @@ public:
   virtual const std::string mime_type(void) const override { return "application/json"; }
 
   virtual size_t encode(boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> buf, const std::vector<Span *> &spans) override;
+
+  virtual size_t estimate(const Span *span) const override;
 };
 
 /**
@@ -126,6 +143,11 @@ struct Collector
   */
   virtual void shutdown(std::chrono::milliseconds timeout_ms) = 0;
 
+  /**
+  * \brief Number of the spans dropped without sent, since the collector was created
+  */
+  virtual size_t dropped_spans(void) const { return 0; }
+
   static Collector *create(const std::string &uri);
 };
 
@@ -141,6 +163,8 @@ struct BaseConf
   /**
   * \brief the maximum batch size, after which a collect will be triggered.
   *
+  * The collector thread is woken up when the backlog reaches the batch size.
+  *
   * The default batch size is 100 traces.
   */
   size_t batch_size = 100;
@@ -148,35 +172,358 @@ struct BaseConf
   /**
   * \brief the maximum backlog size
   *
-  * when batch size reaches this threshold spans from the beginning of the batch will be disposed
+  * when batch size reaches this threshold the submitted spans will be handled by the #overflow_policy,
+  * the backlog is rounded up to a power of two.
   *
   * The default maximum backlog size is 1000
   */
   size_t backlog = 1000;
 
+  /**
+  * \brief the handling of the submitted spans when the backlog is full
+  */
+  enum OverflowPolicy
+  {
+    DROP_NEWEST, ///< drop the submitted span, the submit never waits
+    DROP_OLDEST, ///< evict the oldest span of the backlog, the recent spans are sent
+    BLOCK,       ///< wait up to #block_timeout for a free slot, then drop the submitted span, the least spans are lost
+    SHED,        ///< drop the submitted spans with a probability growing from the #shed_threshold to the full backlog
+  };
+
+  /**
+  * \brief the policy when the backlog is full
+  *
+  * The default overflow policy is DROP_NEWEST.
+  */
+  OverflowPolicy overflow_policy = DROP_NEWEST;
+
+  /**
+  * \brief the maximum duration a submit waits for the backlog with the BLOCK policy.
+  *
+  * The default block timeout is 10 milliseconds.
+  */
+  std::chrono::milliseconds block_timeout = std::chrono::milliseconds(10);
+
+  /**
+  * \brief the fraction of the backlog from which the SHED policy starts dropping the submitted spans.
+  *
+  * The default shed threshold is 0.75.
+  */
+  double shed_threshold = 0.75;
+
+  /**
+  * \brief the minimum interval between the logged summaries of the dropped spans.
+  *
+  * The default drop log interval is 10 seconds.
+  */
+  std::chrono::milliseconds drop_log_interval = std::chrono::seconds(10);
+
   /**
   * \brief the maximum duration we will buffer traces before emitting them to the collector.
   *
   * The default batch interval is 1 second.
   */
   std::chrono::milliseconds batch_interval = std::chrono::seconds(1);
+
+  /**
+  * \brief the maximum estimated bytes of a batch, after which a collect will be triggered.
+  *
+  * The spans are estimated by MessageCodec#estimate, 0 means the batches are only bounded by #batch_size.
+  *
+  * The default maximum batch bytes is unlimited.
+  */
+  size_t max_batch_bytes = 0;
+
+  /**
+  * \brief the maximum bytes of an encoded message, such as the datagram or request body limit of the transport.
+  *
+  * The batches are closed before their estimated bytes exceed it, and an encoded message still exceeds it is split in halves.
+  * A single span exceeds it is dropped, the messages are never truncated.
+  *
+  * The default maximum message bytes is unlimited.
+  */
+  size_t max_message_bytes = 0;
+
+  /**
+  * \brief the spans a thread buffers before handing them over to the collector at once.
+  *
+  * The spans of a thread are also handed over when the first one reaches the #thread_batch_age,
+  * when the collector is flushed or its batch interval passed, and when the thread exits.
+  * 1 hands over each span on submit.
+  *
+  * The default thread batch size is 16 spans.
+  */
+  size_t thread_batch_size = 16;
+
+  /**
+  * \brief the maximum duration a thread buffers a span while it keeps submitting.
+  *
+  * The default thread batch age is 10 milliseconds.
+  */
+  std::chrono::milliseconds thread_batch_age = std::chrono::milliseconds(10);
+
+  /**
+  * \brief the threads encoding the batches.
+  *
+  * The collector thread encodes the batches itself when 1, otherwise it hands them over to as many encoding threads.
+  *
+  * The default encode threads is 1.
+  */
+  size_t encode_threads = 1;
+
+  /**
+  * \brief the threads sending the encoded messages.
+  *
+  * The encoding threads send the messages themselves when 0. The collector must support the concurrent #send_message when more than 1.
+  *
+  * The default send threads is 1.
+  */
+  size_t send_threads = 1;
+
+  /**
+  * \brief the encoded messages waiting for a sending thread, the encoding waits when they are full.
+  *
+  * The default pending messages is 1, a message is encoded while the previous one is sent.
+  */
+  size_t pending_messages = 1;
+};
+
+/**
+ * \brief Parse an overflow policy, an unknown policy is logged and drops the newest spans
+ */
+BaseConf::OverflowPolicy parse_overflow_policy(const std::string &policy);
+const std::string to_string(BaseConf::OverflowPolicy policy);
+
+namespace __impl
+{
+
+/**
+* \brief Blocking bounded queue between the stages of a collector
+*/
+template <typename T>
+class __bounded_queue
+{
+  std::mutex m_mutex;
+  std::condition_variable m_not_empty, m_not_full;
+  std::deque<T> m_items;
+  size_t m_capacity;
+  bool m_closed = false;
+
+public:
+  __bounded_queue(size_t capacity) : m_capacity(std::max<size_t>(1, capacity)) {}
+
+  /**
+  * \brief Wait for a free slot, false when the queue was closed
+  */
+  bool push(T &&item)
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    m_not_full.wait(lock, [this] { return m_closed || m_items.size() < m_capacity; });
+
+    if (m_closed)
+      return false;
+
+    m_items.push_back(std::move(item));
+    m_not_empty.notify_one();
+
+    return true;
+  }
+
+  /**
+  * \brief Wait for an item, false when the queue was closed and drained
+  */
+  bool pop(T &item)
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    m_not_empty.wait(lock, [this] { return m_closed || !m_items.empty(); });
+
+    if (m_items.empty())
+      return false;
+
+    item = std::move(m_items.front());
+    m_items.pop_front();
+    m_not_full.notify_one();
+
+    return true;
+  }
+
+  /**
+  * \brief Wake up all the waiting threads, the queued items are still popped
+  */
+  void close(void)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_closed = true;
+    m_not_empty.notify_all();
+    m_not_full.notify_all();
+  }
 };
 
+} // namespace __impl
+
 class BaseCollector : public Collector
 {
-  boost::lockfree::queue<Span *> m_spans;
-  std::atomic_size_t m_queued_spans = ATOMIC_VAR_INIT(0);
+public:
+  static constexpr size_t MAX_THREAD_BATCHES = 8;
+
+private:
+  struct ThreadSpans
+  {
+    std::vector<Span *> spans;
+    uint64_t since = 0; // coarse ticks of the first span
+    size_t bytes = 0;   // estimated bytes of the spans, when the batches are bounded by bytes
+  };
+
+  /**
+  * \brief The spans buffered by a thread, without a lock
+  *
+  * The owner thread takes the published spans with an atomic exchange on each submit and publishes them back,
+  * another thread hands them over with an atomic exchange too, and the owner continues with the other buffer.
+  * The hand-overs are serialized by the registry lock, so the other buffer was emptied before the last one was taken.
+  */
+  struct ThreadBatch
+  {
+    std::atomic<BaseCollector *> collector = ATOMIC_VAR_INIT(nullptr);
+    std::atomic<ThreadSpans *> published = ATOMIC_VAR_INIT(nullptr); // nullptr while the owner submits or after a hand-over
+    ThreadSpans buffers[2];
+    ThreadSpans *last = nullptr; // the buffer last published by the owner thread
+    ThreadBatch *next = nullptr; // registered batches of the collector
+  };
+
+  struct ThreadBatches
+  {
+    ThreadBatch slots[MAX_THREAD_BATCHES];
+
+    ~ThreadBatches();
+  };
+
+  struct Message
+  {
+    boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> buf;
+    size_t spans;
+  };
+
+  SpanRing m_spans;
+  Wakeup m_wakeup; // the collector thread
+  Wakeup m_space;  // the submits waiting for the backlog
+  Clock *m_clock = Clock::get(Clock::COARSE);
+  ThreadBatch *m_batches = nullptr;
+  std::atomic_size_t m_pending_batches = ATOMIC_VAR_INIT(0);
+  std::atomic_size_t m_queued_bytes = ATOMIC_VAR_INIT(0);
+  std::atomic_size_t m_dropped_backlog = ATOMIC_VAR_INIT(0);
+  std::atomic_size_t m_evicted_spans = ATOMIC_VAR_INIT(0);
+  std::atomic_size_t m_timed_out_spans = ATOMIC_VAR_INIT(0);
+  std::atomic_size_t m_shed_spans = ATOMIC_VAR_INIT(0);
+  std::atomic_size_t m_oversize_spans = ATOMIC_VAR_INIT(0);
+  size_t m_reported_drops = 0; // the collector thread only
+  std::chrono::steady_clock::time_point m_drops_reported_at;
+  std::atomic_size_t m_flush_spans = ATOMIC_VAR_INIT(0);
+  std::atomic_size_t m_sent_spans = ATOMIC_VAR_INIT(0);
 
   std::thread m_worker;
   std::atomic_bool m_terminated = ATOMIC_VAR_INIT(false);
   std::mutex m_sending;
-  std::condition_variable m_flush, m_sent;
+  std::condition_variable m_sent;
+
+  __impl::__bounded_queue<std::vector<Span *>> m_encode_queue;
+  __impl::__bounded_queue<Message> m_send_queue;
+  std::mutex m_buffers_lock;
+  std::vector<boost::shared_ptr<apache::thrift::transport::TMemoryBuffer>> m_buffers; // sent buffers for reuse
+
+  void drop_span(Span *span, std::atomic_size_t &counter);
+
+  /**
+  * \brief Forget the estimated bytes of a queued span
+  */
+  void unqueue_bytes(Span *span);
+
+  /**
+  * \brief Drop the spans by the SHED policy, the kept spans are moved to the front
+  *
+  * \return the number of the kept spans
+  */
+  size_t shed_spans(Span **spans, size_t count, size_t &bytes);
 
-  bool drop_front_span(void);
+  /**
+  * \brief Handle the spans which don't fit in the backlog by the overflow policy
+  *
+  * \return the number of the pushed spans
+  */
+  size_t overflow(Span **spans, size_t count, size_t &queued, bool wait);
+
+  /**
+  * \brief Log a summary of the dropped spans, at most once per BaseConf#drop_log_interval
+  */
+  void report_drops(bool force = false);
+
+  static std::mutex &registry(void);
+
+  static ThreadBatches &thread_batches(void);
+
+  /**
+  * \brief The batch of the current thread, nullptr when the thread submits to too many collectors
+  */
+  ThreadBatch *thread_batch(void);
+
+  /**
+  * \brief Push the spans into the ring with a single claim, the spans exceed the backlog are handled by the overflow policy
+  *
+  * \param bytes the estimated bytes of the spans, when the batches are bounded by bytes
+  * \param wait the BLOCK policy may wait for the backlog, false when a lock is held
+  */
+  void push_spans(Span **spans, size_t count, size_t bytes, bool wait);
+
+  /**
+  * \brief Take the published spans of a batch and push them into the ring, with the registry lock held
+  */
+  void hand_over(ThreadBatch &batch);
+
+  /**
+  * \brief Push the spans of all the threads into the ring
+  */
+  void hand_over_all(void);
+
+  void unregister_batches(void);
 
   void try_send_spans(void);
 
-  void send_spans(void);
+  /**
+  * \brief The estimated bytes of the queued spans reached BaseConf#max_batch_bytes
+  */
+  bool over_budget(void) const;
+
+  /**
+  * \brief Pass a batch to the encoding stage
+  */
+  void encode_batch(std::vector<Span *> &spans);
+
+  /**
+  * \brief Encode a batch and pass the messages to the sending stage
+  */
+  void encode_spans(std::vector<Span *> &spans);
+
+  /**
+  * \brief Encode the spans to a message, split it when exceeds BaseConf#max_message_bytes
+  */
+  void encode_message(const std::vector<Span *> &spans);
+
+  boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> get_buffer(void);
+
+  void put_buffer(boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> &buf);
+
+  void send(Message &message);
+
+  /**
+  * \brief Count the spans sent or dropped by the stages, for the flush
+  */
+  void sent(size_t spans);
+
+  void encode_batches(void);
+
+  void send_messages(void);
 
   static void run(BaseCollector *collector);
 
@@ -185,19 +532,29 @@ protected:
 
 protected:
   BaseCollector(const BaseConf *conf)
-      : m_conf(conf), m_spans(conf->backlog), m_worker(BaseCollector::run, this)
+      : m_spans(conf->backlog), m_encode_queue(conf->encode_threads), m_send_queue(conf->pending_messages), m_conf(conf)
   {
+    m_worker = std::thread(BaseCollector::run, this);
   }
 
   virtual ~BaseCollector()
   {
+    unregister_batches();
+
     if (!m_terminated.exchange(true)) {
+      m_wakeup.notify();
+      m_space.notify();
       m_worker.detach();
     }
   }
 
   virtual void send_message(const uint8_t *msg, size_t size) = 0;
 
+  /**
+  * \brief Release the sent spans, the spans of a tracer are returned to its cache in batches
+  */
+  static void release_spans(const std::vector<Span *> &spans);
+
 public:
   // Implement Collector
 
@@ -206,6 +563,29 @@ public:
   virtual bool flush(std::chrono::milliseconds timeout_ms) override;
 
   virtual void shutdown(std::chrono::milliseconds timeout_ms) override;
+
+  virtual size_t dropped_spans(void) const override { return drops().total(); }
+
+  /**
+  * \brief The dropped spans by the reason
+  */
+  struct Drops
+  {
+    size_t backlog;  ///< the backlog was full
+    size_t evicted;  ///< evicted by the BaseConf#DROP_OLDEST policy
+    size_t timeout;  ///< waited BaseConf#block_timeout in vain
+    size_t shed;     ///< shed by the BaseConf#SHED policy
+    size_t oversize; ///< a single span exceeded BaseConf#max_message_bytes
+
+    size_t total(void) const { return backlog + evicted + timeout + shed + oversize; }
+  };
+
+  Drops drops(void) const;
+
+  /**
+  * \brief Number of the spans waiting to be sent
+  */
+  size_t queued_spans(void) const { return m_spans.size(); }
 };
 
 } // namespace zipkin
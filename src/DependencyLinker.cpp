@@ -0,0 +1,219 @@
+#include "DependencyLinker.h"
+
+#include <glog/logging.h>
+
+namespace zipkin
+{
+
+constexpr size_t DependencyLinker::MAX_LINKS;
+constexpr size_t DependencyLinker::MAX_SERVICES;
+constexpr size_t DependencyLinker::SERVICE_BUCKETS;
+
+std::ostream &operator<<(std::ostream &os, const DependencyLink &link)
+{
+    return os << link.parent << " -> " << link.child << ": calls=" << link.call_count << ", errors=" << link.error_count;
+}
+
+DependencyLinker::DependencyLinker(const DependencyConf &conf)
+    : m_conf(conf), m_overflows(0), m_service_count(0), m_service_overflows(0)
+{
+    for (size_t i = 0; i < MAX_LINKS; i++)
+    {
+        m_links[i].key.store(0, std::memory_order_relaxed);
+        m_links[i].calls.store(0, std::memory_order_relaxed);
+        m_links[i].errors.store(0, std::memory_order_relaxed);
+    }
+
+    for (size_t i = 0; i < SERVICE_BUCKETS; i++)
+    {
+        m_service_buckets[i].store(nullptr, std::memory_order_relaxed);
+    }
+
+    for (size_t i = 0; i <= MAX_SERVICES; i++)
+    {
+        m_services[i].store(nullptr, std::memory_order_relaxed);
+    }
+
+    if (m_conf.reporter)
+        m_reporter = std::thread(&DependencyLinker::report, this);
+}
+
+DependencyLinker::~DependencyLinker()
+{
+    if (m_reporter.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_reporting);
+
+            m_stopped = true;
+        }
+
+        m_stop.notify_one();
+        m_reporter.join();
+    }
+
+    for (size_t i = 0; i <= MAX_SERVICES; i++)
+    {
+        delete m_services[i].load(std::memory_order_relaxed);
+    }
+}
+
+DependencyLinker::Service *DependencyLinker::find_service(const std::string &name, size_t h) const
+{
+    size_t bucket = h % SERVICE_BUCKETS;
+    Service *service;
+
+    while ((service = m_service_buckets[bucket].load(std::memory_order_acquire)))
+    {
+        if (service->hash == h && service->name == name)
+            return service;
+
+        bucket = (bucket + 1) % SERVICE_BUCKETS;
+    }
+
+    return nullptr;
+}
+
+intern_t DependencyLinker::service(const std::string &name)
+{
+    size_t h = std::hash<std::string>()(name);
+
+    if (Service *service = find_service(name, h))
+        return service->id;
+
+    // the names past the limit are counted, never logged, the spans keep coming with them
+    if (m_service_count.load(std::memory_order_relaxed) >= MAX_SERVICES)
+    {
+        m_service_overflows.fetch_add(1, std::memory_order_relaxed);
+
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> lock(m_adding);
+
+    if (Service *service = find_service(name, h))
+        return service->id;
+
+    size_t count = m_service_count.load(std::memory_order_relaxed);
+
+    if (count >= MAX_SERVICES)
+    {
+        m_service_overflows.fetch_add(1, std::memory_order_relaxed);
+
+        return 0;
+    }
+
+    Service *service = new Service{name, h, static_cast<intern_t>(count + 1)};
+
+    size_t bucket = h % SERVICE_BUCKETS;
+
+    while (m_service_buckets[bucket].load(std::memory_order_relaxed))
+    {
+        bucket = (bucket + 1) % SERVICE_BUCKETS;
+    }
+
+    // published by id first, a span may resolve the id as soon as it finds the name
+    m_services[service->id].store(service, std::memory_order_release);
+    m_service_buckets[bucket].store(service, std::memory_order_release);
+    m_service_count.store(count + 1, std::memory_order_release);
+
+    VLOG(2) << "linking the `" << name << "` service";
+
+    return service->id;
+}
+
+const std::string &DependencyLinker::service_name(intern_t id) const
+{
+    static const std::string empty;
+
+    Service *service = id <= MAX_SERVICES ? m_services[id].load(std::memory_order_acquire) : nullptr;
+
+    return service ? service->name : empty;
+}
+
+void DependencyLinker::record(const Span &span)
+{
+    const SpanServices &services = span.services();
+
+    if ((m_conf.sides & DependencyConf::CLIENT) && services.client && services.server_addr)
+    {
+        record(services.client, services.server_addr, span.failed());
+    }
+
+    if ((m_conf.sides & DependencyConf::SERVER) && services.server)
+    {
+        intern_t parent = services.client_addr ? services.client_addr : services.parent;
+
+        if (parent)
+            record(parent, services.server, span.failed());
+    }
+}
+
+void DependencyLinker::record(intern_t parent, intern_t child, bool error)
+{
+    uint32_t key = (static_cast<uint32_t>(parent) << 16) | child;
+    size_t bucket = (key * 0x9E3779B1u) % MAX_LINKS;
+
+    for (size_t i = 0; i < MAX_LINKS; i++)
+    {
+        Link &link = m_links[bucket];
+        uint32_t current = link.key.load(std::memory_order_acquire);
+
+        // claim an empty slot, or find the link claimed by another thread meanwhile
+        if (!current && link.key.compare_exchange_strong(current, key, std::memory_order_acq_rel))
+            current = key;
+
+        if (current == key)
+        {
+            link.calls.fetch_add(1, std::memory_order_relaxed);
+
+            if (error)
+                link.errors.fetch_add(1, std::memory_order_relaxed);
+
+            return;
+        }
+
+        bucket = (bucket + 1) % MAX_LINKS;
+    }
+
+    m_overflows.fetch_add(1, std::memory_order_relaxed);
+}
+
+std::vector<DependencyLink> DependencyLinker::links(bool reset)
+{
+    std::vector<DependencyLink> links;
+
+    for (size_t i = 0; i < MAX_LINKS; i++)
+    {
+        Link &link = m_links[i];
+        uint32_t key = link.key.load(std::memory_order_acquire);
+
+        if (!key)
+            continue;
+
+        // the links are kept across the intervals, only their counters restart
+        uint64_t calls = reset ? link.calls.exchange(0, std::memory_order_relaxed) : link.calls.load(std::memory_order_relaxed);
+        uint64_t errors = reset ? link.errors.exchange(0, std::memory_order_relaxed) : link.errors.load(std::memory_order_relaxed);
+
+        if (calls)
+            links.push_back(DependencyLink{service_name(key >> 16), service_name(key & 0xFFFF), calls, errors});
+    }
+
+    return links;
+}
+
+void DependencyLinker::report(void)
+{
+    std::unique_lock<std::mutex> lock(m_reporting);
+
+    while (!m_stop.wait_for(lock, m_conf.report_interval, [this] { return m_stopped; }))
+    {
+        lock.unlock();
+
+        m_conf.reporter(links(true));
+
+        lock.lock();
+    }
+}
+
+} // namespace zipkin
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <functional>
+#include <ostream>
+
+#include "Span.h"
+
+namespace zipkin
+{
+
+/**
+* \brief The calls from a parent service to a child service
+*/
+struct DependencyLink
+{
+    std::string parent;
+    std::string child;
+    uint64_t call_count;
+    uint64_t error_count;
+};
+
+std::ostream &operator<<(std::ostream &os, const DependencyLink &link);
+
+struct DependencyConf
+{
+    enum Side
+    {
+        CLIENT = 1, ///< link the client spans, from their local service to the TraceKeys#SERVER_ADDR service
+        SERVER = 2, ///< link the server spans, from the TraceKeys#CLIENT_ADDR or the local parent service to their service
+    };
+
+    /**
+    * \brief The sides of the calls which are linked
+    *
+    * A call between two instrumented processes is observed by both sides, link a single side when the links
+    * of the processes are summed. Each process knows its outgoing calls, so the client side covers the graph
+    * of the instrumented callers.
+    *
+    * default: CLIENT
+    */
+    unsigned sides = CLIENT;
+
+    /**
+    * \brief Called with the links of the last interval every #report_interval, from a background thread
+    *
+    * default: none
+    */
+    std::function<void(const std::vector<DependencyLink> &links)> reporter;
+
+    /**
+    * \brief The interval between the reports
+    *
+    * default: 60 seconds
+    */
+    std::chrono::milliseconds report_interval = std::chrono::seconds(60);
+};
+
+/**
+* \brief Aggregates the service dependency links of all the submitted spans, sampled or not
+*
+* The spans of a tracer with a linker keep the service ids of their RPC annotations even when they aren't recording,
+* see Span#services, so the complete service graph is known while the spans are sampled aggressively.
+*
+* The linker owns the ids of up to #MAX_SERVICES service names, the names past it are not linked.
+* The links live in a lock-free open addressing table of up to #MAX_LINKS entries, keyed by the parent and child service ids.
+*
+* \sa CachedTracer#set_dependency_linker
+*/
+class DependencyLinker
+{
+  public:
+    static constexpr size_t MAX_LINKS = 1024;
+    static constexpr size_t MAX_SERVICES = 256;
+
+  private:
+    static constexpr size_t SERVICE_BUCKETS = MAX_SERVICES * 2;
+
+    struct Link
+    {
+        std::atomic<uint32_t> key;
+        std::atomic<uint64_t> calls, errors;
+    };
+
+    struct Service
+    {
+        std::string name;
+        size_t hash;
+        intern_t id;
+    };
+
+    DependencyConf m_conf;
+    Link m_links[MAX_LINKS];
+    std::atomic<size_t> m_overflows;
+
+    std::atomic<Service *> m_service_buckets[SERVICE_BUCKETS];
+    std::atomic<Service *> m_services[MAX_SERVICES + 1]; // by id, the id 0 is no service
+    std::atomic<size_t> m_service_count;
+    std::atomic<size_t> m_service_overflows;
+    std::mutex m_adding;
+
+    Service *find_service(const std::string &name, size_t h) const;
+
+    std::thread m_reporter;
+    std::mutex m_reporting;
+    std::condition_variable m_stop;
+    bool m_stopped = false;
+
+    void report(void);
+
+  public:
+    DependencyLinker(const DependencyConf &conf = DependencyConf());
+
+    ~DependencyLinker();
+
+    DependencyLinker(const DependencyLinker &) = delete;
+    DependencyLinker &operator=(const DependencyLinker &) = delete;
+
+    const DependencyConf &conf(void) const { return m_conf; }
+
+    /**
+    * \brief The id of a service name, assigned on its first use
+    *
+    * The lookup is lock-free, only a new name takes a lock.
+    *
+    * \return 0 when the #MAX_SERVICES names are taken
+    */
+    intern_t service(const std::string &name);
+
+    /**
+    * \brief The name of a service id
+    */
+    const std::string &service_name(intern_t id) const;
+
+    /**
+    * \brief Link the services of a finished span
+    */
+    void record(const Span &span);
+
+    /**
+    * \brief Count a call between two services
+    */
+    void record(intern_t parent, intern_t child, bool error);
+
+    /**
+    * \brief The links since the last reset
+    *
+    * \param reset start a new interval
+    */
+    std::vector<DependencyLink> links(bool reset = false);
+
+    /**
+    * \brief Number of the calls which were not linked, when the table is full
+    */
+    inline size_t overflows(void) const { return m_overflows.load(std::memory_order_relaxed); }
+
+    /**
+    * \brief Number of the service names which got no id, when the #MAX_SERVICES names are taken
+    */
+    inline size_t service_overflows(void) const { return m_service_overflows.load(std::memory_order_relaxed); }
+};
+
+} // namespace zipkin
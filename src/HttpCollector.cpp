@@ -77,6 +77,22 @@ HttpConf::HttpConf(folly::Uri &uri)
         {
             batch_interval = std::chrono::milliseconds(folly::to<size_t>(param.second));
         }
+        else if (param.first == "max_batch_bytes")
+        {
+            max_batch_bytes = folly::to<size_t>(param.second);
+        }
+        else if (param.first == "max_message_bytes")
+        {
+            max_message_bytes = folly::to<size_t>(param.second);
+        }
+        else if (param.first == "overflow_policy")
+        {
+            overflow_policy = parse_overflow_policy(param.second);
+        }
+        else if (param.first == "block_timeout")
+        {
+            block_timeout = std::chrono::milliseconds(folly::to<size_t>(param.second));
+        }
     }
 }
 
@@ -0,0 +1,88 @@
+#include "IdGenerator.h"
+
+#include <chrono>
+#include <random>
+#include <thread>
+#include <functional>
+
+namespace zipkin
+{
+
+namespace __impl
+{
+
+class __splitmix64
+{
+    uint64_t m_state;
+
+  public:
+    __splitmix64(void)
+    {
+        std::random_device rd;
+
+        m_state = (static_cast<uint64_t>(rd()) << 32) ^ rd() ^
+                  static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count()) ^
+                  std::hash<std::thread::id>()(std::this_thread::get_id());
+    }
+
+    inline uint64_t operator()(void)
+    {
+        uint64_t z = (m_state += 0x9E3779B97F4A7C15ULL);
+
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+
+        return z ^ (z >> 31);
+    }
+};
+
+static thread_local __splitmix64 g_rand_gen;
+
+} // namespace __impl
+
+IdGenerator *IdGenerator::random(void)
+{
+    static RandomIdGenerator generator;
+
+    return &generator;
+}
+
+IdGenerator *IdGenerator::timestamp(void)
+{
+    static TimestampIdGenerator generator;
+
+    return &generator;
+}
+
+uint64_t RandomIdGenerator::next_id(void)
+{
+    uint64_t id;
+
+    // zero means `not set` for the span ids
+    while (!(id = __impl::g_rand_gen()))
+        ;
+
+    return id;
+}
+
+void RandomIdGenerator::next_ids(uint64_t *ids, size_t count)
+{
+    __impl::__splitmix64 &rand_gen = __impl::g_rand_gen;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        while (!(ids[i] = rand_gen()))
+            ;
+    }
+}
+
+std::pair<uint64_t, uint64_t> TimestampIdGenerator::next_trace_id(void)
+{
+    uint64_t seconds = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+    uint64_t high = (seconds << 32) | (next_id() & 0xFFFFFFFF);
+
+    return std::make_pair(high, next_id());
+}
+
+} // namespace zipkin
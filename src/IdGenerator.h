@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+namespace zipkin
+{
+
+/**
+* \brief Generates the trace and span identifiers
+*
+* The generators are shared by all the threads of a tracer, implementations must be thread safe.
+*
+* \sa Tracer#set_id_generator
+*/
+struct IdGenerator
+{
+    virtual ~IdGenerator() = default;
+
+    /**
+    * \brief Generate a random 64-bit span id
+    */
+    virtual uint64_t next_id(void) = 0;
+
+    /**
+    * \brief Generate a 128-bit trace id, as (high, low)
+    */
+    virtual std::pair<uint64_t, uint64_t> next_trace_id(void)
+    {
+        uint64_t high = next_id();
+
+        return std::make_pair(high, next_id());
+    }
+
+    /**
+    * \brief Reserve a batch of span ids at once
+    */
+    virtual void next_ids(uint64_t *ids, size_t count)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            ids[i] = next_id();
+        }
+    }
+
+    /**
+    * \brief The default generator, a RandomIdGenerator
+    */
+    static IdGenerator *random(void);
+
+    /**
+    * \brief The generator with time-prefixed trace ids, a TimestampIdGenerator
+    */
+    static IdGenerator *timestamp(void);
+};
+
+/**
+* \brief Random identifiers from a per-thread SplitMix64 generator
+*
+* Each thread keeps 8 bytes of state in a `thread_local`, seeded from `std::random_device`,
+* the clock and the thread, so the generator is lock-free and never shares a cache line.
+*/
+class RandomIdGenerator : public IdGenerator
+{
+  public:
+    virtual uint64_t next_id(void) override;
+
+    virtual void next_ids(uint64_t *ids, size_t count) override;
+};
+
+/**
+* \brief Time-prefixed 128-bit trace identifiers
+*
+* The high 64 bits of a trace id start with the epoch seconds, followed by 32 random bits,
+* which is compatible with the AWS X-Ray trace id format and keeps the ids roughly ordered by time.
+*/
+class TimestampIdGenerator : public RandomIdGenerator
+{
+  public:
+    virtual std::pair<uint64_t, uint64_t> next_trace_id(void) override;
+};
+
+} // namespace zipkin
@@ -0,0 +1,133 @@
+#include "Intern.h"
+
+#include <cstring>
+
+#include <arpa/inet.h>
+
+#include <glog/logging.h>
+
+#include "Span.h"
+
+namespace zipkin
+{
+
+constexpr size_t InternTable::MAX_ENTRIES;
+constexpr size_t InternTable::BUCKETS;
+
+InternTable::InternTable(void) : m_size(0)
+{
+    for (size_t i = 0; i < BUCKETS; i++)
+    {
+        m_by_content[i].store(0, std::memory_order_relaxed);
+        m_by_address[i].store(0, std::memory_order_relaxed);
+    }
+
+    for (const std::string *key : {&TraceKeys::CLIENT_SEND, &TraceKeys::CLIENT_RECV,
+                                   &TraceKeys::SERVER_SEND, &TraceKeys::SERVER_RECV,
+                                   &TraceKeys::WIRE_SEND, &TraceKeys::WIRE_RECV,
+                                   &TraceKeys::CLIENT_SEND_FRAGMENT, &TraceKeys::CLIENT_RECV_FRAGMENT,
+                                   &TraceKeys::SERVER_SEND_FRAGMENT, &TraceKeys::SERVER_RECV_FRAGMENT,
+                                   &TraceKeys::LOCAL_COMPONENT, &TraceKeys::CLIENT_ADDR,
+                                   &TraceKeys::SERVER_ADDR, &TraceKeys::ERROR,
+                                   &TraceKeys::HTTP_HOST, &TraceKeys::HTTP_METHOD,
+                                   &TraceKeys::HTTP_PATH, &TraceKeys::HTTP_URL,
+                                   &TraceKeys::HTTP_STATUS_CODE, &TraceKeys::HTTP_REQUEST_SIZE,
+                                   &TraceKeys::HTTP_RESPONSE_SIZE})
+    {
+        add(*key, key->data());
+    }
+}
+
+InternTable &InternTable::instance(void)
+{
+    static InternTable table;
+
+    return table;
+}
+
+intern_t InternTable::add(const std::string &str, const char *addr)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    size_t bucket = hash(str.data(), str.size()) % BUCKETS;
+    intern_t id;
+
+    while ((id = m_by_content[bucket].load(std::memory_order_relaxed)))
+    {
+        if (m_entries[id].str == str)
+            return id;
+
+        bucket = (bucket + 1) % BUCKETS;
+    }
+
+    size_t size = m_size.load(std::memory_order_relaxed);
+
+    if (size >= MAX_ENTRIES)
+    {
+        LOG(WARNING) << "intern table is full, `" << str << "` will be copied to the spans";
+
+        return 0;
+    }
+
+    id = static_cast<intern_t>(size + 1);
+
+    Entry &entry = m_entries[id];
+
+    uint32_t len = htonl(static_cast<uint32_t>(str.size()));
+
+    entry.str = str;
+    entry.thrift.assign(reinterpret_cast<const char *>(&len), sizeof(len));
+    entry.thrift.append(str);
+    entry.addr = addr;
+
+    m_size.store(size + 1, std::memory_order_release);
+    m_by_content[bucket].store(id, std::memory_order_release);
+
+    if (addr)
+    {
+        bucket = hash(addr) % BUCKETS;
+
+        while (m_by_address[bucket].load(std::memory_order_relaxed))
+        {
+            bucket = (bucket + 1) % BUCKETS;
+        }
+
+        m_by_address[bucket].store(id, std::memory_order_release);
+    }
+
+    VLOG(2) << "interned `" << str << "` as #" << id;
+
+    return id;
+}
+
+intern_t InternTable::find(const char *str, size_t len) const
+{
+    size_t bucket = hash(str) % BUCKETS;
+    intern_t id;
+
+    while ((id = m_by_address[bucket].load(std::memory_order_acquire)))
+    {
+        const Entry &entry = m_entries[id];
+
+        if (entry.addr == str && entry.str.size() == len)
+            return id;
+
+        bucket = (bucket + 1) % BUCKETS;
+    }
+
+    bucket = hash(str, len) % BUCKETS;
+
+    while ((id = m_by_content[bucket].load(std::memory_order_acquire)))
+    {
+        const std::string &entry = m_entries[id].str;
+
+        if (entry.size() == len && 0 == memcmp(entry.data(), str, len))
+            return id;
+
+        bucket = (bucket + 1) % BUCKETS;
+    }
+
+    return 0;
+}
+
+} // namespace zipkin
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <atomic>
+#include <mutex>
+
+namespace zipkin
+{
+
+/**
+* \brief Handle of an interned string, 0 means not interned
+*/
+typedef uint16_t intern_t;
+
+/**
+* \brief Process-wide table of interned annotation keys and values
+*
+* The well-known TraceKeys are registered on first use, applications may register their own keys with #intern.
+* A Span stores the handle and a pointer to the table storage instead of copying the string,
+* the codecs write the precomputed bytes of the handle.
+*
+* Entries are never removed; lookups are lock-free, registration is serialized.
+*/
+class InternTable
+{
+  public:
+    static constexpr size_t MAX_ENTRIES = 1024;
+
+  private:
+    static constexpr size_t BUCKETS = MAX_ENTRIES * 2;
+
+    struct Entry
+    {
+        std::string str;
+        std::string thrift; // i32 length prefix and bytes, in TBinaryProtocol format
+        const char *addr; // storage of a well-known key, matched without comparing the content
+    };
+
+    Entry m_entries[MAX_ENTRIES + 1];
+    std::atomic<size_t> m_size;
+    std::atomic<intern_t> m_by_content[BUCKETS];
+    std::atomic<intern_t> m_by_address[BUCKETS];
+    std::mutex m_mutex;
+
+    InternTable(void);
+
+    static inline size_t hash(const char *str, size_t len)
+    {
+        size_t h = 2166136261u;
+
+        for (size_t i = 0; i < len; i++)
+        {
+            h = (h ^ static_cast<uint8_t>(str[i])) * 16777619u;
+        }
+
+        return h;
+    }
+
+    static inline size_t hash(const void *addr)
+    {
+        return (reinterpret_cast<uintptr_t>(addr) >> 3) * 0x9E3779B1u;
+    }
+
+    intern_t add(const std::string &str, const char *addr);
+
+  public:
+    static InternTable &instance(void);
+
+    /**
+    * \brief Register a string and return its handle, 0 when the table is full
+    */
+    intern_t intern(const std::string &str) { return add(str, nullptr); }
+
+    /**
+    * \brief Find the handle of a registered string, 0 when it isn't interned
+    *
+    * The storage of the well-known keys is matched by address first, so views of TraceKeys are found without hashing.
+    */
+    intern_t find(const char *str, size_t len) const;
+
+    inline intern_t find(const std::string &str) const { return find(str.data(), str.size()); }
+
+    /**
+    * \brief Number of the interned strings
+    */
+    inline size_t size(void) const { return m_size.load(std::memory_order_acquire); }
+
+    inline const std::string &str(intern_t id) const { return m_entries[id].str; }
+
+    /**
+    * \brief Precomputed TBinaryProtocol encoding of the interned string
+    */
+    inline const std::string &thrift(intern_t id) const { return m_entries[id].thrift; }
+};
+
+} // namespace zipkin
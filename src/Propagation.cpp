@@ -125,6 +125,31 @@ void Propagation::extract(grpc::ServerContext &context, Span &span)
     }
 }
 
+void Propagation::extract(grpc::ServerContext &context, SpanContext &parent)
+{
+    for (auto &item : context.client_metadata())
+    {
+        const std::string value(item.second.begin(), item.second.end());
+
+        if (item.first == ZIPKIN_X_TRACE_ID_LOWERCASE)
+        {
+            parent.trace_id = folly::to<uint64_t>(value);
+        }
+        else if (item.first == ZIPKIN_X_SPAN_ID_LOWERCASE)
+        {
+            parent.span_id = folly::to<uint64_t>(value);
+        }
+        else if (item.first == ZIPKIN_X_SAMPLED_LOWERCASE)
+        {
+            parent.sampled = folly::to<int>(value);
+        }
+        else if (item.first == ZIPKIN_X_FLAGS_LOWERCASE)
+        {
+            parent.debug = folly::to<int>(value);
+        }
+    }
+}
+
 #endif // WITH_GRPC
 
 } // namespace zipkin
\ No newline at end of file
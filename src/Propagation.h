@@ -56,6 +56,11 @@ class Propagation
     static void inject(::grpc::ClientContext &context, const Span &span);
 
     static void extract(::grpc::ServerContext &context, Span &span);
+
+    /**
+    * \brief Extract the parent context, which could be passed to Tracer#span
+    */
+    static void extract(::grpc::ServerContext &context, SpanContext &parent);
 #endif
 };
 
@@ -0,0 +1,439 @@
+#include "Sampler.h"
+#include "Clock.h"
+#include "Collector.h"
+
+#include <cstring>
+#include <algorithm>
+#include <limits>
+
+#include <glog/logging.h>
+
+namespace zipkin
+{
+
+constexpr size_t CountingSampler::COUNT_BLOCK;
+constexpr int64_t RateLimitingSampler::TOKEN;
+constexpr int64_t RateLimitingSampler::REFILL_INTERVAL;
+constexpr size_t AdaptiveSampler::MAX_OPERATIONS;
+constexpr double AdaptiveSampler::RECOVERY;
+constexpr size_t AdaptiveSampler::BUCKETS;
+
+namespace __impl
+{
+
+// the block of counts a thread claimed from a counting sampler
+struct __count_block
+{
+    const CountingSampler *sampler;
+    size_t next, end;
+};
+
+static constexpr size_t MAX_COUNT_BLOCKS = 4;
+
+class __constant_sampler : public Sampler
+{
+    bool m_sampled;
+
+  public:
+    __constant_sampler(bool sampled) : m_sampled(sampled) {}
+
+    virtual bool sample(trace_id_t trace_id, string_view name) override { return m_sampled; }
+};
+
+// the trace ids of some generators are not uniform, mix them before comparing
+static inline uint64_t mix_trace_id(trace_id_t trace_id)
+{
+    uint64_t z = trace_id;
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+
+    return z ^ (z >> 31);
+}
+
+static inline uint64_t probability_threshold(double probability)
+{
+    return probability >= 1.0 ? std::numeric_limits<uint64_t>::max()
+                              : static_cast<uint64_t>(std::max(0.0, probability) * std::numeric_limits<uint64_t>::max());
+}
+
+static inline size_t hash_name(const char *str, size_t len)
+{
+    size_t h = 2166136261u;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        h = (h ^ static_cast<uint8_t>(str[i])) * 16777619u;
+    }
+
+    return h;
+}
+
+} // namespace __impl
+
+Sampler *Sampler::always(void)
+{
+    static __impl::__constant_sampler sampler(true);
+
+    return &sampler;
+}
+
+Sampler *Sampler::never(void)
+{
+    static __impl::__constant_sampler sampler(false);
+
+    return &sampler;
+}
+
+bool CountingSampler::sample(trace_id_t trace_id, string_view name)
+{
+    size_t sample_rate = m_sample_rate.load(std::memory_order_relaxed);
+
+    if (sample_rate <= 1)
+        return true;
+
+    static thread_local __impl::__count_block blocks[__impl::MAX_COUNT_BLOCKS];
+
+    __impl::__count_block *block = nullptr;
+
+    for (__impl::__count_block &b : blocks)
+    {
+        if (b.sampler == this || !b.sampler)
+        {
+            block = &b;
+            break;
+        }
+    }
+
+    // a thread counting for too many samplers shares the counter
+    if (!block)
+        return m_sampled_traces.fetch_add(1, std::memory_order_relaxed) % sample_rate == 0;
+
+    if (block->sampler != this || block->next == block->end)
+    {
+        block->sampler = this;
+        block->next = m_sampled_traces.fetch_add(COUNT_BLOCK, std::memory_order_relaxed);
+        block->end = block->next + COUNT_BLOCK;
+    }
+
+    return block->next++ % sample_rate == 0;
+}
+
+ProbabilisticSampler::ProbabilisticSampler(double probability) : m_probability(std::max(0.0, std::min(1.0, probability)))
+{
+    m_threshold = __impl::probability_threshold(m_probability);
+}
+
+bool ProbabilisticSampler::sample(trace_id_t trace_id, string_view name)
+{
+    if (m_probability >= 1.0)
+        return true;
+
+    return __impl::mix_trace_id(trace_id) < m_threshold;
+}
+
+RateLimitingSampler::RateLimitingSampler(double traces_per_second)
+    : m_traces_per_second(std::max(0.0, traces_per_second)),
+      m_max_balance(std::max(TOKEN, static_cast<int64_t>(m_traces_per_second * TOKEN))),
+      m_balance(m_max_balance), m_last_refill(now())
+{
+}
+
+int64_t RateLimitingSampler::now(void)
+{
+    // a few milliseconds resolution is enough for refilling the bucket
+    return Clock::get(Clock::COARSE)->ticks();
+}
+
+bool RateLimitingSampler::sample(trace_id_t trace_id, string_view name)
+{
+    int64_t ts = now();
+    int64_t last = m_last_refill.load(std::memory_order_relaxed);
+
+    // one thread refills the elapsed tokens, at most once per interval
+    if (ts - last >= REFILL_INTERVAL && m_last_refill.compare_exchange_strong(last, ts, std::memory_order_relaxed))
+    {
+        int64_t tokens = static_cast<int64_t>((ts - last) * m_traces_per_second * TOKEN / 1000000000);
+        int64_t balance = m_balance.fetch_add(tokens, std::memory_order_relaxed) + tokens;
+
+        if (balance > m_max_balance)
+            m_balance.fetch_sub(balance - m_max_balance, std::memory_order_relaxed);
+    }
+
+    // the unsampled traces only read the balance once the bucket is empty
+    if (m_balance.load(std::memory_order_relaxed) < TOKEN)
+        return false;
+
+    if (m_balance.fetch_sub(TOKEN, std::memory_order_relaxed) >= TOKEN)
+        return true;
+
+    m_balance.fetch_add(TOKEN, std::memory_order_relaxed);
+
+    return false;
+}
+
+std::ostream &operator<<(std::ostream &os, const OperationRate &rate)
+{
+    return os << rate.name << ": probability=" << rate.probability
+              << ", traces_per_second=" << rate.traces_per_second
+              << ", sampled_per_second=" << rate.sampled_per_second;
+}
+
+AdaptiveSampler::Operation::Operation(string_view name, size_t hash, double probability)
+    : name(name.data(), name.size()), hash(hash), threshold(__impl::probability_threshold(probability)),
+      last_sampled(0), traces(0), sampled(0), probability(probability), traces_per_second(0), sampled_per_second(0)
+{
+}
+
+AdaptiveSampler::AdaptiveSampler(const AdaptiveSamplingConf &conf, const Collector *collector)
+    : m_conf(conf), m_collector(collector),
+      m_min_interval(conf.min_traces_per_second > 0 ? static_cast<int64_t>(1000000000 / conf.min_traces_per_second)
+                                                    : std::numeric_limits<int64_t>::max()),
+      m_size(0), m_others("*", 0, 1.0), m_last_adjust(now()), m_budget(conf.traces_per_second)
+{
+    for (size_t i = 0; i < BUCKETS; i++)
+    {
+        m_buckets[i].store(nullptr, std::memory_order_relaxed);
+    }
+
+    if (m_collector)
+        m_dropped_spans = m_collector->dropped_spans();
+
+    if (m_conf.adjust_interval.count() > 0)
+        m_adjuster = std::thread(&AdaptiveSampler::run_adjuster, this);
+}
+
+AdaptiveSampler::~AdaptiveSampler()
+{
+    if (m_adjuster.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_stopping);
+
+            m_stopped = true;
+        }
+
+        m_stop.notify_one();
+        m_adjuster.join();
+    }
+
+    for (size_t i = 0; i < BUCKETS; i++)
+    {
+        delete m_buckets[i].load(std::memory_order_relaxed);
+    }
+}
+
+int64_t AdaptiveSampler::now(void)
+{
+    return Clock::get(Clock::COARSE)->ticks();
+}
+
+AdaptiveSampler::Operation *AdaptiveSampler::find(string_view name, size_t h) const
+{
+    size_t bucket = h % BUCKETS;
+    Operation *op;
+
+    while ((op = m_buckets[bucket].load(std::memory_order_acquire)))
+    {
+        if (op->hash == h && op->name.size() == name.size() && 0 == memcmp(op->name.data(), name.data(), name.size()))
+            return op;
+
+        bucket = (bucket + 1) % BUCKETS;
+    }
+
+    return nullptr;
+}
+
+AdaptiveSampler::Operation *AdaptiveSampler::add(string_view name, size_t h)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (Operation *op = find(name, h))
+        return op;
+
+    size_t size = m_size.load(std::memory_order_relaxed);
+
+    if (size >= MAX_OPERATIONS)
+        return nullptr;
+
+    // a new operation is sampled fully until the next adjustment, its floor still applies afterwards
+    Operation *op = new Operation(name, h, 1.0);
+
+    size_t bucket = h % BUCKETS;
+
+    while (m_buckets[bucket].load(std::memory_order_relaxed))
+    {
+        bucket = (bucket + 1) % BUCKETS;
+    }
+
+    m_buckets[bucket].store(op, std::memory_order_release);
+    m_size.store(size + 1, std::memory_order_release);
+
+    VLOG(2) << "sampling the `" << op->name << "` operation";
+
+    return op;
+}
+
+AdaptiveSampler::Operation *AdaptiveSampler::operation(string_view name)
+{
+    size_t h = __impl::hash_name(name.data(), name.size());
+    Operation *op = find(name, h);
+
+    if (!op && !(op = add(name, h)))
+        op = &m_others;
+
+    return op;
+}
+
+void AdaptiveSampler::run_adjuster(void)
+{
+    std::unique_lock<std::mutex> lock(m_stopping);
+
+    while (!m_stop.wait_for(lock, m_conf.adjust_interval, [this] { return m_stopped; }))
+    {
+        lock.unlock();
+
+        adjust();
+
+        lock.lock();
+    }
+}
+
+bool AdaptiveSampler::sample(trace_id_t trace_id, string_view name)
+{
+    int64_t ts = now();
+
+    Operation *op = operation(name);
+
+    op->traces.fetch_add(1, std::memory_order_relaxed);
+
+    bool sampled = __impl::mix_trace_id(trace_id) < op->threshold.load(std::memory_order_relaxed);
+
+    int64_t last_sampled = op->last_sampled.load(std::memory_order_relaxed);
+
+    if (sampled)
+    {
+        op->last_sampled.store(ts, std::memory_order_relaxed);
+    }
+    else if (ts - last_sampled >= m_min_interval)
+    {
+        // the guaranteed floor of the operation
+        sampled = op->last_sampled.compare_exchange_strong(last_sampled, ts, std::memory_order_relaxed);
+    }
+
+    if (sampled)
+        op->sampled.fetch_add(1, std::memory_order_relaxed);
+
+    return sampled;
+}
+
+void AdaptiveSampler::adjust(void)
+{
+    int64_t ts = now();
+    int64_t last = m_last_adjust.exchange(ts, std::memory_order_relaxed);
+
+    adjust(ts - last);
+}
+
+void AdaptiveSampler::adjust(int64_t elapsed)
+{
+    std::lock_guard<std::mutex> lock(m_adjusting);
+
+    double seconds = std::max(elapsed, int64_t(1000000)) / 1e9;
+
+    if (m_collector)
+    {
+        size_t dropped_spans = m_collector->dropped_spans();
+
+        if (dropped_spans > m_dropped_spans)
+        {
+            m_pressure = std::max(m_pressure * m_conf.backoff, 0.01);
+
+            VLOG(1) << "collector dropped " << (dropped_spans - m_dropped_spans) << " spans, back off the sampling budget to "
+                    << m_pressure * m_conf.traces_per_second << " traces per second";
+        }
+        else
+        {
+            m_pressure = std::min(m_pressure + RECOVERY, 1.0);
+        }
+
+        m_dropped_spans = dropped_spans;
+    }
+
+    double budget = m_conf.traces_per_second * m_pressure;
+
+    m_budget.store(budget, std::memory_order_relaxed);
+
+    std::vector<Operation *> ops;
+
+    ops.reserve(m_size.load(std::memory_order_acquire) + 1);
+
+    for (size_t i = 0; i < BUCKETS; i++)
+    {
+        if (Operation *op = m_buckets[i].load(std::memory_order_acquire))
+            ops.push_back(op);
+    }
+
+    ops.push_back(&m_others);
+
+    for (Operation *op : ops)
+    {
+        double traces = op->traces.exchange(0, std::memory_order_relaxed) / seconds;
+        double sampled = op->sampled.exchange(0, std::memory_order_relaxed) / seconds;
+
+        // smooth the observed throughput, a single quiet interval doesn't open the gates
+        double smoothed = op->traces_per_second.load(std::memory_order_relaxed);
+
+        op->traces_per_second.store(smoothed ? (smoothed + traces) / 2 : traces, std::memory_order_relaxed);
+        op->sampled_per_second.store(sampled, std::memory_order_relaxed);
+    }
+
+    // split the budget evenly, the operations below their share leave the remaining to the busier ones
+    std::sort(ops.begin(), ops.end(), [](const Operation *lhs, const Operation *rhs) {
+        return lhs->traces_per_second.load(std::memory_order_relaxed) < rhs->traces_per_second.load(std::memory_order_relaxed);
+    });
+
+    double remaining = budget;
+
+    for (size_t i = 0; i < ops.size(); i++)
+    {
+        Operation *op = ops[i];
+        double traces = op->traces_per_second.load(std::memory_order_relaxed);
+        double share = remaining / (ops.size() - i);
+        double probability = traces <= share ? 1.0 : share / traces;
+
+        remaining -= std::min(traces, share);
+
+        op->probability.store(probability, std::memory_order_relaxed);
+        op->threshold.store(__impl::probability_threshold(probability), std::memory_order_relaxed);
+    }
+}
+
+double AdaptiveSampler::probability(string_view name) const
+{
+    Operation *op = find(name, __impl::hash_name(name.data(), name.size()));
+
+    return (op ? op : &m_others)->probability.load(std::memory_order_relaxed);
+}
+
+std::vector<OperationRate> AdaptiveSampler::rates(void) const
+{
+    std::vector<OperationRate> rates;
+
+    rates.reserve(m_size.load(std::memory_order_acquire));
+
+    for (size_t i = 0; i < BUCKETS; i++)
+    {
+        if (Operation *op = m_buckets[i].load(std::memory_order_acquire))
+        {
+            rates.push_back(OperationRate{op->name,
+                                          op->probability.load(std::memory_order_relaxed),
+                                          op->traces_per_second.load(std::memory_order_relaxed),
+                                          op->sampled_per_second.load(std::memory_order_relaxed)});
+        }
+    }
+
+    return rates;
+}
+
+} // namespace zipkin
@@ -0,0 +1,277 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "Span.h"
+
+namespace zipkin
+{
+
+/**
+* \brief Decides whether a new trace is recorded
+*
+* The decision is taken once per trace, when its root span is created, and the child spans inherit it
+* through their SpanContext. The samplers are shared by all the threads of a tracer, implementations must be thread safe.
+*
+* \sa Tracer#set_sampler
+*/
+struct Sampler
+{
+    virtual ~Sampler() = default;
+
+    /**
+    * \brief Decide whether the trace of a new root span is sampled
+    */
+    virtual bool sample(trace_id_t trace_id, string_view name) = 0;
+
+    /**
+    * \brief The sampler which records all the traces
+    */
+    static Sampler *always(void);
+
+    /**
+    * \brief The sampler which records none of the traces, except the debug ones
+    */
+    static Sampler *never(void);
+};
+
+/**
+* \brief Samples one of every \p sample_rate traces
+*
+* The traces are counted by the sampler, so the tracers with different rates don't disturb each other.
+* Each thread claims a block of #COUNT_BLOCK counts at once and counts the traces of the block locally,
+* so the shared counter is touched once per block of root spans, the children inherit the decision.
+*/
+class CountingSampler : public Sampler
+{
+  public:
+    static constexpr size_t COUNT_BLOCK = 64;
+
+  private:
+    std::atomic_size_t m_sample_rate;
+
+    // keep the shared counter off the cache lines of the settings and the neighbours, wherever the sampler is placed
+    uint8_t m_pad[64];
+    std::atomic_size_t m_sampled_traces;
+    uint8_t m_tail_pad[64];
+
+  public:
+    CountingSampler(size_t sample_rate = 1) : m_sample_rate(sample_rate), m_sampled_traces(0) {}
+
+    inline size_t sample_rate(void) const { return m_sample_rate.load(std::memory_order_relaxed); }
+
+    inline void set_sample_rate(size_t sample_rate) { m_sample_rate.store(sample_rate, std::memory_order_relaxed); }
+
+    virtual bool sample(trace_id_t trace_id, string_view name) override;
+};
+
+/**
+* \brief Samples a fraction of the traces, by the trace id
+*
+* The decision is a pure function of the trace id, so the services which share a trace agree on it
+* even when the sampling state is not propagated.
+*/
+class ProbabilisticSampler : public Sampler
+{
+    double m_probability;
+    uint64_t m_threshold;
+
+  public:
+    ProbabilisticSampler(double probability);
+
+    inline double probability(void) const { return m_probability; }
+
+    virtual bool sample(trace_id_t trace_id, string_view name) override;
+};
+
+/**
+* \brief Samples up to \p traces_per_second traces with a token bucket
+*
+* The bucket holds up to one second of tokens, so short bursts are sampled.
+* The balance lives on its own cache line, and is only written when a token is taken or refilled.
+*/
+class RateLimitingSampler : public Sampler
+{
+    static constexpr int64_t TOKEN = 1000000;           // micro-tokens of a trace
+    static constexpr int64_t REFILL_INTERVAL = 1000000; // nanoseconds between the refills
+
+    double m_traces_per_second;
+    int64_t m_max_balance;
+
+    // keep the written state off the cache lines of the settings and the neighbours, the sampler isn't cache line aligned
+    uint8_t m_pad[64];
+    std::atomic<int64_t> m_balance;
+    std::atomic<int64_t> m_last_refill;
+    uint8_t m_tail_pad[64];
+
+    static int64_t now(void);
+
+  public:
+    RateLimitingSampler(double traces_per_second);
+
+    inline double traces_per_second(void) const { return m_traces_per_second; }
+
+    virtual bool sample(trace_id_t trace_id, string_view name) override;
+};
+
+struct Collector;
+
+struct AdaptiveSamplingConf
+{
+    /**
+    * \brief The budget of the sampled traces per second, shared by all the operations
+    *
+    * The budget is counted in traces, since a decision is taken once at the root span and covers the whole trace.
+    * For a budget of spans per second, divide it by the typical number of spans of a trace.
+    *
+    * default: 100
+    */
+    double traces_per_second = 100;
+
+    /**
+    * \brief The sampled traces per second guaranteed to each operation, even beyond the budget
+    *
+    * default: 1
+    */
+    double min_traces_per_second = 1;
+
+    /**
+    * \brief The interval between the adjustments of the sampling probabilities, by a background thread
+    *
+    * Zero disables the background adjustments, see AdaptiveSampler#adjust.
+    *
+    * default: 1 second
+    */
+    std::chrono::milliseconds adjust_interval = std::chrono::seconds(1);
+
+    /**
+    * \brief The budget is multiplied by it when the collector dropped spans since the last adjustment
+    *
+    * default: 0.5
+    */
+    double backoff = 0.5;
+};
+
+/**
+* \brief The sampling rate of an operation
+*/
+struct OperationRate
+{
+    std::string name;
+    double probability;        ///< the probability of sampling a trace
+    double traces_per_second;  ///< the observed traces per second, smoothed over the adjustments
+    double sampled_per_second; ///< the sampled traces per second in the last interval
+};
+
+std::ostream &operator<<(std::ostream &os, const OperationRate &rate);
+
+/**
+* \brief Samples each operation with its own probability, to spend a traces per second budget across the operations
+*
+* The traces are counted per root span name, and every #AdaptiveSamplingConf::adjust_interval the budget is split
+* evenly between the operations, the quiet operations are sampled fully and leave their unused share to the busy ones.
+* Each operation is sampled at least #AdaptiveSamplingConf::min_traces_per_second, so the rare operations are never missed.
+*
+* The budget is in traces rather than spans: the decision is taken at the root span, before the number of the spans
+* of the trace is known, and the children inherit it.
+*
+* When the collector dropped spans from its backlog, the budget backs off, and recovers gradually once the drops stopped.
+*
+* Lookups are lock-free, registering a new operation is serialized. Operations beyond #MAX_OPERATIONS share one rate.
+* The probabilities are adjusted by a background thread, the sampling never waits for an adjustment.
+*/
+class AdaptiveSampler : public Sampler
+{
+  public:
+    static constexpr size_t MAX_OPERATIONS = 256;
+    static constexpr double RECOVERY = 0.1; // the budget fraction recovered per adjustment
+
+  private:
+    static constexpr size_t BUCKETS = MAX_OPERATIONS * 2;
+
+    struct Operation
+    {
+        std::string name;
+        size_t hash;
+        std::atomic<uint64_t> threshold;
+        std::atomic<int64_t> last_sampled;
+        std::atomic<size_t> traces, sampled;
+        std::atomic<double> probability, traces_per_second, sampled_per_second;
+
+        Operation(string_view name, size_t hash, double probability);
+    };
+
+    AdaptiveSamplingConf m_conf;
+    const Collector *m_collector;
+    int64_t m_min_interval; // nanoseconds between the guaranteed samples of an operation
+
+    std::atomic<size_t> m_size;
+    std::atomic<Operation *> m_buckets[BUCKETS];
+    Operation m_others;
+    std::mutex m_mutex;
+
+    std::mutex m_adjusting;
+    std::thread m_adjuster;
+    std::mutex m_stopping;
+    std::condition_variable m_stop;
+    bool m_stopped = false;
+    std::atomic<int64_t> m_last_adjust;
+    std::atomic<double> m_budget;
+    double m_pressure = 1.0;
+    size_t m_dropped_spans = 0;
+
+    static int64_t now(void);
+
+    Operation *find(string_view name, size_t h) const;
+
+    Operation *add(string_view name, size_t h);
+
+    Operation *operation(string_view name);
+
+    void adjust(int64_t elapsed);
+
+    void run_adjuster(void);
+
+  public:
+    AdaptiveSampler(const AdaptiveSamplingConf &conf = AdaptiveSamplingConf(), const Collector *collector = nullptr);
+
+    ~AdaptiveSampler();
+
+    AdaptiveSampler(const AdaptiveSampler &) = delete;
+    AdaptiveSampler &operator=(const AdaptiveSampler &) = delete;
+
+    const AdaptiveSamplingConf &conf(void) const { return m_conf; }
+
+    /**
+    * \brief The current budget of the sampled traces per second, after backing off the collector drops
+    */
+    inline double budget(void) const { return m_budget.load(std::memory_order_relaxed); }
+
+    /**
+    * \brief The current sampling probability of the operation
+    */
+    double probability(string_view name) const;
+
+    /**
+    * \brief The current rates of all the tracked operations
+    */
+    std::vector<OperationRate> rates(void) const;
+
+    /**
+    * \brief Adjust the probabilities now, it happens every #AdaptiveSamplingConf::adjust_interval in the background
+    */
+    void adjust(void);
+
+    virtual bool sample(trace_id_t trace_id, string_view name) override;
+};
+
+} // namespace zipkin
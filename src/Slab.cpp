@@ -0,0 +1,182 @@
+#include "Slab.h"
+
+#include <algorithm>
+#include <map>
+#include <utility>
+
+#include <sys/mman.h>
+
+#include <glog/logging.h>
+
+namespace zipkin
+{
+
+constexpr size_t Slab::SLAB_SIZE;
+constexpr size_t Slab::CHUNK_ALIGN;
+
+namespace __impl
+{
+
+// the mapped slabs by their start address, never destroyed since the spans may be deleted during the static destruction
+static std::mutex *g_slabs_mutex = new std::mutex();
+static std::map<const uint8_t *, std::pair<const uint8_t *, Slab *>> *g_mapped_slabs =
+    new std::map<const uint8_t *, std::pair<const uint8_t *, Slab *>>();
+
+} // namespace __impl
+
+Slab::Slab(size_t chunk_size, bool hugepage)
+    : m_chunk_size((chunk_size + CHUNK_ALIGN - 1) & ~(CHUNK_ALIGN - 1)), m_hugepage(hugepage)
+{
+    // a slab holds at least a few chunks, even for the oversized spans
+    m_slab_size = (std::max(SLAB_SIZE, m_chunk_size * 8) + SLAB_SIZE - 1) & ~(SLAB_SIZE - 1);
+}
+
+Slab *Slab::get(size_t chunk_size, bool hugepage)
+{
+    // never destroyed, the spans may be deleted during the static destruction
+    static std::mutex *mutex = new std::mutex();
+    static std::map<std::pair<size_t, bool>, Slab *> *slabs = new std::map<std::pair<size_t, bool>, Slab *>();
+
+    std::lock_guard<std::mutex> lock(*mutex);
+
+    Slab *&slab = (*slabs)[std::make_pair(chunk_size, hugepage)];
+
+    if (!slab)
+        slab = new Slab(chunk_size, hugepage);
+
+    return slab;
+}
+
+void *Slab::map_slab(void)
+{
+    void *p = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+    if (m_hugepage)
+    {
+        p = mmap(nullptr, m_slab_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+        if (p != MAP_FAILED)
+        {
+            m_huge_slabs.fetch_add(1, std::memory_order_relaxed);
+
+            VLOG(1) << "mapped slab @ " << p << " with " << m_slab_size << " bytes of huge pages";
+
+            return p;
+        }
+    }
+#endif
+
+    if (m_hugepage)
+    {
+        // over-map to align the slab to the huge page size, then unmap the unaligned head and tail
+        size_t size = m_slab_size + SLAB_SIZE;
+
+        p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (p == MAP_FAILED)
+            return nullptr;
+
+        uint8_t *base = static_cast<uint8_t *>(p);
+        uint8_t *aligned = reinterpret_cast<uint8_t *>((reinterpret_cast<uintptr_t>(base) + SLAB_SIZE - 1) & ~(SLAB_SIZE - 1));
+
+        if (aligned > base)
+            munmap(base, aligned - base);
+
+        if (base + size > aligned + m_slab_size)
+            munmap(aligned + m_slab_size, base + size - aligned - m_slab_size);
+
+        p = aligned;
+
+#ifdef MADV_HUGEPAGE
+        if (0 == madvise(p, m_slab_size, MADV_HUGEPAGE))
+            m_huge_slabs.fetch_add(1, std::memory_order_relaxed);
+#endif
+    }
+    else
+    {
+        p = mmap(nullptr, m_slab_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (p == MAP_FAILED)
+            return nullptr;
+    }
+
+    VLOG(1) << "mapped slab @ " << p << " with " << m_slab_size << " bytes";
+
+    return p;
+}
+
+void *Slab::allocate(void)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    void *p = nullptr;
+
+    if (m_free)
+    {
+        p = m_free;
+        m_free = m_free->next;
+    }
+    else
+    {
+        if (m_top + m_chunk_size > m_end)
+        {
+            uint8_t *slab = static_cast<uint8_t *>(map_slab());
+
+            if (!slab)
+                return nullptr;
+
+            // the remaining of the last slab is wasted, less than a chunk
+            m_top = slab;
+            m_end = slab + m_slab_size;
+
+            {
+                std::lock_guard<std::mutex> slabs_lock(*__impl::g_slabs_mutex);
+
+                __impl::g_mapped_slabs->emplace(slab, std::make_pair(m_end, this));
+            }
+
+            m_slabs.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        p = m_top;
+        m_top += m_chunk_size;
+    }
+
+    m_allocated.fetch_add(1, std::memory_order_relaxed);
+
+    return p;
+}
+
+Slab *Slab::owner(const void *ptr)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(ptr);
+
+    std::lock_guard<std::mutex> lock(*__impl::g_slabs_mutex);
+
+    auto it = __impl::g_mapped_slabs->upper_bound(p);
+
+    if (it == __impl::g_mapped_slabs->begin())
+        return nullptr;
+
+    --it;
+
+    return p < it->second.first ? it->second.second : nullptr;
+}
+
+void Slab::deallocate(void *ptr)
+{
+    if (!ptr)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    Chunk *chunk = static_cast<Chunk *>(ptr);
+
+    chunk->next = m_free;
+    m_free = chunk;
+
+    m_allocated.fetch_sub(1, std::memory_order_relaxed);
+}
+
+} // namespace zipkin
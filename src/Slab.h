@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace zipkin
+{
+
+/**
+* \brief Fixed-size chunk allocator carving the chunks out of large mapped slabs
+*
+* Neighbouring spans share the pages of a slab instead of being scattered across the heap,
+* which keeps the TLB footprint of a busy tracer small. When huge pages are requested,
+* a slab is mapped with `MAP_HUGETLB` first, and falls back to a #SLAB_SIZE aligned mapping
+* advised with `MADV_HUGEPAGE` for the transparent huge pages.
+*
+* The slabs are never unmapped, a freed chunk is kept in a free list for the next allocation.
+* The slabs are shared by all the caches with the same chunk size, see #get.
+*/
+class Slab
+{
+    struct Chunk
+    {
+        Chunk *next;
+    };
+
+    size_t m_chunk_size, m_slab_size;
+    bool m_hugepage;
+
+    std::mutex m_mutex;
+    Chunk *m_free = nullptr;
+    uint8_t *m_top = nullptr, *m_end = nullptr;
+
+    std::atomic<size_t> m_slabs = ATOMIC_VAR_INIT(0);
+    std::atomic<size_t> m_huge_slabs = ATOMIC_VAR_INIT(0);
+    std::atomic<size_t> m_allocated = ATOMIC_VAR_INIT(0);
+
+    void *map_slab(void);
+
+  public:
+    static constexpr size_t SLAB_SIZE = 2 * 1024 * 1024;
+    static constexpr size_t CHUNK_ALIGN = 64;
+
+    Slab(size_t chunk_size, bool hugepage = false);
+
+    Slab(const Slab &) = delete;
+    Slab &operator=(const Slab &) = delete;
+
+    /**
+    * \brief The shared slab of the chunk size, never destroyed since the chunks may outlive their tracer
+    */
+    static Slab *get(size_t chunk_size, bool hugepage = false);
+
+    inline size_t chunk_size(void) const { return m_chunk_size; }
+
+    inline bool hugepage(void) const { return m_hugepage; }
+
+    /**
+    * \brief Number of the mapped slabs
+    */
+    inline size_t slabs(void) const { return m_slabs.load(std::memory_order_relaxed); }
+
+    /**
+    * \brief Number of the mapped slabs backed by `MAP_HUGETLB` or advised for the transparent huge pages
+    */
+    inline size_t huge_slabs(void) const { return m_huge_slabs.load(std::memory_order_relaxed); }
+
+    /**
+    * \brief Number of the chunks in use
+    */
+    inline size_t allocated(void) const { return m_allocated.load(std::memory_order_relaxed); }
+
+    /**
+    * \brief Allocate a chunk, nullptr when no slab could be mapped
+    */
+    void *allocate(void);
+
+    void deallocate(void *ptr);
+
+    /**
+    * \brief The slab which mapped the memory of \p ptr, nullptr when it was allocated elsewhere
+    */
+    static Slab *owner(const void *ptr);
+};
+
+} // namespace zipkin
@@ -1,4 +1,3 @@
-#include <random>
 #include <utility>
 
 #include <ios>
@@ -9,10 +8,14 @@
 #include <glog/logging.h>
 
 #include <boost/algorithm/string.hpp>
-#include <boost/thread/tss.hpp>
+
+#include <thrift/transport/TTransport.h>
+#include <thrift/transport/TBufferTransports.h>
+#include <thrift/protocol/TBinaryProtocol.h>
 
 #include "Span.h"
 #include "Tracer.h"
+#include "Slab.h"
 #include "Base64.h"
 
 namespace zipkin
@@ -42,6 +45,286 @@ DEFINE_TRACE_KEY(HTTP_STATUS_CODE)
 DEFINE_TRACE_KEY(HTTP_REQUEST_SIZE)
 DEFINE_TRACE_KEY(HTTP_RESPONSE_SIZE)
 
+namespace __impl
+{
+
+static inline __string copy(Arena &arena, string_view str)
+{
+    InternTable &table = InternTable::instance();
+
+    if (intern_t id = table.find(str.data(), str.size()))
+    {
+        const std::string &interned = table.str(id);
+
+        return __string{interned.data(), interned.size(), id};
+    }
+
+    return __string{arena.copy(str.data(), str.size()), str.size(), 0};
+}
+
+static inline __string copy(Arena &arena, const void *data, size_t size)
+{
+    return __string{arena.copy(static_cast<const char *>(data), size), size, 0};
+}
+
+static void assign(__endpoint &ep, const ::Endpoint &host)
+{
+    ep.ipv4 = host.ipv4;
+    ep.port = host.port;
+
+    if (host.__isset.ipv6 && host.ipv6.size() == sizeof(ep.ipv6))
+    {
+        ep.has_ipv6 = true;
+        memcpy(ep.ipv6, host.ipv6.data(), sizeof(ep.ipv6));
+    }
+}
+
+static const __endpoint *copy(Arena &arena, const Endpoint &endpoint)
+{
+    const ::Endpoint &host = endpoint.host();
+    __endpoint *ep = arena.create<__endpoint>();
+
+    assign(*ep, host);
+
+    ep->service_name = copy(arena, string_view(host.service_name));
+
+    return ep;
+}
+
+static const ::Endpoint to_host(const __endpoint &ep)
+{
+    ::Endpoint host;
+
+    host.__set_ipv4(ep.ipv4);
+    host.__set_port(ep.port);
+    host.__set_service_name(ep.service_name.str());
+
+    if (ep.has_ipv6)
+    {
+        host.__set_ipv6(std::string(reinterpret_cast<const char *>(ep.ipv6), sizeof(ep.ipv6)));
+    }
+
+    return host;
+}
+
+static inline uint32_t write_string(apache::thrift::protocol::TProtocol &protocol,
+                                    apache::thrift::transport::TTransport &transport,
+                                    const __string &str)
+{
+    if (str.id)
+    {
+        const std::string &bytes = InternTable::instance().thrift(str.id);
+
+        transport.write(reinterpret_cast<const uint8_t *>(bytes.data()), bytes.size());
+
+        return bytes.size();
+    }
+
+    // write the string in TBinaryProtocol format without copying it to a temporary std::string
+    uint32_t wrote = protocol.writeI32(static_cast<int32_t>(str.size));
+
+    transport.write(reinterpret_cast<const uint8_t *>(str.data), str.size);
+
+    return wrote + str.size;
+}
+
+static uint32_t write_endpoint(apache::thrift::protocol::TProtocol &protocol,
+                               apache::thrift::transport::TTransport &transport,
+                               const __endpoint &ep)
+{
+    using namespace apache::thrift::protocol;
+
+    if (ep.cache)
+    {
+        const std::string &bytes = ep.cache->thrift;
+
+        transport.write(reinterpret_cast<const uint8_t *>(bytes.data()), bytes.size());
+
+        return bytes.size();
+    }
+
+    uint32_t wrote = protocol.writeStructBegin("Endpoint");
+
+    wrote += protocol.writeFieldBegin("ipv4", T_I32, 1);
+    wrote += protocol.writeI32(static_cast<int32_t>(ep.ipv4));
+    wrote += protocol.writeFieldEnd();
+
+    wrote += protocol.writeFieldBegin("port", T_I16, 2);
+    wrote += protocol.writeI16(static_cast<int16_t>(ep.port));
+    wrote += protocol.writeFieldEnd();
+
+    wrote += protocol.writeFieldBegin("service_name", T_STRING, 3);
+    wrote += write_string(protocol, transport, ep.service_name);
+    wrote += protocol.writeFieldEnd();
+
+    if (ep.has_ipv6)
+    {
+        wrote += protocol.writeFieldBegin("ipv6", T_STRING, 4);
+        wrote += write_string(protocol, transport, __string{reinterpret_cast<const char *>(ep.ipv6), sizeof(ep.ipv6), 0});
+        wrote += protocol.writeFieldEnd();
+    }
+
+    wrote += protocol.writeFieldStop();
+    wrote += protocol.writeStructEnd();
+
+    return wrote;
+}
+
+/**
+* \brief Serialized thrift bytes of the value, in TBinaryProtocol format
+*
+* The numeric types are converted to big-endian into `buf`, see THRIFT-3217.
+*/
+static __string encode(const __binary_annotation_record &annotation, uint64_t &buf)
+{
+    const char *data = reinterpret_cast<const char *>(&buf);
+
+    switch (annotation.type)
+    {
+    case AnnotationType::BOOL:
+        buf = annotation.number.b ? 1 : 0;
+        return __string{data, sizeof(uint8_t), 0};
+
+    case AnnotationType::I16:
+    {
+        uint16_t v = native_to_big(static_cast<uint16_t>(annotation.number.i16));
+        memcpy(&buf, &v, sizeof(v));
+        return __string{data, sizeof(v), 0};
+    }
+
+    case AnnotationType::I32:
+    {
+        uint32_t v = native_to_big(static_cast<uint32_t>(annotation.number.i32));
+        memcpy(&buf, &v, sizeof(v));
+        return __string{data, sizeof(v), 0};
+    }
+
+    case AnnotationType::I64:
+        buf = native_to_big(static_cast<uint64_t>(annotation.number.i64));
+        return __string{data, sizeof(buf), 0};
+
+    case AnnotationType::DOUBLE:
+        memcpy(&buf, &annotation.number.d, sizeof(buf));
+        return __string{data, sizeof(buf), 0};
+
+    default:
+        return annotation.value;
+    }
+}
+
+} // namespace __impl
+
+EndpointRegistry &EndpointRegistry::instance(void)
+{
+    // never destroyed, spans may release their endpoints during the static destruction
+    static EndpointRegistry *registry = new EndpointRegistry();
+
+    return *registry;
+}
+
+const std::string EndpointRegistry::key(const ::Endpoint &host)
+{
+    std::string key(host.service_name);
+
+    key.push_back('\0');
+    key.append(reinterpret_cast<const char *>(&host.ipv4), sizeof(host.ipv4));
+    key.append(reinterpret_cast<const char *>(&host.port), sizeof(host.port));
+
+    if (host.__isset.ipv6)
+    {
+        key.append(host.ipv6);
+    }
+
+    return key;
+}
+
+const Endpoint *EndpointRegistry::acquire(const Endpoint &endpoint)
+{
+    if (endpoint.registered())
+    {
+        acquire(endpoint.registered());
+
+        return &endpoint;
+    }
+
+    std::string k = key(endpoint.host());
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_entries.find(k);
+
+    if (it != m_entries.end())
+    {
+        acquire(&it->second->record);
+
+        return &it->second->endpoint;
+    }
+
+    Entry *entry = new Entry();
+
+    entry->endpoint = endpoint;
+    entry->endpoint.m_registered = &entry->record;
+    entry->key = std::move(k);
+
+    const ::Endpoint &host = entry->endpoint.host();
+
+    __impl::assign(entry->record, host);
+
+    entry->record.service_name = __impl::__string{host.service_name.data(), host.service_name.size(), 0};
+
+    in_addr addr = {static_cast<in_addr_t>(htonl(host.ipv4))};
+
+    inet_ntop(AF_INET, &addr, entry->cache.ipv4, sizeof(entry->cache.ipv4));
+
+    boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> buf(new apache::thrift::transport::TMemoryBuffer());
+    apache::thrift::protocol::TBinaryProtocol protocol(buf);
+
+    __impl::write_endpoint(protocol, *buf, entry->record);
+
+    entry->cache.thrift = buf->getBufferAsString();
+    entry->cache.refs.store(1, std::memory_order_relaxed);
+    entry->record.cache = &entry->cache;
+
+    m_entries[entry->key] = entry;
+    m_records[&entry->record] = entry;
+
+    VLOG(2) << "Endpoint @ " << &entry->endpoint << " registered, service=" << host.service_name
+            << ", addr=" << entry->endpoint.addr() << ", port=" << host.port;
+
+    return &entry->endpoint;
+}
+
+void EndpointRegistry::remove(const __impl::__endpoint *record)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // the record may have been removed, or even reused, after the last reference was dropped
+    auto it = m_records.find(record);
+
+    if (it == m_records.end() || it->second->cache.refs.load(std::memory_order_acquire))
+        return;
+
+    Entry *entry = it->second;
+
+    VLOG(2) << "Endpoint @ " << &entry->endpoint << " unregistered, service=" << entry->endpoint.service_name();
+
+    m_records.erase(it);
+    m_entries.erase(entry->key);
+
+    delete entry;
+}
+
+size_t EndpointRegistry::size(void)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    return m_entries.size();
+}
+
+Endpoint::Endpoint(const __impl::__endpoint &host) : m_host(__impl::to_host(host))
+{
+}
+
 std::unique_ptr<const struct sockaddr> Endpoint::sockaddr(void) const
 {
     std::unique_ptr<sockaddr_storage> addr(new sockaddr_storage());
@@ -152,55 +435,387 @@ const char *to_string(AnnotationType type)
     }
 }
 
-void Span::reset(const std::string &name, span_id_t parent_id, userdata_t userdata, bool sampled)
+void Span::reset_state(string_view name, userdata_t userdata)
+{
+    m_header = __impl::__span_header();
+
+    Clock *clock = m_tracer ? m_tracer->clock() : nullptr;
+
+    m_clock = clock ? clock : Clock::precise();
+
+    m_name.assign(name.data(), name.size());
+
+    m_start_ticks = 0;
+    m_error = false;
+    m_recorded = false;
+    m_services = SpanServices();
+    m_linker = nullptr;
+    m_estimated_bytes = 0;
+
+    // an unsampled span doesn't read the clock, unless it starts recording later
+    if (m_sampled)
+    {
+        start();
+    }
+
+    m_userdata = userdata;
+
+    release_hosts();
+
+    m_annotations.clear();
+    m_binary_annotations.clear();
+    m_aggregates.clear();
+    m_arena.reset();
+}
+
+void Span::reset(string_view name, span_id_t parent_id, userdata_t userdata, bool sampled)
 {
-    m_span.debug = false;
-    m_span.duration = 0;
-    m_span.annotations.clear();
-    m_span.binary_annotations.clear();
-    m_span.__isset = _Span__isset();
+    m_sampled = sampled;
+
+    reset_state(name, userdata);
 
-    m_span.__set_name(name);
-    m_span.__set_trace_id(next_id());
-    m_span.__set_trace_id_high(next_id());
-    m_span.__set_id(next_id());
-    m_span.__set_debug(0);
-    m_span.__set_timestamp(now().count());
+    IdGenerator *generator = id_generator();
+    x_trace_id_t trace_id = generator->next_trace_id();
+
+    with_trace_id(trace_id.second);
+    with_trace_id_high(trace_id.first);
+    with_id(generator->next_id());
+    with_debug(false);
 
     if (parent_id)
     {
-        m_span.__set_parent_id(parent_id);
+        with_parent_id(parent_id);
     }
-    else
+}
+
+void Span::reset(string_view name, const SpanContext &parent, userdata_t userdata)
+{
+    m_sampled = parent.sampled;
+
+    reset_state(name, userdata);
+
+    with_trace_id(parent.trace_id);
+    with_trace_id_high(parent.trace_id_high);
+    with_id(id_generator()->next_id());
+    with_debug(parent.debug);
+
+    if (parent.span_id)
+    {
+        with_parent_id(parent.span_id);
+    }
+}
+
+const __impl::__endpoint *Span::host(const Endpoint &endpoint, const __impl::__endpoint *replaced)
+{
+    if (replaced && replaced->cache)
     {
-        m_span.parent_id = 0;
+        EndpointRegistry::instance().release(replaced);
+        m_registered_hosts--;
     }
 
-    m_userdata = userdata;
-    m_sampled = sampled;
+    if (const __impl::__endpoint *record = endpoint.registered())
+    {
+        EndpointRegistry::acquire(record);
+        m_registered_hosts++;
+
+        return record;
+    }
+
+    return __impl::copy(m_arena, endpoint);
+}
+
+void Span::release_hosts(void)
+{
+    if (!m_registered_hosts)
+        return;
+
+    EndpointRegistry &registry = EndpointRegistry::instance();
+
+    for (auto annotation = m_annotations.head; annotation; annotation = annotation->next)
+    {
+        if (annotation->host && annotation->host->cache)
+            registry.release(annotation->host);
+    }
+
+    for (auto annotation = m_binary_annotations.head; annotation; annotation = annotation->next)
+    {
+        if (annotation->host && annotation->host->cache)
+            registry.release(annotation->host);
+    }
+
+    m_registered_hosts = 0;
+}
+
+const ::Span &Span::message(void) const
+{
+    if (!m_message)
+    {
+        m_message.reset(new ::Span());
+    }
+
+    ::Span &span = *m_message;
+
+    span = ::Span();
+
+    span.__set_trace_id(m_header.trace_id);
+    span.__set_name(m_name);
+    span.__set_id(m_header.id);
+
+    if (m_header.has(__impl::__span_header::ISSET_PARENT_ID))
+        span.__set_parent_id(m_header.parent_id);
+    if (m_header.has(__impl::__span_header::ISSET_DEBUG))
+        span.__set_debug(m_header.debug);
+    if (m_header.has(__impl::__span_header::ISSET_TIMESTAMP))
+        span.__set_timestamp(m_header.timestamp);
+    if (m_header.has(__impl::__span_header::ISSET_DURATION))
+        span.__set_duration(m_header.duration);
+    if (m_header.has(__impl::__span_header::ISSET_TRACE_ID_HIGH))
+        span.__set_trace_id_high(m_header.trace_id_high);
+
+    for (auto annotation = m_annotations.head; annotation; annotation = annotation->next)
+    {
+        ::Annotation msg;
+
+        msg.__set_timestamp(annotation->timestamp);
+        msg.__set_value(annotation->value.str());
+
+        if (annotation->host)
+        {
+            msg.__set_host(__impl::to_host(*annotation->host));
+        }
+
+        span.annotations.push_back(msg);
+    }
+
+    for (auto annotation = m_binary_annotations.head; annotation; annotation = annotation->next)
+    {
+        ::BinaryAnnotation msg;
+
+        uint64_t buf;
+
+        msg.__set_key(annotation->key.str());
+        msg.__set_value(__impl::encode(*annotation, buf).str());
+        msg.__set_annotation_type(annotation->type);
+
+        if (annotation->host)
+        {
+            msg.__set_host(__impl::to_host(*annotation->host));
+        }
+
+        span.binary_annotations.push_back(msg);
+    }
+
+    span.__isset.annotations = true;
+    span.__isset.binary_annotations = true;
+
+    return span;
+}
+
+size_t Span::serialize_binary(apache::thrift::protocol::TProtocol &protocol) const
+{
+    using namespace apache::thrift::protocol;
+
+    boost::shared_ptr<apache::thrift::transport::TTransport> transport = protocol.getTransport();
+
+    uint32_t wrote = protocol.writeStructBegin("Span");
+
+    wrote += protocol.writeFieldBegin("trace_id", T_I64, 1);
+    wrote += protocol.writeI64(m_header.trace_id);
+    wrote += protocol.writeFieldEnd();
+
+    wrote += protocol.writeFieldBegin("name", T_STRING, 3);
+    wrote += protocol.writeString(m_name);
+    wrote += protocol.writeFieldEnd();
+
+    wrote += protocol.writeFieldBegin("id", T_I64, 4);
+    wrote += protocol.writeI64(m_header.id);
+    wrote += protocol.writeFieldEnd();
+
+    if (m_header.has(__impl::__span_header::ISSET_PARENT_ID))
+    {
+        wrote += protocol.writeFieldBegin("parent_id", T_I64, 5);
+        wrote += protocol.writeI64(m_header.parent_id);
+        wrote += protocol.writeFieldEnd();
+    }
+
+    wrote += protocol.writeFieldBegin("annotations", T_LIST, 6);
+    wrote += protocol.writeListBegin(T_STRUCT, static_cast<uint32_t>(m_annotations.size));
+
+    for (auto annotation = m_annotations.head; annotation; annotation = annotation->next)
+    {
+        wrote += protocol.writeStructBegin("Annotation");
+
+        wrote += protocol.writeFieldBegin("timestamp", T_I64, 1);
+        wrote += protocol.writeI64(annotation->timestamp);
+        wrote += protocol.writeFieldEnd();
+
+        wrote += protocol.writeFieldBegin("value", T_STRING, 2);
+        wrote += __impl::write_string(protocol, *transport, annotation->value);
+        wrote += protocol.writeFieldEnd();
+
+        if (annotation->host)
+        {
+            wrote += protocol.writeFieldBegin("host", T_STRUCT, 3);
+            wrote += __impl::write_endpoint(protocol, *transport, *annotation->host);
+            wrote += protocol.writeFieldEnd();
+        }
+
+        wrote += protocol.writeFieldStop();
+        wrote += protocol.writeStructEnd();
+    }
+
+    wrote += protocol.writeListEnd();
+    wrote += protocol.writeFieldEnd();
+
+    wrote += protocol.writeFieldBegin("binary_annotations", T_LIST, 8);
+    wrote += protocol.writeListBegin(T_STRUCT, static_cast<uint32_t>(m_binary_annotations.size));
+
+    for (auto annotation = m_binary_annotations.head; annotation; annotation = annotation->next)
+    {
+        wrote += protocol.writeStructBegin("BinaryAnnotation");
+
+        wrote += protocol.writeFieldBegin("key", T_STRING, 1);
+        wrote += __impl::write_string(protocol, *transport, annotation->key);
+        wrote += protocol.writeFieldEnd();
+
+        uint64_t buf;
+
+        wrote += protocol.writeFieldBegin("value", T_STRING, 2);
+        wrote += __impl::write_string(protocol, *transport, __impl::encode(*annotation, buf));
+        wrote += protocol.writeFieldEnd();
+
+        wrote += protocol.writeFieldBegin("annotation_type", T_I32, 3);
+        wrote += protocol.writeI32(static_cast<int32_t>(annotation->type));
+        wrote += protocol.writeFieldEnd();
+
+        if (annotation->host)
+        {
+            wrote += protocol.writeFieldBegin("host", T_STRUCT, 4);
+            wrote += __impl::write_endpoint(protocol, *transport, *annotation->host);
+            wrote += protocol.writeFieldEnd();
+        }
+
+        wrote += protocol.writeFieldStop();
+        wrote += protocol.writeStructEnd();
+    }
+
+    wrote += protocol.writeListEnd();
+    wrote += protocol.writeFieldEnd();
+
+    if (m_header.has(__impl::__span_header::ISSET_DEBUG))
+    {
+        wrote += protocol.writeFieldBegin("debug", T_BOOL, 9);
+        wrote += protocol.writeBool(m_header.debug);
+        wrote += protocol.writeFieldEnd();
+    }
+
+    if (m_header.has(__impl::__span_header::ISSET_TIMESTAMP))
+    {
+        wrote += protocol.writeFieldBegin("timestamp", T_I64, 10);
+        wrote += protocol.writeI64(m_header.timestamp);
+        wrote += protocol.writeFieldEnd();
+    }
+
+    if (m_header.has(__impl::__span_header::ISSET_DURATION))
+    {
+        wrote += protocol.writeFieldBegin("duration", T_I64, 11);
+        wrote += protocol.writeI64(m_header.duration);
+        wrote += protocol.writeFieldEnd();
+    }
+
+    if (m_header.has(__impl::__span_header::ISSET_TRACE_ID_HIGH))
+    {
+        wrote += protocol.writeFieldBegin("trace_id_high", T_I64, 12);
+        wrote += protocol.writeI64(m_header.trace_id_high);
+        wrote += protocol.writeFieldEnd();
+    }
+
+    wrote += protocol.writeFieldStop();
+    wrote += protocol.writeStructEnd();
+
+    return wrote;
 }
 
 void Span::submit(void)
 {
-    if (m_span.timestamp)
-        m_span.__set_duration(now().count() - m_span.timestamp);
+    if (m_aggregates.head)
+        submit_aggregates();
+
+    if (m_start_ticks)
+        with_duration(duration_t(std::max<int64_t>(1, m_clock->elapsed(m_start_ticks))));
+    else if (m_header.timestamp)
+        with_duration(duration_t(std::max<int64_t>(1, m_clock->wall() - m_header.timestamp)));
 
     if (m_tracer)
         m_tracer->submit(this);
 }
 
-static boost::thread_specific_ptr<std::mt19937_64> g_rand_gen;
+SpanAggregate Span::aggregate(string_view name)
+{
+    if (!recording())
+        return SpanAggregate(*this);
 
-span_id_t Span::next_id()
+    for (__impl::__aggregate_record *aggregate = m_aggregates.head; aggregate; aggregate = aggregate->next)
+    {
+        if (name == string_view(aggregate->name.data, aggregate->name.size))
+            return SpanAggregate(*this, *aggregate);
+    }
+
+    __impl::__aggregate_record *aggregate = m_arena.create<__impl::__aggregate_record>();
+
+    aggregate->name = __impl::copy(m_arena, name);
+    aggregate->first = aggregate->last = 0;
+    aggregate->count = aggregate->errors = 0;
+    aggregate->total = aggregate->min = aggregate->max = 0;
+
+    m_aggregates.push_back(aggregate);
+
+    return SpanAggregate(*this, *aggregate);
+}
+
+void Span::submit_aggregates(void)
 {
-    if (!g_rand_gen.get())
+    for (__impl::__aggregate_record *aggregate = m_aggregates.head; aggregate; aggregate = aggregate->next)
     {
-        g_rand_gen.reset(new std::mt19937_64((std::chrono::system_clock::now().time_since_epoch().count() << 32) + std::random_device()()));
+        if (!aggregate->count)
+            continue;
+
+        Span *child = span(string_view(aggregate->name.data, aggregate->name.size));
+
+        child->with_timestamp(timestamp_t(aggregate->first));
+        child->with_duration(duration_t(std::max<int64_t>(1, aggregate->last - aggregate->first)));
+
+        child->annotate(SpanAggregate::COUNT, static_cast<int64_t>(aggregate->count));
+        child->annotate(SpanAggregate::TOTAL, aggregate->total);
+        child->annotate(SpanAggregate::MIN, aggregate->min);
+        child->annotate(SpanAggregate::MAX, aggregate->max);
+
+        if (aggregate->errors)
+        {
+            child->annotate(SpanAggregate::ERRORS, static_cast<int64_t>(aggregate->errors));
+            child->annotate(TraceKeys::ERROR, std::to_string(aggregate->errors) + " of " + std::to_string(aggregate->count) + " failed");
+        }
+
+        // the duration was measured by the aggregate, skip Span#submit
+        if (child->tracer())
+            child->tracer()->submit(child);
+        else
+            delete child;
     }
 
-    std::mt19937_64 &rand_gen = *g_rand_gen.get();
+    m_aggregates.clear();
+}
+
+span_id_t Span::next_id()
+{
+    return IdGenerator::random()->next_id();
+}
+
+IdGenerator *Span::id_generator(void) const
+{
+    IdGenerator *generator = m_tracer ? m_tracer->id_generator() : nullptr;
 
-    return rand_gen();
+    return generator ? generator : IdGenerator::random();
 }
 
 timestamp_t Span::now()
@@ -208,87 +823,284 @@ timestamp_t Span::now()
     return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch());
 }
 
-Annotation Span::annotate(const std::string &value, const Endpoint *endpoint)
+const char *const SpanAggregate::COUNT = "aggregate.count";
+const char *const SpanAggregate::ERRORS = "aggregate.errors";
+const char *const SpanAggregate::TOTAL = "aggregate.total_us";
+const char *const SpanAggregate::MIN = "aggregate.min_us";
+const char *const SpanAggregate::MAX = "aggregate.max_us";
+
+SpanAggregate &SpanAggregate::record(duration_t duration, bool error)
 {
-    ::Annotation annotation;
+    if (!m_aggregate)
+        return *this;
 
-    annotation.__set_timestamp(now().count());
-    annotation.__set_value(value);
+    int64_t us = std::max<int64_t>(0, duration.count());
+    int64_t now = m_span.elapsed_now().count();
 
-    if (endpoint)
+    if (!m_aggregate->count)
     {
-        annotation.__set_host(endpoint->host());
+        m_aggregate->first = now - us;
+        m_aggregate->min = m_aggregate->max = us;
     }
 
-    m_span.annotations.push_back(annotation);
+    m_aggregate->first = std::min(m_aggregate->first, now - us);
+    m_aggregate->last = now;
+    m_aggregate->count++;
+    m_aggregate->total += us;
+    m_aggregate->min = std::min(m_aggregate->min, us);
+    m_aggregate->max = std::max(m_aggregate->max, us);
+
+    if (error)
+        m_aggregate->errors++;
+
+    return *this;
+}
+
+SpanAggregate::Timer::Timer(const SpanAggregate &aggregate)
+    : m_span(aggregate.m_span), m_aggregate(aggregate.m_aggregate), m_start_ticks(m_aggregate ? m_span.clock()->ticks() : 0)
+{
+}
+
+SpanAggregate::Timer::~Timer()
+{
+    if (m_start_ticks)
+        SpanAggregate(m_span, *m_aggregate).record(duration_t(m_span.clock()->elapsed(m_start_ticks)), m_error);
+}
 
-    return Annotation(*this, m_span.annotations.back());
+Annotation &Annotation::with_value(string_view value)
+{
+    if (m_annotation)
+        m_annotation->value = __impl::copy(m_span.arena(), value);
+    return *this;
 }
 
-BinaryAnnotation Span::annotate(const std::string &key, const uint8_t *value, size_t size, const Endpoint *endpoint)
+Annotation &Annotation::with_endpoint(const Endpoint &endpoint)
 {
-    ::BinaryAnnotation annotation;
+    if (m_annotation)
+        m_annotation->host = m_span.host(endpoint, m_annotation->host);
+    return *this;
+}
 
-    annotation.__set_key(key);
-    annotation.__set_value(std::string(reinterpret_cast<const char *>(value), size));
-    annotation.__set_annotation_type(AnnotationType::BYTES);
+const std::string BinaryAnnotation::value(void) const
+{
+    if (!m_annotation)
+        return std::string();
+
+    uint64_t buf;
+
+    return __impl::encode(*m_annotation, buf).str();
+}
+
+BinaryAnnotation &BinaryAnnotation::with_value(const void *value, size_t size, AnnotationType type)
+{
+    if (m_annotation)
+    {
+        m_annotation->value = __impl::copy(m_span.arena(), value, size);
+        m_annotation->type = type;
+    }
+    return *this;
+}
+
+BinaryAnnotation &BinaryAnnotation::with_endpoint(const Endpoint &endpoint)
+{
+    if (m_annotation)
+        m_annotation->host = m_span.host(endpoint, m_annotation->host);
+    return *this;
+}
+
+Annotation Span::annotate(string_view value, const Endpoint *endpoint)
+{
+    if (value == TraceKeys::ERROR)
+        m_error = true;
+
+    record_service(value, endpoint);
+
+    if (!recording())
+        return Annotation(*this);
+
+    __impl::__annotation_record *annotation = m_arena.create<__impl::__annotation_record>();
+
+    annotation->timestamp = elapsed_now().count();
+    annotation->value = __impl::copy(m_arena, value);
 
     if (endpoint)
     {
-        annotation.__set_host(endpoint->host());
+        annotation->host = host(*endpoint);
     }
 
-    m_span.binary_annotations.push_back(annotation);
+    m_annotations.push_back(annotation);
 
-    return BinaryAnnotation(*this, m_span.binary_annotations.back());
+    return Annotation(*this, *annotation);
 }
 
-BinaryAnnotation Span::annotate(const std::string &key, const std::string &value, const Endpoint *endpoint)
+void Span::link_service(string_view key, const Endpoint &endpoint)
 {
-    ::BinaryAnnotation annotation;
+    intern_t *service;
+
+    if (key == TraceKeys::CLIENT_SEND)
+        service = &m_services.client;
+    else if (key == TraceKeys::SERVER_RECV)
+        service = &m_services.server;
+    else if (key == TraceKeys::CLIENT_ADDR)
+        service = &m_services.client_addr;
+    else if (key == TraceKeys::SERVER_ADDR)
+        service = &m_services.server_addr;
+    else
+        return;
 
-    annotation.__set_key(key);
-    annotation.__set_value(value);
-    annotation.__set_annotation_type(AnnotationType::STRING);
+    // the service names are few, the linker assigns them an id once and they are never copied into the span
+    const std::string &name = endpoint.service_name();
 
-    if (endpoint)
+    if (!name.empty())
+        *service = m_linker->service(name);
+}
+
+bool Span::annotated(string_view key) const
+{
+    for (const __impl::__annotation_record *annotation = m_annotations.head; annotation; annotation = annotation->next)
+    {
+        if (key == string_view(annotation->value.data, annotation->value.size))
+            return true;
+    }
+
+    for (const __impl::__binary_annotation_record *annotation = m_binary_annotations.head; annotation; annotation = annotation->next)
+    {
+        if (key == string_view(annotation->key.data, annotation->key.size))
+            return true;
+    }
+
+    return false;
+}
+
+size_t Span::text_size(size_t *endpoints) const
+{
+    size_t size = m_name.size(), hosts = 0;
+
+    for (const __impl::__annotation_record *annotation = m_annotations.head; annotation; annotation = annotation->next)
+    {
+        size += annotation->value.size;
+
+        if (annotation->host)
+        {
+            size += annotation->host->service_name.size;
+            hosts++;
+        }
+    }
+
+    for (const __impl::__binary_annotation_record *annotation = m_binary_annotations.head; annotation; annotation = annotation->next)
     {
-        annotation.__set_host(endpoint->host());
+        size += annotation->key.size + annotation->value.size;
+
+        if (annotation->host)
+        {
+            size += annotation->host->service_name.size;
+            hosts++;
+        }
     }
 
-    m_span.binary_annotations.push_back(annotation);
+    if (endpoints)
+        *endpoints = hosts;
 
-    return BinaryAnnotation(*this, m_span.binary_annotations.back());
+    return size;
 }
 
-BinaryAnnotation Span::annotate(const std::string &key, const std::wstring &value, const Endpoint *endpoint)
+__impl::__binary_annotation_record *Span::new_binary_annotation(string_view key, AnnotationType type, const Endpoint *endpoint)
 {
-    ::BinaryAnnotation annotation;
+    __impl::__binary_annotation_record *annotation = m_arena.create<__impl::__binary_annotation_record>();
 
-    annotation.__set_key(key);
-    annotation.__set_value(boost::locale::conv::utf_to_utf<char>(value));
-    annotation.__set_annotation_type(AnnotationType::STRING);
+    annotation->key = __impl::copy(m_arena, key);
+    annotation->type = type;
 
     if (endpoint)
     {
-        annotation.__set_host(endpoint->host());
+        annotation->host = host(*endpoint);
     }
 
-    m_span.binary_annotations.push_back(annotation);
+    m_binary_annotations.push_back(annotation);
+
+    return annotation;
+}
+
+BinaryAnnotation Span::annotate(string_view key, const void *value, size_t size, AnnotationType type, const Endpoint *endpoint)
+{
+    if (key == TraceKeys::ERROR)
+        m_error = true;
+
+    record_service(key, endpoint);
+
+    if (!recording())
+        return BinaryAnnotation(*this);
+
+    __impl::__binary_annotation_record *annotation = new_binary_annotation(key, type, endpoint);
+
+    annotation->value = __impl::copy(m_arena, value, size);
 
-    return BinaryAnnotation(*this, m_span.binary_annotations.back());
+    return BinaryAnnotation(*this, *annotation);
 }
 
-size_t CachedSpan::cache_size(void) const
+BinaryAnnotation Span::annotate(string_view key, const uint8_t *value, size_t size, const Endpoint *endpoint)
 {
-    return static_cast<CachedTracer *>(m_tracer)->cache().message_size() - cache_offset();
+    return annotate(key, value, size, AnnotationType::BYTES, endpoint);
+}
+
+BinaryAnnotation Span::annotate(string_view key, string_view value, const Endpoint *endpoint)
+{
+    return annotate(key, value.data(), value.size(), AnnotationType::STRING, endpoint);
+}
+
+BinaryAnnotation Span::annotate(string_view key, const std::wstring &value, const Endpoint *endpoint)
+{
+    if (!recording())
+    {
+        if (key == TraceKeys::ERROR)
+            m_error = true;
+
+        record_service(key, endpoint);
+
+        return BinaryAnnotation(*this);
+    }
+
+    const std::string utf8 = boost::locale::conv::utf_to_utf<char>(value);
+
+    return annotate(key, utf8.data(), utf8.size(), AnnotationType::STRING, endpoint);
+}
+
+size_t CachedSpan::buffer_size(void) const
+{
+    return m_cache ? m_cache->message_size() - cache_offset() : 0;
+}
+
+SpanCache *CachedSpan::default_cache(Tracer *tracer)
+{
+    return tracer ? &static_cast<CachedTracer *>(tracer)->cache() : nullptr;
+}
+
+Slab *CachedSpan::cache_slab(SpanCache *cache)
+{
+    return cache ? cache->slab() : nullptr;
 }
 
 void *CachedSpan::operator new(size_t size, CachedTracer *tracer) noexcept
 {
-    size_t sz = tracer ? tracer->cache().message_size() : size;
+    return operator new(size, tracer ? &tracer->cache() : nullptr);
+}
+
+void *CachedSpan::operator new(size_t size, SpanCache *cache) noexcept
+{
+    size_t sz = cache ? cache->message_size() : size;
     void *p = nullptr;
 
+    if (Slab *slab = cache_slab(cache))
+    {
+        // a slab can't be mapped, fall back to the heap, the span is freed by its owner lookup
+        if ((p = slab->allocate()))
+        {
+            VLOG(3) << "Span @ " << p << " allocated from slab with " << slab->chunk_size() << " bytes";
+
+            return p;
+        }
+    }
+
     if (posix_memalign(&p, CachedTracer::CACHE_LINE_SIZE, sz))
         return nullptr;
 
@@ -299,33 +1111,50 @@ void *CachedSpan::operator new(size_t size, CachedTracer *tracer) noexcept
 
 void CachedSpan::operator delete(void *ptr, std::size_t sz) noexcept
 {
-    if (!ptr)
-        return;
+    VLOG(3) << "Span @ " << ptr << " deleted with " << sz << " bytes";
 
-    CachedSpan *span = static_cast<CachedSpan *>(ptr);
+    deallocate(ptr);
+}
 
-    VLOG(3) << "Span @ " << ptr << " deleted with " << sz << " bytes, id=" << std::hex << span->id();
+void CachedSpan::operator delete(void *ptr, SpanCache *cache) noexcept
+{
+    deallocate(ptr);
+}
 
-    free(ptr);
+void CachedSpan::operator delete(void *ptr, CachedTracer *tracer) noexcept
+{
+    deallocate(ptr);
 }
 
-Span *CachedSpan::span(const std::string &name, userdata_t userdata) const
+void CachedSpan::deallocate(void *ptr) noexcept
 {
-    std::unique_ptr<Span> span;
+    if (!ptr)
+        return;
 
+    if (Slab *slab = Slab::owner(ptr))
+        slab->deallocate(ptr);
+    else
+        free(ptr);
+}
+
+Span *Span::span(string_view name, userdata_t userdata) const
+{
     if (m_tracer)
     {
-        span.reset(m_tracer->span(m_span.name, m_span.id, userdata));
+        return inherit_services(m_tracer->span(name, context(), userdata));
     }
-    else
+
+    return inherit_services(new Span(nullptr, name, context(), userdata));
+}
+
+Span *CachedSpan::span(string_view name, userdata_t userdata) const
+{
+    if (m_tracer)
     {
-        span.reset(new (nullptr) CachedSpan(nullptr, m_span.name, m_span.id, userdata));
+        return inherit_services(m_tracer->span(name, context(), userdata));
     }
 
-    span->with_trace_id(trace_id());
-    span->with_trace_id_high(trace_id_high());
-
-    return span.release();
+    return inherit_services(new (static_cast<SpanCache *>(nullptr)) CachedSpan(nullptr, name, context(), userdata));
 }
 
 void CachedSpan::release(void)
@@ -3,11 +3,19 @@
 #include <arpa/inet.h>
 
 #include <cstdint>
+#include <cstring>
+#include <cwchar>
+#include <algorithm>
 #include <locale>
 #include <memory>
 #include <chrono>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
 
 #include <boost/locale/encoding_utf.hpp>
+#include <boost/utility/string_view.hpp>
 #include <boost/asio.hpp>
 using namespace ::boost::asio;
 
@@ -17,6 +25,10 @@ using namespace ::boost::asio;
 
 #include "Config.h"
 #include "Base64.h"
+#include "Arena.h"
+#include "Intern.h"
+#include "IdGenerator.h"
+#include "Clock.h"
 
 typedef uint64_t span_id_t;
 typedef uint64_t trace_id_t;
@@ -35,20 +47,189 @@ typedef void *userdata_t;
 namespace zipkin
 {
 
+/**
+* \brief Non-owning reference to a string
+*
+* Keys, values and names are passed as views, so literals, `const char *` and `std::string` are
+* copied once into the span instead of building a temporary `std::string` at the call site.
+*/
+using string_view = boost::string_view;
+
+namespace __impl
+{
+
+/**
+* \brief String stored in the Arena of a Span, or in the InternTable when it has a handle
+*/
+struct __string
+{
+    const char *data;
+    size_t size;
+    intern_t id;
+
+    inline const std::string str(void) const { return std::string(data, size); }
+};
+
+/**
+* \brief Encoded forms of an Endpoint in the EndpointRegistry
+*/
+struct __endpoint_cache
+{
+    std::atomic<size_t> refs;
+    std::string thrift; // serialized thrift struct, in TBinaryProtocol format
+    char ipv4[INET_ADDRSTRLEN];
+};
+
+/**
+* \brief Endpoint stored in the Arena of a Span, or shared by the EndpointRegistry when it has a cache
+*/
+struct __endpoint
+{
+    uint32_t ipv4;
+    uint16_t port;
+    bool has_ipv6;
+    uint8_t ipv6[16];
+    __string service_name;
+    __endpoint_cache *cache;
+};
+
+/**
+* \brief Annotation stored in the Arena of a Span
+*/
+struct __annotation_record
+{
+    __annotation_record *next;
+    int64_t timestamp;
+    __string value;
+    const __endpoint *host;
+};
+
+/**
+* \brief Numeric value of a BinaryAnnotation, kept in native byte order
+*/
+union __number {
+    bool b;
+    int16_t i16;
+    int32_t i32;
+    int64_t i64;
+    double d;
+};
+
+/**
+* \brief BinaryAnnotation stored in the Arena of a Span
+*
+* AnnotationType#STRING and AnnotationType#BYTES values are kept in `value`, the numeric types are kept inline
+* in `number` and only converted to the big-endian thrift bytes when the span is encoded.
+*/
+struct __binary_annotation_record
+{
+    __binary_annotation_record *next;
+    __string key;
+    __string value;
+    __number number;
+    ::AnnotationType::type type;
+    const __endpoint *host;
+};
+
+/**
+* \brief Timings of the repeated child spans folded by Span#aggregate, stored in the Arena of the parent Span
+*/
+struct __aggregate_record
+{
+    __aggregate_record *next;
+    __string name;
+    int64_t first;  // the start timestamp of the first child
+    int64_t last;   // the finish timestamp of the last child
+    uint64_t count;
+    uint64_t errors;
+    int64_t total;
+    int64_t min;
+    int64_t max;
+};
+
+/**
+* \brief Intrusive singly linked list of the records allocated from an Arena
+*/
+template <typename T>
+struct __list
+{
+    T *head = nullptr;
+    T *tail = nullptr;
+    size_t size = 0;
+
+    inline void clear(void)
+    {
+        head = tail = nullptr;
+        size = 0;
+    }
+
+    inline void push_back(T *item)
+    {
+        item->next = nullptr;
+
+        if (tail)
+        {
+            tail->next = item;
+        }
+        else
+        {
+            head = item;
+        }
+
+        tail = item;
+        size++;
+    }
+};
+
+/**
+* \brief Fixed-size header of a Span, the thrift message is only built by Span#message
+*/
+struct __span_header
+{
+    enum : uint8_t
+    {
+        ISSET_PARENT_ID = 1 << 0,
+        ISSET_DEBUG = 1 << 1,
+        ISSET_TIMESTAMP = 1 << 2,
+        ISSET_DURATION = 1 << 3,
+        ISSET_TRACE_ID_HIGH = 1 << 4,
+    };
+
+    trace_id_t trace_id;
+    trace_id_t trace_id_high;
+    span_id_t id;
+    span_id_t parent_id;
+    int64_t timestamp;
+    int64_t duration;
+    bool debug;
+    uint8_t isset;
+
+    inline bool has(uint8_t field) const { return isset & field; }
+};
+
+} // namespace __impl
+
 /**
  * \brief Indicates the network context of a service recording an annotation with two exceptions.
  */
 class Endpoint
 {
     ::Endpoint m_host;
+    const __impl::__endpoint *m_registered = nullptr;
+
+    friend class EndpointRegistry;
 
   public:
     Endpoint()
     {
     }
+    Endpoint(const Endpoint &endpoint) : m_host(endpoint.m_host)
+    {
+    }
     Endpoint(const ::Endpoint &host) : m_host(host)
     {
     }
+    Endpoint(const __impl::__endpoint &host);
     Endpoint(const std::string &service)
     {
         with_service_name(service);
@@ -135,36 +316,121 @@ class Endpoint
     inline Endpoint &with_port(port_t port);
 
     inline const ::Endpoint &host(void) const { return m_host; }
+
+    /**
+    * \brief The shared record of an Endpoint returned by EndpointRegistry#acquire, or nullptr
+    */
+    inline const __impl::__endpoint *registered(void) const { return m_registered; }
+
+    Endpoint &operator=(const Endpoint &endpoint)
+    {
+        m_host = endpoint.m_host;
+        return *this;
+    }
+};
+
+/**
+* \brief Process-wide registry of the endpoints, keyed by service name, address and port
+*
+* The registry returns stable and reference counted endpoints. Annotations recorded with a registered endpoint
+* hold a reference instead of copying it, and the codecs write its cached encoding.
+*
+* \code
+* const zipkin::Endpoint *endpoint = zipkin::EndpointRegistry::instance().acquire(zipkin::Endpoint("proxy", addr));
+*
+* span << zipkin::TraceKeys::SERVER_RECV << *endpoint;
+*
+* zipkin::EndpointRegistry::instance().release(endpoint);
+* \endcode
+*/
+class EndpointRegistry
+{
+    struct Entry
+    {
+        Endpoint endpoint;
+        __impl::__endpoint record;
+        __impl::__endpoint_cache cache;
+        std::string key;
+    };
+
+    static const std::string key(const ::Endpoint &host);
+
+    std::mutex m_mutex;
+    std::unordered_map<std::string, Entry *> m_entries;
+    std::unordered_map<const __impl::__endpoint *, Entry *> m_records;
+
+    void remove(const __impl::__endpoint *record);
+
+  public:
+    static EndpointRegistry &instance(void);
+
+    /**
+    * \brief Find or register the endpoint and take a reference
+    */
+    const Endpoint *acquire(const Endpoint &endpoint);
+
+    /**
+    * \brief Take another reference of a registered endpoint
+    */
+    static void acquire(const __impl::__endpoint *record) { record->cache->refs.fetch_add(1, std::memory_order_relaxed); }
+
+    /**
+    * \brief Drop a reference, the endpoint is removed with the last one
+    */
+    void release(const Endpoint *endpoint) { release(endpoint->registered()); }
+
+    void release(const __impl::__endpoint *record)
+    {
+        if (record->cache->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            remove(record);
+    }
+
+    /**
+    * \brief Number of the registered endpoints
+    */
+    size_t size(void);
 };
 
 struct Tracer;
 class CachedTracer;
+class SpanCache;
+class Slab;
 class Span;
+class CachedSpan;
+class DependencyLinker;
 
 /**
 * \brief Associates an event that explains latency with a timestamp.
 *
 * Unlike log statements, annotations are often codes: Ex. {@link TraceKeys#SERVER_RECV "sr"}.
+*
+* The annotation of a span which isn't recording is a no-op, see Span#recording.
 */
 class Annotation
 {
     Span &m_span;
-    ::Annotation &m_annotation;
+    __impl::__annotation_record *m_annotation;
 
   public:
-    Annotation(Span &span, ::Annotation &annotation) : m_span(span), m_annotation(annotation) {}
+    Annotation(Span &span, __impl::__annotation_record &annotation) : m_span(span), m_annotation(&annotation) {}
+
+    /**
+    * \brief The no-op annotation of a span which isn't recording
+    */
+    explicit Annotation(Span &span) : m_span(span), m_annotation(nullptr) {}
 
     Span &span(void) { return m_span; }
 
     /**
     * \brief Microseconds from epoch.
     */
-    timestamp_t timestamp(void) const { return timestamp_t(m_annotation.timestamp); }
+    timestamp_t timestamp(void) const { return timestamp_t(m_annotation ? m_annotation->timestamp : 0); }
 
     /** \sa Annotation#timestamp */
     Annotation &with_timestamp(timestamp_t timestamp)
     {
-        m_annotation.timestamp = timestamp.count();
+        if (m_annotation)
+            m_annotation->timestamp = timestamp.count();
         return *this;
     }
 
@@ -172,26 +438,18 @@ class Annotation
     * \brief Usually a short tag indicating an event, like {@link TraceKeys#SERVER_RECV "sr"}. or {@link
     * TraceKeys#ERROR "error"}
     */
-    const std::string &value(void) const { return m_annotation.value; }
+    const std::string value(void) const { return m_annotation ? m_annotation->value.str() : std::string(); }
 
     /** \sa Annotation#value */
-    Annotation &with_value(const std::string &value)
-    {
-        m_annotation.value = value;
-        return *this;
-    }
+    Annotation &with_value(string_view value);
 
     /**
      * \brief The host that recorded #value, primarily for query by service name.
      */
-    const Endpoint endpoint(void) const { return Endpoint(m_annotation.host); }
+    const Endpoint endpoint(void) const { return m_annotation && m_annotation->host ? Endpoint(*m_annotation->host) : Endpoint(); }
 
     /** \sa Annotation#endpoint */
-    Annotation &with_endpoint(const Endpoint &endpoint)
-    {
-        m_annotation.host = endpoint.host();
-        return *this;
-    }
+    Annotation &with_endpoint(const Endpoint &endpoint);
 };
 
 /**
@@ -400,10 +658,17 @@ struct TraceKeys
 class BinaryAnnotation
 {
     Span &m_span;
-    ::BinaryAnnotation &m_annotation;
+    __impl::__binary_annotation_record *m_annotation;
+
+    BinaryAnnotation &with_value(const void *value, size_t size, AnnotationType type);
 
   public:
-    BinaryAnnotation(Span &span, ::BinaryAnnotation &annotation) : m_span(span), m_annotation(annotation) {}
+    BinaryAnnotation(Span &span, __impl::__binary_annotation_record &annotation) : m_span(span), m_annotation(&annotation) {}
+
+    /**
+    * \brief The no-op annotation of a span which isn't recording
+    */
+    explicit BinaryAnnotation(Span &span) : m_span(span), m_annotation(nullptr) {}
 
     Span &span(void) { return m_span; }
 
@@ -412,19 +677,19 @@ class BinaryAnnotation
     *
     * Note: type shouldn't vary for the same key.
     */
-    AnnotationType type(void) const { return m_annotation.annotation_type; }
+    AnnotationType type(void) const { return m_annotation ? m_annotation->type : AnnotationType::BYTES; }
 
     /**
     * \brief Name used to lookup spans, such as {@link TraceKeys#HTTP_PATH "http.path"} or {@link
     * TraceKeys#ERROR "error"}
     */
-    const std::string &key(void) const { return m_annotation.key; }
+    const std::string key(void) const { return m_annotation ? m_annotation->key.str() : std::string(); }
     /**
     * \brief Serialized thrift bytes, in TBinaryProtocol format.
     *
     * For legacy reasons, byte order is big-endian. See THRIFT-3217.
     */
-    const std::string &value(void) const { return m_annotation.value; }
+    const std::string value(void) const;
 
     /**
     * \brief Annotate with value
@@ -441,9 +706,7 @@ class BinaryAnnotation
     */
     inline BinaryAnnotation &with_value(const uint8_t *value, size_t size)
     {
-        m_annotation.value = std::string(reinterpret_cast<const char *>(value), size);
-        m_annotation.annotation_type = AnnotationType::BYTES;
-        return *this;
+        return with_value(value, size, AnnotationType::BYTES);
     }
     /**
     * \brief Annotate with AnnotationType#BYTES
@@ -471,9 +734,26 @@ class BinaryAnnotation
     */
     inline BinaryAnnotation &with_value(const std::string &value)
     {
-        m_annotation.value = value;
-        m_annotation.annotation_type = AnnotationType::STRING;
-        return *this;
+        return with_value(value.data(), value.size(), AnnotationType::STRING);
+    }
+    /**
+    * \brief Annotate with AnnotationType#STRING
+    *
+    * \sa BinaryAnnotation#value
+    */
+    inline BinaryAnnotation &with_value(string_view value)
+    {
+        return with_value(value.data(), value.size(), AnnotationType::STRING);
+    }
+    /**
+    * \brief Annotate with AnnotationType#STRING, without the trailing NUL of a literal
+    *
+    * \sa BinaryAnnotation#value
+    */
+    template <size_t N>
+    inline BinaryAnnotation &with_value(char const (&value)[N])
+    {
+        return with_value(value, strnlen(value, N), AnnotationType::STRING);
     }
     /**
     * \brief Annotate with AnnotationType#STRING
@@ -482,7 +762,7 @@ class BinaryAnnotation
     */
     inline BinaryAnnotation &with_value(const char *value, int len = -1)
     {
-        return with_value(len >= 0 ? std::string(value, len) : std::string(value));
+        return with_value(value, len >= 0 ? len : strlen(value), AnnotationType::STRING);
     }
     /**
     * \brief Annotate with AnnotationType#STRING
@@ -510,19 +790,136 @@ class BinaryAnnotation
     * TraceKeys#SERVER_ADDR}, this is the source or destination of an RPC. This exception allows
     * zipkin to display network context of uninstrumented services, such as browsers or databases.
     */
-    const Endpoint endpoint(void) const { return Endpoint(m_annotation.host); }
+    const Endpoint endpoint(void) const { return m_annotation && m_annotation->host ? Endpoint(*m_annotation->host) : Endpoint(); }
     /**
     * \brief Annotate with Endpoint
     *
     * \sa BinaryAnnotation#endpoint
     */
-    BinaryAnnotation &with_endpoint(const Endpoint &endpoint)
+    BinaryAnnotation &with_endpoint(const Endpoint &endpoint);
+};
+
+/**
+* \brief The repeated child spans with a name, folded into a single summary child span
+*
+* The summary span is submitted with its parent, it lasts from the start of the first child to the finish of the last one,
+* and carries the #COUNT, #TOTAL, #MIN and #MAX durations in microseconds as binary annotations.
+*
+* \sa Span#aggregate
+*/
+class SpanAggregate
+{
+    Span &m_span;
+    __impl::__aggregate_record *m_aggregate;
+
+  public:
+    static const char *const COUNT;  ///< "aggregate.count"
+    static const char *const ERRORS; ///< "aggregate.errors"
+    static const char *const TOTAL;  ///< "aggregate.total_us"
+    static const char *const MIN;    ///< "aggregate.min_us"
+    static const char *const MAX;    ///< "aggregate.max_us"
+
+    SpanAggregate(Span &span, __impl::__aggregate_record &aggregate) : m_span(span), m_aggregate(&aggregate) {}
+
+    /**
+    * \brief The no-op aggregate of a span which isn't recording
+    */
+    explicit SpanAggregate(Span &span) : m_span(span), m_aggregate(nullptr) {}
+
+    Span &span(void) { return m_span; }
+
+    /**
+    * \brief Number of the folded child spans
+    */
+    uint64_t count(void) const { return m_aggregate ? m_aggregate->count : 0; }
+
+    /**
+    * \brief Total duration of the folded child spans
+    */
+    duration_t total(void) const { return duration_t(m_aggregate ? m_aggregate->total : 0); }
+
+    /**
+    * \brief Fold a child span which finished now, after the duration
+    */
+    SpanAggregate &record(duration_t duration, bool error = false);
+
+    /**
+    * \brief Measures a child span from its construction to its destruction
+    */
+    class Timer
+    {
+        Span &m_span;
+        __impl::__aggregate_record *m_aggregate;
+        uint64_t m_start_ticks;
+        bool m_error = false;
+
+      public:
+        explicit Timer(const SpanAggregate &aggregate);
+
+        Timer(Timer &&timer)
+            : m_span(timer.m_span), m_aggregate(timer.m_aggregate), m_start_ticks(timer.m_start_ticks), m_error(timer.m_error)
+        {
+            timer.m_start_ticks = 0;
+        }
+
+        Timer(const Timer &) = delete;
+        Timer &operator=(const Timer &) = delete;
+
+        ~Timer();
+
+        /**
+        * \brief The child span failed
+        */
+        void fail(void) { m_error = true; }
+    };
+
+    /**
+    * \brief Start measuring a child span
+    */
+    Timer time(void) { return Timer(*this); }
+};
+
+/**
+* \brief The identifiers and sampling state which a child span inherits from its parent
+*
+* \sa Span#context
+*/
+struct SpanContext
+{
+    trace_id_t trace_id = 0;
+    trace_id_t trace_id_high = 0;
+    span_id_t span_id = 0;
+    bool sampled = true;
+    bool debug = false;
+
+    SpanContext() {}
+    SpanContext(trace_id_t trace_id, span_id_t span_id, trace_id_t trace_id_high = 0, bool sampled = true, bool debug = false)
+        : trace_id(trace_id), trace_id_high(trace_id_high), span_id(span_id), sampled(sampled), debug(debug)
     {
-        m_annotation.host = endpoint.host();
-        return *this;
     }
 };
 
+/**
+* \brief The service ids of a RPC span, kept even when the span isn't recording
+*
+* The ids are assigned by the DependencyLinker of the tracer, the services are not kept without one.
+*
+* \sa DependencyLinker#service
+*/
+struct SpanServices
+{
+    intern_t client = 0;      ///< the endpoint of TraceKeys#CLIENT_SEND
+    intern_t server = 0;      ///< the endpoint of TraceKeys#SERVER_RECV
+    intern_t client_addr = 0; ///< the endpoint of TraceKeys#CLIENT_ADDR
+    intern_t server_addr = 0; ///< the endpoint of TraceKeys#SERVER_ADDR
+    intern_t parent = 0;      ///< the local service of the parent span, when it was created in the process
+
+    /**
+    * \brief The service of the process which recorded the span
+    */
+    inline intern_t local(void) const { return server ? server : client; }
+};
+
 /**
 * \brief A trace is a series of spans (often RPC calls) which form a latency tree.
 *
@@ -540,26 +937,119 @@ class Span
 {
   protected:
     Tracer *m_tracer;
-    ::Span m_span;
+    __impl::__span_header m_header;
+    std::string m_name;
+    mutable std::unique_ptr<::Span> m_message;
     userdata_t m_userdata;
     bool m_sampled;
+    bool m_recorded = false; // recorded locally, regardless of the propagated head decision
+    bool m_error = false;
+    SpanServices m_services;
+    Arena m_arena;
+    __impl::__list<__impl::__annotation_record> m_annotations;
+    __impl::__list<__impl::__binary_annotation_record> m_binary_annotations;
+    __impl::__list<__impl::__aggregate_record> m_aggregates;
+
+    size_t m_registered_hosts = 0;
+    Clock *m_clock = nullptr;
+    uint64_t m_start_ticks = 0;
+    DependencyLinker *m_linker = nullptr;
+    size_t m_estimated_bytes = 0;
+
+    /**
+    * \brief Record the endpoint of an annotation, the registered endpoint is referenced instead of copied
+    */
+    const __impl::__endpoint *host(const Endpoint &endpoint, const __impl::__endpoint *replaced = nullptr);
 
-    static const ::Endpoint host(const Endpoint *endpoint);
+    void release_hosts(void);
+
+    void reset_state(string_view name, userdata_t userdata);
+
+    /**
+    * \brief Keep the service of a RPC annotation, even when the span isn't recording
+    *
+    * Nothing is kept without an endpoint or a dependency linker.
+    */
+    inline void record_service(string_view key, const Endpoint *endpoint)
+    {
+        if (endpoint && m_linker)
+            link_service(key, *endpoint);
+    }
+
+    void link_service(string_view key, const Endpoint &endpoint);
+
+    /**
+    * \brief Submit the summary child spans of the aggregates
+    */
+    void submit_aggregates(void);
+
+    /**
+    * \brief The child span inherits the local service of its parent
+    */
+    inline Span *inherit_services(Span *child) const
+    {
+        if (child)
+            child->m_services.parent = m_services.local();
+        return child;
+    }
+
+    /**
+    * \brief Anchor the timestamp when the span starts recording
+    */
+    inline void start(void)
+    {
+        m_header.timestamp = m_clock->wall();
+        m_header.isset |= __impl::__span_header::ISSET_TIMESTAMP;
+        m_start_ticks = m_clock->ticks();
+    }
+
+    friend class Annotation;
+    friend class BinaryAnnotation;
+
+    __impl::__binary_annotation_record *new_binary_annotation(string_view key, AnnotationType type, const Endpoint *endpoint);
+
+    BinaryAnnotation annotate(string_view key, const void *value, size_t size, AnnotationType type, const Endpoint *endpoint);
 
   public:
     /**
      * \brief Construct a span
      */
-    Span(Tracer *tracer, const std::string &name, span_id_t parent_id = 0, userdata_t userdata = nullptr, bool sampled = true)
+    Span(Tracer *tracer, string_view name, span_id_t parent_id = 0, userdata_t userdata = nullptr, bool sampled = true)
         : m_tracer(tracer)
     {
         reset(name, parent_id, userdata, sampled);
     }
 
+    /**
+     * \brief Construct a child span of the parent context
+     */
+    Span(Tracer *tracer, string_view name, const SpanContext &parent, userdata_t userdata = nullptr)
+        : m_tracer(tracer)
+    {
+        reset(name, parent, userdata);
+    }
+
+    virtual ~Span() { release_hosts(); }
+
     /**
      * \brief Reset a span
      */
-    void reset(const std::string &name, span_id_t parent_id = 0, userdata_t userdata = nullptr, bool sampled = true);
+    void reset(string_view name, span_id_t parent_id = 0, userdata_t userdata = nullptr, bool sampled = true);
+
+    /**
+     * \brief Reset a span as the child of the parent context
+     *
+     * The trace identifiers are inherited, only the span id is generated.
+     */
+    void reset(string_view name, const SpanContext &parent, userdata_t userdata = nullptr);
+
+    /**
+     * \brief The context which the child spans inherit
+     */
+    inline SpanContext context(void) const
+    {
+        return SpanContext(m_header.trace_id, m_header.id, m_header.trace_id_high, m_sampled, m_header.debug);
+    }
 
     /**
      * \brief Submit a Span to Tracer
@@ -575,6 +1065,11 @@ class Span
      */
     virtual void release(void) { delete this; }
 
+    /**
+     * \brief The span as a CachedSpan, or nullptr when it isn't allocated by a CachedTracer
+     */
+    virtual CachedSpan *cached(void) { return nullptr; }
+
     /**
      * \brief Associated Tracer
      */
@@ -582,22 +1077,55 @@ class Span
 
     /**
      * \brief Raw thrift message
+     *
+     * The span is recorded in a native header and the Arena of span, the thrift message is built on demand.
      */
-    inline const ::Span &message(void) const { return m_span; }
+    const ::Span &message(void) const;
 
-    inline ::Span &message(void) { return m_span; }
+    /**
+     * \brief Arena which holds the annotations of span
+     */
+    inline Arena &arena(void) { return m_arena; }
+
+    inline const Arena &arena(void) const { return m_arena; }
+
+    /**
+     * \brief Number of recorded annotations
+     */
+    inline size_t annotations_size(void) const { return m_annotations.size; }
+
+    /**
+     * \brief Number of recorded binary annotations
+     */
+    inline size_t binary_annotations_size(void) const { return m_binary_annotations.size; }
+
+    /**
+    * \brief Bytes of the recorded text, the name, the annotation values, the binary annotation keys and values,
+    * and the service names of their endpoints
+    *
+    * Used by the codecs to estimate the encoded size of span, see MessageCodec#estimate
+    *
+    * \param endpoints set to the number of the annotations and binary annotations with an endpoint
+    */
+    size_t text_size(size_t *endpoints = nullptr) const;
+
+    /**
+    * \brief The span has an annotation with the value, or a binary annotation with the key,
+    * for example TraceKeys#ERROR
+    */
+    bool annotated(string_view key) const;
 
     /**
      * \brief Unique 8-byte identifier for a trace, set on all spans within it.
      *
      * \sa Span#trace_id_high
      */
-    inline trace_id_t trace_id(void) const { return m_span.trace_id; }
+    inline trace_id_t trace_id(void) const { return m_header.trace_id; }
 
     /** \sa Span#trace_id */
     inline Span &with_trace_id(trace_id_t trace_id)
     {
-        m_span.__set_trace_id(trace_id);
+        m_header.trace_id = trace_id;
         return *this;
     }
 
@@ -606,12 +1134,13 @@ class Span
     *
     * \sa Span#trace_id
     */
-    inline trace_id_t trace_id_high(void) const { return m_span.trace_id_high; }
+    inline trace_id_t trace_id_high(void) const { return m_header.trace_id_high; }
 
     /** \sa Span#trace_id_high */
     inline Span &with_trace_id_high(trace_id_t trace_id_high)
     {
-        m_span.__set_trace_id_high(trace_id_high);
+        m_header.trace_id_high = trace_id_high;
+        m_header.isset |= __impl::__span_header::ISSET_TRACE_ID_HIGH;
         return *this;
     }
 
@@ -619,12 +1148,12 @@ class Span
     {
         if (trace_id.size() > 16)
         {
-            m_span.__set_trace_id_high(strtoull(trace_id.substr(0, 16).c_str(), NULL, 16));
-            m_span.__set_trace_id(strtoull(trace_id.substr(16).c_str(), NULL, 16));
+            with_trace_id_high(strtoull(trace_id.substr(0, 16).c_str(), NULL, 16));
+            with_trace_id(strtoull(trace_id.substr(16).c_str(), NULL, 16));
         }
         else
         {
-            m_span.__set_trace_id(strtoull(trace_id.c_str(), NULL, 16));
+            with_trace_id(strtoull(trace_id.c_str(), NULL, 16));
         }
 
         return *this;
@@ -633,12 +1162,12 @@ class Span
     /**
     * \brief Unique 8-byte identifier of this span within a trace.
     */
-    inline span_id_t id(void) const { return m_span.id; }
+    inline span_id_t id(void) const { return m_header.id; }
 
     /** \sa Span#id */
     inline Span &with_id(span_id_t id)
     {
-        m_span.__set_id(id);
+        m_header.id = id;
         return *this;
     }
 
@@ -647,36 +1176,55 @@ class Span
     *
     * Conventionally, when the span name isn't known, name = "unknown".
     */
-    inline const std::string &name(void) const { return m_span.name; }
+    inline const std::string &name(void) const { return m_name; }
 
     /** \sa Span#name */
-    inline Span &with_name(const std::string &name)
+    inline Span &with_name(string_view name)
+    {
+        m_name.assign(name.data(), name.size());
+        return *this;
+    }
+    /** \sa Span#name */
+    inline Span &with_name(const char *name)
     {
-        m_span.__set_name(name);
+        m_name.assign(name);
+        return *this;
+    }
+    /** \sa Span#name */
+    inline Span &with_name(std::string &&name)
+    {
+        m_name = std::move(name);
         return *this;
     }
 
     /**
     * \brief The parent's #id or 0 if this the root span in a trace.
     */
-    inline span_id_t parent_id(void) const { return m_span.parent_id; }
+    inline span_id_t parent_id(void) const { return m_header.parent_id; }
 
     /** \sa Span#parent_id */
     inline Span &with_parent_id(span_id_t id)
     {
-        m_span.__set_parent_id(id);
+        m_header.parent_id = id;
+        m_header.isset |= __impl::__span_header::ISSET_PARENT_ID;
         return *this;
     }
 
     /**
     * \brief Epoch microseconds of the start of this span, possibly absent if this an incomplete span.
     */
-    inline timestamp_t timestamp(void) const { return timestamp_t(m_span.timestamp); }
+    inline timestamp_t timestamp(void) const { return timestamp_t(m_header.timestamp); }
 
-    /** \sa Span#timestamp */
+    /**
+    * \sa Span#timestamp
+    *
+    * The explicit timestamp replaces the monotonic anchor, the duration is measured from it with the wall clock.
+    */
     inline Span &with_timestamp(timestamp_t timestamp)
     {
-        m_span.__set_timestamp(timestamp.count());
+        m_header.timestamp = timestamp.count();
+        m_header.isset |= __impl::__span_header::ISSET_TIMESTAMP;
+        m_start_ticks = 0;
         return *this;
     }
 
@@ -685,24 +1233,28 @@ class Span
     *
     * Durations of less than one microsecond must be rounded up to 1 microsecond.
     */
-    inline duration_t duration(void) const { return duration_t(m_span.duration); }
+    inline duration_t duration(void) const { return duration_t(m_header.duration); }
 
     /** \sa Span#duration */
     inline Span &with_duration(duration_t duration)
     {
-        m_span.__set_duration(duration.count());
+        m_header.duration = duration.count();
+        m_header.isset |= __impl::__span_header::ISSET_DURATION;
         return *this;
     }
 
     /**
     * \brief Force a trace to be sampled
     */
-    inline bool debug(void) const { return m_span.debug; }
+    inline bool debug(void) const { return m_header.debug; }
 
     /** \sa #debug */
     inline Span &with_debug(bool debug = true)
     {
-        m_span.__set_debug(debug);
+        m_header.debug = debug;
+        m_header.isset |= __impl::__span_header::ISSET_DEBUG;
+        if (recording() && !m_header.timestamp)
+            start();
         return *this;
     }
 
@@ -727,24 +1279,128 @@ class Span
     inline Span &with_sampled(bool sampled = true)
     {
         m_sampled = sampled;
+        if (recording() && !m_header.timestamp)
+            start();
         return *this;
     }
 
-    virtual inline Span *span(const std::string &name, userdata_t userdata = nullptr) const
+    /**
+    * \brief Record the span locally, without changing the sampling decision propagated to the downstream services
+    *
+    * \sa CachedTracer#set_tail_sampler
+    */
+    inline Span &with_recorded(bool recorded = true)
     {
-        Span *span = new Span(m_tracer, name, id(), userdata);
-        span->with_trace_id(trace_id());
-        span->with_trace_id_high(trace_id_high());
-        span->with_debug(debug());
-        span->with_sampled(sampled());
-        return span;
-    };
+        m_recorded = recorded;
+        if (recording() && !m_header.timestamp)
+            start();
+        return *this;
+    }
+
+    /** \sa Span#with_recorded */
+    inline bool recorded(void) const { return m_recorded; }
+
+    /**
+    * \brief Keep the encoded size estimated once by the collector at submit, the span doesn't change afterwards
+    *
+    * \sa MessageCodec#estimate
+    */
+    inline Span &with_estimated_bytes(size_t bytes)
+    {
+        m_estimated_bytes = bytes;
+        return *this;
+    }
+
+    /** \sa Span#with_estimated_bytes */
+    inline size_t estimated_bytes(void) const { return m_estimated_bytes; }
+
+    /**
+    * \brief Read the clock at the start of a span which isn't recording, so its duration is measured on submit
+    */
+    inline Span &start_timer(void)
+    {
+        if (!m_start_ticks)
+            m_start_ticks = m_clock->ticks();
+        return *this;
+    }
+
+    /**
+    * \brief The span was annotated with TraceKeys#ERROR, even when it isn't recording
+    */
+    inline bool failed(void) const { return m_error; }
+
+    /**
+    * \brief The services of the RPC annotations, even when the span isn't recording
+    */
+    inline const SpanServices &services(void) const { return m_services; }
+
+    /**
+    * \brief Keep the services of the RPC annotations for the linker, which assigns their ids
+    *
+    * \sa CachedTracer#set_dependency_linker
+    */
+    inline Span &with_dependency_linker(DependencyLinker *linker)
+    {
+        m_linker = linker;
+        return *this;
+    }
+
+    /**
+    * \brief The span records its annotations, when it is sampled, debug or recorded locally
+    *
+    * Otherwise the span is a no-op handle which only carries the trace context for the propagation,
+    * its annotations are dropped without reading the clock or copying the values.
+    */
+    inline bool recording(void) const { return m_sampled || m_recorded || m_header.debug; }
+
+    /**
+    * \brief Create a child span, from the cache of the Tracer when there is one
+    */
+    virtual Span *span(string_view name, userdata_t userdata = nullptr) const;
+
+    /**
+    * \brief Fold the repeated child spans with the name into a single summary child span, submitted with this span
+    *
+    * Use it instead of #span for the children created in loops, like the cache lookups of a request.
+    *
+    * \code
+    * SpanAggregate lookups = span->aggregate("cache.get");
+    *
+    * for (auto &key : keys)
+    * {
+    *     SpanAggregate::Timer timer = lookups.time();
+    *
+    *     cache.get(key);
+    * }
+    * \endcode
+    */
+    SpanAggregate aggregate(string_view name);
 
     /**
     * \brief Generatea a random unique id for Span or Tracer;
+    *
+    * \sa IdGenerator#random
     */
     static span_id_t next_id();
 
+    /**
+    * \brief The IdGenerator of the associated Tracer, or the default one
+    */
+    IdGenerator *id_generator(void) const;
+
+    /**
+    * \brief The Clock of the associated Tracer, or the precise one
+    */
+    inline Clock *clock(void) const { return m_clock; }
+
+    /**
+    * \brief The current time of span, derived from its start timestamp and the monotonic clock
+    */
+    inline timestamp_t elapsed_now(void) const
+    {
+        return timestamp_t(m_start_ticks ? m_header.timestamp + m_clock->elapsed(m_start_ticks) : m_clock->wall());
+    }
+
     /**
     * \brief Get the current time
     */
@@ -753,7 +1409,7 @@ class Span
     /**
     * \brief Associates events that explain latency with a timestamp.
     */
-    Annotation annotate(const std::string &value, const Endpoint *endpoint = nullptr);
+    Annotation annotate(string_view value, const Endpoint *endpoint = nullptr);
 
     /// \brief Annotate TraceKeys#CLIENT_SEND event
     inline Annotation client_send(const Endpoint *endpoint = nullptr)
@@ -810,90 +1466,94 @@ class Span
     * \brief Tags a span with context, usually to support query or aggregation.
     */
     template <typename T>
-    BinaryAnnotation annotate(const std::string &key, const T &value, const Endpoint *endpoint = nullptr);
+    BinaryAnnotation annotate(string_view key, const T &value, const Endpoint *endpoint = nullptr);
 
-    BinaryAnnotation annotate(const std::string &key, const uint8_t *value, size_t size, const Endpoint *endpoint = nullptr);
+    BinaryAnnotation annotate(string_view key, const uint8_t *value, size_t size, const Endpoint *endpoint = nullptr);
 
     template <size_t N>
-    inline BinaryAnnotation annotate(const std::string &key, const uint8_t (&value)[N], const Endpoint *endpoint = nullptr)
+    inline BinaryAnnotation annotate(string_view key, const uint8_t (&value)[N], const Endpoint *endpoint = nullptr)
     {
         return annotate(key, value, N, endpoint);
     }
-    inline BinaryAnnotation annotate(const std::string &key, const std::vector<uint8_t> &value, const Endpoint *endpoint = nullptr)
+    inline BinaryAnnotation annotate(string_view key, const std::vector<uint8_t> &value, const Endpoint *endpoint = nullptr)
     {
         return annotate(key, value.data(), value.size(), endpoint);
     }
 
-    BinaryAnnotation annotate(const std::string &key, const std::string &value, const Endpoint *endpoint = nullptr);
+    BinaryAnnotation annotate(string_view key, string_view value, const Endpoint *endpoint = nullptr);
 
+    inline BinaryAnnotation annotate(string_view key, const std::string &value, const Endpoint *endpoint = nullptr)
+    {
+        return annotate(key, string_view(value), endpoint);
+    }
     template <size_t N>
-    inline BinaryAnnotation annotate(const std::string &key, char const (&value)[N], const Endpoint *endpoint = nullptr)
+    inline BinaryAnnotation annotate(string_view key, char const (&value)[N], const Endpoint *endpoint = nullptr)
     {
-        return annotate(key, std::string(value, N), endpoint);
+        return annotate(key, string_view(value, strnlen(value, N)), endpoint);
     }
-    inline BinaryAnnotation annotate(const std::string &key, const char *value, int len = -1, const Endpoint *endpoint = nullptr)
+    inline BinaryAnnotation annotate(string_view key, const char *value, int len = -1, const Endpoint *endpoint = nullptr)
     {
-        return annotate(key, len >= 0 ? std::string(value, len) : std::string(value), endpoint);
+        return annotate(key, string_view(value, len >= 0 ? len : strlen(value)), endpoint);
     }
 
-    BinaryAnnotation annotate(const std::string &key, const std::wstring &value, const Endpoint *endpoint = nullptr);
+    BinaryAnnotation annotate(string_view key, const std::wstring &value, const Endpoint *endpoint = nullptr);
     template <size_t N>
-    inline BinaryAnnotation annotate(const std::string &key, wchar_t const (&value)[N], const Endpoint *endpoint = nullptr)
+    inline BinaryAnnotation annotate(string_view key, wchar_t const (&value)[N], const Endpoint *endpoint = nullptr)
     {
-        return annotate(key, std::wstring(value, N), endpoint);
+        return annotate(key, std::wstring(value, wcsnlen(value, N)), endpoint);
     }
-    inline BinaryAnnotation annotate(const std::string &key, const wchar_t *value, int len = -1, const Endpoint *endpoint = nullptr)
+    inline BinaryAnnotation annotate(string_view key, const wchar_t *value, int len = -1, const Endpoint *endpoint = nullptr)
     {
         return annotate(key, len >= 0 ? std::wstring(value, len) : std::wstring(value), endpoint);
     }
 
     /// \brief Annotate TraceKeys#HTTP_HOST event
-    inline BinaryAnnotation http_host(const std::string &value, const Endpoint *endpoint = nullptr)
+    inline BinaryAnnotation http_host(string_view value, const Endpoint *endpoint = nullptr)
     {
         return annotate(TraceKeys::HTTP_HOST, value, endpoint);
     }
     /// \brief Annotate TraceKeys#HTTP_METHOD event
-    inline BinaryAnnotation http_method(const std::string &value, const Endpoint *endpoint = nullptr)
+    inline BinaryAnnotation http_method(string_view value, const Endpoint *endpoint = nullptr)
     {
         return annotate(TraceKeys::HTTP_METHOD, value, endpoint);
     }
     /// \brief Annotate TraceKeys#HTTP_PATH event
-    inline BinaryAnnotation http_path(const std::string &value, const Endpoint *endpoint = nullptr)
+    inline BinaryAnnotation http_path(string_view value, const Endpoint *endpoint = nullptr)
     {
         return annotate(TraceKeys::HTTP_PATH, value, endpoint);
     }
     /// \brief Annotate TraceKeys#HTTP_URL event
-    inline BinaryAnnotation http_url(const std::string &value, const Endpoint *endpoint = nullptr)
+    inline BinaryAnnotation http_url(string_view value, const Endpoint *endpoint = nullptr)
     {
         return annotate(TraceKeys::HTTP_URL, value, endpoint);
     }
     /// \brief Annotate TraceKeys#HTTP_STATUS_CODE event
-    inline BinaryAnnotation http_status_code(const std::string &value, const Endpoint *endpoint = nullptr)
+    inline BinaryAnnotation http_status_code(string_view value, const Endpoint *endpoint = nullptr)
     {
         return annotate(TraceKeys::HTTP_STATUS_CODE, value, endpoint);
     }
     /// \brief Annotate TraceKeys#HTTP_REQUEST_SIZE event
-    inline BinaryAnnotation http_request_size(const std::string &value, const Endpoint *endpoint = nullptr)
+    inline BinaryAnnotation http_request_size(string_view value, const Endpoint *endpoint = nullptr)
     {
         return annotate(TraceKeys::HTTP_REQUEST_SIZE, value, endpoint);
     }
     /// \brief Annotate TraceKeys#HTTP_REQUEST_SIZE event
-    inline BinaryAnnotation http_response_size(const std::string &value, const Endpoint *endpoint = nullptr)
+    inline BinaryAnnotation http_response_size(string_view value, const Endpoint *endpoint = nullptr)
     {
         return annotate(TraceKeys::HTTP_RESPONSE_SIZE, value, endpoint);
     }
     /// \brief Annotate TraceKeys#LOCAL_COMPONENT event
-    inline BinaryAnnotation local_component(const std::string &value, const Endpoint *endpoint = nullptr)
+    inline BinaryAnnotation local_component(string_view value, const Endpoint *endpoint = nullptr)
     {
         return annotate(TraceKeys::LOCAL_COMPONENT, value, endpoint);
     }
     /// \brief Annotate TraceKeys#CLIENT_ADDR event
-    inline BinaryAnnotation client_addr(const std::string &value, const Endpoint *endpoint = nullptr)
+    inline BinaryAnnotation client_addr(string_view value, const Endpoint *endpoint = nullptr)
     {
         return annotate(TraceKeys::CLIENT_ADDR, value, endpoint);
     }
     /// \brief Annotate TraceKeys#SERVER_ADDR event
-    inline BinaryAnnotation server_addr(const std::string &value, const Endpoint *endpoint = nullptr)
+    inline BinaryAnnotation server_addr(string_view value, const Endpoint *endpoint = nullptr)
     {
         return annotate(TraceKeys::SERVER_ADDR, value, endpoint);
     }
@@ -903,15 +1563,12 @@ class Span
         return annotate(TraceKeys::ERROR, endpoint);
     }
     /// \brief Annotate TraceKeys#ERROR event
-    inline BinaryAnnotation error(const std::string &value, const Endpoint *endpoint = nullptr)
+    inline BinaryAnnotation error(string_view value, const Endpoint *endpoint = nullptr)
     {
         return annotate(TraceKeys::ERROR, value, endpoint);
     }
 
-    inline size_t serialize_binary(apache::thrift::protocol::TProtocol &protocol) const
-    {
-        return m_span.write(&protocol);
-    }
+    size_t serialize_binary(apache::thrift::protocol::TProtocol &protocol) const;
 
     template <class RapidJsonWriter>
     void serialize_json(RapidJsonWriter &writer) const;
@@ -974,19 +1631,34 @@ struct __annotation<K, const wchar_t *>
 
 } // namespace __impl
 
-static inline Annotation operator<<(Span &span, const std::string &value)
+static inline Annotation operator<<(Span &span, string_view value)
 {
     return span.annotate(value);
 }
 
+static inline Annotation operator<<(Span &span, const std::string &value)
+{
+    return span.annotate(string_view(value));
+}
+
+static inline Annotation operator<<(Annotation annotation, string_view value)
+{
+    return annotation.span().annotate(value);
+}
+
 static inline Annotation operator<<(Annotation annotation, const std::string &value)
+{
+    return annotation.span().annotate(string_view(value));
+}
+
+static inline Annotation operator<<(BinaryAnnotation annotation, string_view value)
 {
     return annotation.span().annotate(value);
 }
 
 static inline Annotation operator<<(BinaryAnnotation annotation, const std::string &value)
 {
-    return annotation.span().annotate(value);
+    return annotation.span().annotate(string_view(value));
 }
 
 static inline Span &operator<<(Annotation annotation, const zipkin::Endpoint &endpoint)
@@ -1019,25 +1691,85 @@ BinaryAnnotation operator<<(BinaryAnnotation annotation, const std::pair<K, V> &
 
 class CachedSpan : public Span
 {
+    SpanCache *m_cache;                   // size class of the span, nullptr when it isn't cached
+    CachedSpan *m_next_cached = nullptr; // next span of the SpanCache batch
+    size_t m_cached_batch = 0;            // spans in the batch, kept by the head
+    bool m_tail_pending = false;          // started in the tail sampler, neither finished nor discarded
+
+    friend class SpanCache;
+    friend class CachedTracer;
+
     uint8_t m_buf[0] __attribute__((aligned));
 
+    static SpanCache *default_cache(Tracer *tracer);
+
+    static Slab *cache_slab(SpanCache *cache);
+
+    /**
+    * \brief Return the memory of a span to its slab or the heap, found by the address since the span is destroyed
+    */
+    static void deallocate(void *ptr) noexcept;
+
   public:
-    CachedSpan(Tracer *tracer, const std::string &name, span_id_t parent_id = 0, userdata_t userdata = nullptr)
-        : Span(tracer, name, parent_id, userdata)
+    CachedSpan(SpanCache *cache, Tracer *tracer, string_view name, span_id_t parent_id = 0, userdata_t userdata = nullptr, bool sampled = true)
+        : Span(tracer, name, parent_id, userdata, sampled), m_cache(cache)
+    {
+        m_arena.assign(m_buf, buffer_size());
+    }
+    CachedSpan(SpanCache *cache, Tracer *tracer, string_view name, const SpanContext &parent, userdata_t userdata = nullptr)
+        : Span(tracer, name, parent, userdata), m_cache(cache)
+    {
+        m_arena.assign(m_buf, buffer_size());
+    }
+    CachedSpan(Tracer *tracer, string_view name, span_id_t parent_id = 0, userdata_t userdata = nullptr)
+        : CachedSpan(default_cache(tracer), tracer, name, parent_id, userdata)
+    {
+    }
+    CachedSpan(Tracer *tracer, string_view name, const SpanContext &parent, userdata_t userdata = nullptr)
+        : CachedSpan(default_cache(tracer), tracer, name, parent, userdata)
     {
     }
 
+    /**
+    * \brief Allocate a span with the message size of the size class, from the slab of the cache if any
+    */
+    static void *operator new(size_t size, SpanCache *cache) noexcept;
+    /**
+    * \brief Allocate a span with the message size of the default size class of the tracer
+    */
     static void *operator new(size_t size, CachedTracer *tracer) noexcept;
     static void operator delete(void *ptr, std::size_t sz) noexcept;
+    /**
+    * \brief Release the memory when a constructor throws
+    */
+    static void operator delete(void *ptr, SpanCache *cache) noexcept;
+    static void operator delete(void *ptr, CachedTracer *tracer) noexcept;
+
+    /**
+    * \brief The SpanCache of the size class
+    */
+    inline SpanCache *cache(void) const { return m_cache; }
 
     static size_t cache_offset(void) { return offsetof(CachedSpan, m_buf); }
 
+    /**
+    * \brief Size of the trailing buffer, shared by the Arena and the encoded message
+    */
+    size_t buffer_size(void) const;
+
+    /**
+    * \brief The free space of the trailing buffer, which could be used to encode message
+    *
+    * The Arena of span consumes the trailing buffer from its end.
+    */
     uint8_t *cache_ptr(void) { return &m_buf[0]; }
-    size_t cache_size(void) const;
+    size_t cache_size(void) const { return m_arena.available(); }
 
     virtual void release(void) override;
 
-    virtual Span *span(const std::string &name, userdata_t userdata = nullptr) const override;
+    virtual CachedSpan *cached(void) override { return this; }
+
+    virtual Span *span(string_view name, userdata_t userdata = nullptr) const override;
 
 } __attribute__((aligned));
 
@@ -1120,120 +1852,105 @@ template <>
 struct __binary_annotation<bool>
 {
     static const AnnotationType type = AnnotationType::BOOL;
-    static const std::string encode(const bool &value)
-    {
-        return value ? "\x01" : "\x00";
-    }
+    static void store(__number &number, const bool &value) { number.b = value; }
 };
 template <>
 struct __binary_annotation<int16_t>
 {
     static const AnnotationType type = AnnotationType::I16;
-    static const std::string encode(const int16_t &value)
-    {
-        uint16_t v = native_to_big(static_cast<uint16_t>(value));
-        return std::string(reinterpret_cast<const char *>(&v), sizeof(uint16_t));
-    }
+    static void store(__number &number, const int16_t &value) { number.i16 = value; }
 };
 template <>
 struct __binary_annotation<uint16_t>
 {
     static const AnnotationType type = AnnotationType::I16;
-    static const std::string encode(const uint16_t &value)
-    {
-        uint16_t v = native_to_big(value);
-        return std::string(reinterpret_cast<const char *>(&v), sizeof(uint16_t));
-    }
+    static void store(__number &number, const uint16_t &value) { number.i16 = static_cast<int16_t>(value); }
 };
 template <>
 struct __binary_annotation<int32_t>
 {
     static const AnnotationType type = AnnotationType::I32;
-    static const std::string encode(const int32_t &value)
-    {
-        uint32_t v = native_to_big(static_cast<uint32_t>(value));
-        return std::string(reinterpret_cast<const char *>(&v), sizeof(uint32_t));
-    }
+    static void store(__number &number, const int32_t &value) { number.i32 = value; }
 };
 template <>
 struct __binary_annotation<uint32_t>
 {
     static const AnnotationType type = AnnotationType::I32;
-    static const std::string encode(const uint32_t &value)
-    {
-        uint32_t v = native_to_big(value);
-        return std::string(reinterpret_cast<const char *>(&v), sizeof(uint32_t));
-    }
+    static void store(__number &number, const uint32_t &value) { number.i32 = static_cast<int32_t>(value); }
 };
 template <>
 struct __binary_annotation<int64_t>
 {
     static const AnnotationType type = AnnotationType::I64;
-    static const std::string encode(const int64_t &value)
-    {
-        uint64_t v = native_to_big(static_cast<uint64_t>(value));
-        return std::string(reinterpret_cast<const char *>(&v), sizeof(uint64_t));
-    }
+    static void store(__number &number, const int64_t &value) { number.i64 = value; }
 };
 template <>
 struct __binary_annotation<uint64_t>
 {
     static const AnnotationType type = AnnotationType::I64;
-    static const std::string encode(const uint64_t &value)
-    {
-        uint64_t v = native_to_big(value);
-        return std::string(reinterpret_cast<const char *>(&v), sizeof(uint64_t));
-    }
+    static void store(__number &number, const uint64_t &value) { number.i64 = static_cast<int64_t>(value); }
 };
 template <>
 struct __binary_annotation<double>
 {
     static const AnnotationType type = AnnotationType::DOUBLE;
-    static const std::string encode(const double &value)
-    {
-        return std::string(reinterpret_cast<const char *>(&value), sizeof(double));
-    }
+    static void store(__number &number, const double &value) { number.d = value; }
 };
 } // namespace __impl
 
 template <typename T>
 inline BinaryAnnotation &BinaryAnnotation::with_value(const T &value)
 {
-    m_annotation.__set_value(__impl::__binary_annotation<T>::encode(value));
+    if (!m_annotation)
+        return *this;
+
+    __impl::__binary_annotation<T>::store(m_annotation->number, value);
+
+    m_annotation->value = __impl::__string();
+    m_annotation->type = __impl::__binary_annotation<T>::type;
 
     return *this;
 }
 
 template <typename T>
-inline BinaryAnnotation Span::annotate(const std::string &key, const T &value, const Endpoint *endpoint)
+inline BinaryAnnotation Span::annotate(string_view key, const T &value, const Endpoint *endpoint)
 {
-    ::BinaryAnnotation annotation;
+    if (key == TraceKeys::ERROR)
+        m_error = true;
 
-    annotation.__set_key(key);
-    annotation.__set_value(__impl::__binary_annotation<T>::encode(value));
-    annotation.__set_annotation_type(__impl::__binary_annotation<T>::type);
+    record_service(key, endpoint);
 
-    if (endpoint)
-    {
-        annotation.__set_host(endpoint->host());
-    }
+    if (!recording())
+        return BinaryAnnotation(*this);
+
+    __impl::__binary_annotation_record *annotation = new_binary_annotation(key, __impl::__binary_annotation<T>::type, endpoint);
 
-    m_span.binary_annotations.push_back(annotation);
+    __impl::__binary_annotation<T>::store(annotation->number, value);
 
-    return BinaryAnnotation(*this, m_span.binary_annotations.back());
+    return BinaryAnnotation(*this, *annotation);
 }
 
 template <class RapidJsonWriter>
 void Span::serialize_json(RapidJsonWriter &writer) const
 {
-    auto serialize_endpoint = [&writer](const ::Endpoint &host) {
+    auto serialize_endpoint = [&writer](const __impl::__endpoint &host) {
         writer.StartObject();
 
         writer.Key("serviceName");
-        writer.String(host.service_name);
+        writer.String(host.service_name.data, host.service_name.size);
 
         writer.Key("ipv4");
-        writer.String(inet_ntoa({static_cast<in_addr_t>(htonl(host.ipv4))}));
+        if (host.cache)
+        {
+            writer.String(host.cache->ipv4);
+        }
+        else
+        {
+            char ipv4[INET_ADDRSTRLEN];
+            in_addr addr = {static_cast<in_addr_t>(htonl(host.ipv4))};
+
+            writer.String(inet_ntop(AF_INET, &addr, ipv4, sizeof(ipv4)));
+        }
 
         writer.Key("port");
         writer.Int(host.port);
@@ -1241,35 +1958,35 @@ void Span::serialize_json(RapidJsonWriter &writer) const
         writer.EndObject();
     };
 
-    auto serialize_value = [&writer](const std::string &data, AnnotationType type) {
-        switch (type)
+    auto serialize_value = [&writer](const __impl::__binary_annotation_record &annotation) {
+        switch (annotation.type)
         {
         case AnnotationType::BOOL:
-            writer.Bool(*reinterpret_cast<const bool *>(data.c_str()));
+            writer.Bool(annotation.number.b);
             break;
 
         case AnnotationType::I16:
-            writer.Int(__impl::big_to_native(*reinterpret_cast<const uint16_t *>(data.c_str())));
+            writer.Int(annotation.number.i16);
             break;
 
         case AnnotationType::I32:
-            writer.Int(__impl::big_to_native(*reinterpret_cast<const uint32_t *>(data.c_str())));
+            writer.Int(annotation.number.i32);
             break;
 
         case AnnotationType::I64:
-            writer.Int64(__impl::big_to_native(*reinterpret_cast<const uint64_t *>(data.c_str())));
+            writer.Int64(annotation.number.i64);
             break;
 
         case AnnotationType::DOUBLE:
-            writer.Double(*reinterpret_cast<const double *>(data.c_str()));
+            writer.Double(annotation.number.d);
             break;
 
         case AnnotationType::BYTES:
-            writer.String(base64::encode(data));
+            writer.String(base64::encode(reinterpret_cast<const uint8_t *>(annotation.value.data), annotation.value.size));
             break;
 
         case AnnotationType::STRING:
-            writer.String(data);
+            writer.String(annotation.value.data, annotation.value.size);
             break;
         }
     };
@@ -1279,97 +1996,97 @@ void Span::serialize_json(RapidJsonWriter &writer) const
     writer.StartObject();
 
     writer.Key("traceId");
-    if (m_span.trace_id_high)
+    if (m_header.trace_id_high)
     {
-        writer.String(str, snprintf(str, sizeof(str), SPAN_ID_FMT SPAN_ID_FMT, m_span.trace_id_high, m_span.trace_id));
+        writer.String(str, snprintf(str, sizeof(str), SPAN_ID_FMT SPAN_ID_FMT, m_header.trace_id_high, m_header.trace_id));
     }
     else
     {
-        writer.String(str, snprintf(str, sizeof(str), SPAN_ID_FMT, m_span.trace_id));
+        writer.String(str, snprintf(str, sizeof(str), SPAN_ID_FMT, m_header.trace_id));
     }
 
     writer.Key("name");
-    writer.String(m_span.name);
+    writer.String(m_name);
 
     writer.Key("id");
-    writer.String(str, snprintf(str, sizeof(str), SPAN_ID_FMT, m_span.id));
+    writer.String(str, snprintf(str, sizeof(str), SPAN_ID_FMT, m_header.id));
 
-    if (m_span.__isset.parent_id)
+    if (m_header.has(__impl::__span_header::ISSET_PARENT_ID))
     {
         writer.Key("parentId");
-        writer.String(str, snprintf(str, sizeof(str), SPAN_ID_FMT, m_span.parent_id));
+        writer.String(str, snprintf(str, sizeof(str), SPAN_ID_FMT, m_header.parent_id));
     }
 
     writer.Key("annotations");
     writer.StartArray();
 
-    for (auto &annotation : m_span.annotations)
+    for (auto annotation = m_annotations.head; annotation; annotation = annotation->next)
     {
         writer.StartObject();
 
-        if (annotation.__isset.host)
+        if (annotation->host)
         {
             writer.Key("endpoint");
-            serialize_endpoint(annotation.host);
+            serialize_endpoint(*annotation->host);
         }
 
         writer.Key("timestamp");
-        writer.Int64(annotation.timestamp);
+        writer.Int64(annotation->timestamp);
 
         writer.Key("value");
-        writer.String(annotation.value);
+        writer.String(annotation->value.data, annotation->value.size);
 
         writer.EndObject();
     }
 
-    writer.EndArray(m_span.annotations.size());
+    writer.EndArray(m_annotations.size);
 
     writer.Key("binaryAnnotations");
     writer.StartArray();
 
-    for (auto &annotation : m_span.binary_annotations)
+    for (auto annotation = m_binary_annotations.head; annotation; annotation = annotation->next)
     {
         writer.StartObject();
 
-        if (annotation.__isset.host)
+        if (annotation->host)
         {
             writer.Key("endpoint");
-            serialize_endpoint(annotation.host);
+            serialize_endpoint(*annotation->host);
         }
 
         writer.Key("key");
-        writer.String(annotation.key);
+        writer.String(annotation->key.data, annotation->key.size);
 
         writer.Key("value");
-        serialize_value(annotation.value, annotation.annotation_type);
+        serialize_value(*annotation);
 
-        if (annotation.annotation_type != AnnotationType::BOOL && annotation.annotation_type != AnnotationType::STRING)
+        if (annotation->type != AnnotationType::BOOL && annotation->type != AnnotationType::STRING)
         {
             writer.Key("type");
-            writer.String(to_string(annotation.annotation_type));
+            writer.String(to_string(annotation->type));
         }
 
         writer.EndObject();
     }
 
-    writer.EndArray(m_span.binary_annotations.size());
+    writer.EndArray(m_binary_annotations.size);
 
-    if (m_span.__isset.debug)
+    if (m_header.has(__impl::__span_header::ISSET_DEBUG))
     {
         writer.Key("debug");
-        writer.Bool(m_span.debug);
+        writer.Bool(m_header.debug);
     }
 
-    if (m_span.__isset.timestamp)
+    if (m_header.has(__impl::__span_header::ISSET_TIMESTAMP))
     {
         writer.Key("timestamp");
-        writer.Int64(m_span.timestamp);
+        writer.Int64(m_header.timestamp);
     }
 
-    if (m_span.__isset.duration)
+    if (m_header.has(__impl::__span_header::ISSET_DURATION))
     {
         writer.Key("duration");
-        writer.Int64(m_span.duration);
+        writer.Int64(m_header.duration);
     }
 
     writer.EndObject();
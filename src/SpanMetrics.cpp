@@ -0,0 +1,361 @@
+#include "SpanMetrics.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include <glog/logging.h>
+
+namespace zipkin
+{
+
+constexpr size_t SpanMetrics::MAX_NAMES;
+constexpr size_t SpanMetrics::SUB_BUCKET_BITS;
+constexpr size_t SpanMetrics::SUB_BUCKETS;
+constexpr size_t SpanMetrics::MAX_DURATION_BITS;
+constexpr size_t SpanMetrics::BUCKETS;
+constexpr size_t SpanMetrics::NAME_BUCKETS;
+
+duration_t SpanMetric::percentile(double pct) const
+{
+    size_t rank = static_cast<size_t>(std::ceil(count * pct));
+    uint64_t seen = 0;
+
+    for (size_t i = 0; count && i < buckets.size(); i++)
+    {
+        seen += buckets[i];
+
+        if (seen >= rank)
+            return std::min(std::max(duration_t(SpanMetrics::bucket_limit(i)), min), max);
+    }
+
+    return max;
+}
+
+std::ostream &operator<<(std::ostream &os, const SpanMetric &metric)
+{
+    return os << metric.service << "/" << metric.name << ": count=" << metric.count
+              << ", errors=" << metric.errors
+              << ", p50=" << metric.percentile(0.5).count() << "us"
+              << ", p99=" << metric.percentile(0.99).count() << "us"
+              << ", max=" << metric.max.count() << "us";
+}
+
+SpanMetrics::Counters::Counters() : count(0), errors(0), sum(0), min(std::numeric_limits<uint64_t>::max()), max(0)
+{
+    for (size_t i = 0; i < BUCKETS; i++)
+    {
+        buckets[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+SpanMetrics::Local::Local() : released(false)
+{
+    for (size_t i = 0; i < MAX_NAMES; i++)
+    {
+        counters[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+SpanMetrics::Local::~Local()
+{
+    for (size_t i = 0; i < MAX_NAMES; i++)
+    {
+        delete counters[i].load(std::memory_order_relaxed);
+    }
+}
+
+SpanMetrics::SpanMetrics(const MetricsConf &conf) : m_conf(conf), m_size(0)
+{
+    static std::atomic<uint64_t> next_id(0);
+
+    // the per-thread counters are keyed by the id, an address could be reused by a later instance
+    m_id = ++next_id;
+
+    for (size_t i = 0; i < NAME_BUCKETS; i++)
+    {
+        m_names[i].store(nullptr, std::memory_order_relaxed);
+    }
+
+    for (size_t i = 0; i < MAX_NAMES; i++)
+    {
+        m_indexes[i] = nullptr;
+    }
+
+    if (m_conf.reporter)
+        m_reporter = std::thread(&SpanMetrics::report, this);
+}
+
+SpanMetrics::~SpanMetrics()
+{
+    if (m_reporter.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_reporting);
+
+            m_stopped = true;
+        }
+
+        m_stop.notify_one();
+        m_reporter.join();
+    }
+
+    for (size_t i = 0; i < NAME_BUCKETS; i++)
+    {
+        delete m_names[i].load(std::memory_order_relaxed);
+    }
+}
+
+SpanMetrics::Name *SpanMetrics::find(string_view name, size_t h) const
+{
+    size_t bucket = h % NAME_BUCKETS;
+    Name *entry;
+
+    while ((entry = m_names[bucket].load(std::memory_order_acquire)))
+    {
+        if (entry->hash == h && entry->name.size() == name.size() && 0 == memcmp(entry->name.data(), name.data(), name.size()))
+            return entry;
+
+        bucket = (bucket + 1) % NAME_BUCKETS;
+    }
+
+    return nullptr;
+}
+
+SpanMetrics::Name *SpanMetrics::add(string_view name, size_t h)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (Name *entry = find(name, h))
+        return entry;
+
+    size_t size = m_size.load(std::memory_order_relaxed);
+
+    if (size >= MAX_NAMES)
+        return nullptr;
+
+    Name *entry = new Name();
+
+    entry->name.assign(name.data(), name.size());
+    entry->hash = h;
+    entry->index = size;
+
+    size_t bucket = h % NAME_BUCKETS;
+
+    while (m_names[bucket].load(std::memory_order_relaxed))
+    {
+        bucket = (bucket + 1) % NAME_BUCKETS;
+    }
+
+    m_indexes[size] = entry;
+    m_names[bucket].store(entry, std::memory_order_release);
+    m_size.store(size + 1, std::memory_order_release);
+
+    VLOG(2) << "tracking the metrics of `" << entry->name << "` spans";
+
+    return entry;
+}
+
+SpanMetrics::Local &SpanMetrics::local(void)
+{
+    struct Locals
+    {
+        std::vector<std::pair<uint64_t, std::shared_ptr<Local>>> locals;
+
+        ~Locals()
+        {
+            // hand over the counters to the next new thread
+            for (auto &local : locals)
+            {
+                local.second->released.store(true, std::memory_order_release);
+            }
+        }
+    };
+
+    static thread_local Locals t_locals;
+
+    for (auto &local : t_locals.locals)
+    {
+        if (local.first == m_id)
+            return *local.second;
+    }
+
+    // forget the counters of the destroyed metrics
+    t_locals.locals.erase(std::remove_if(t_locals.locals.begin(), t_locals.locals.end(),
+                                         [](const std::pair<uint64_t, std::shared_ptr<Local>> &local) { return local.second.unique(); }),
+                          t_locals.locals.end());
+
+    std::shared_ptr<Local> local;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        for (auto &candidate : m_locals)
+        {
+            bool released = true;
+
+            if (candidate->released.compare_exchange_strong(released, false, std::memory_order_acq_rel))
+            {
+                local = candidate;
+                break;
+            }
+        }
+
+        if (!local)
+        {
+            local = std::make_shared<Local>();
+
+            m_locals.push_back(local);
+        }
+    }
+
+    t_locals.locals.emplace_back(m_id, local);
+
+    return *local;
+}
+
+void SpanMetrics::record(string_view name, duration_t duration, bool error)
+{
+    size_t h = hash(name.data(), name.size());
+    Name *entry = find(name, h);
+
+    if (!entry && !(entry = add(name, h)))
+        return;
+
+    Local &local = this->local();
+    Counters *counters = local.counters[entry->index].load(std::memory_order_relaxed);
+
+    if (!counters)
+    {
+        counters = new Counters();
+
+        local.counters[entry->index].store(counters, std::memory_order_release);
+    }
+
+    uint64_t us = std::max<int64_t>(0, duration.count());
+
+    // only this thread writes its counters, the readers merge them with relaxed loads
+    counters->count.store(counters->count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    counters->sum.store(counters->sum.load(std::memory_order_relaxed) + us, std::memory_order_relaxed);
+
+    if (error)
+        counters->errors.store(counters->errors.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+    if (us < counters->min.load(std::memory_order_relaxed))
+        counters->min.store(us, std::memory_order_relaxed);
+
+    if (us > counters->max.load(std::memory_order_relaxed))
+        counters->max.store(us, std::memory_order_relaxed);
+
+    std::atomic<uint64_t> &slot = counters->buckets[bucket(us)];
+
+    slot.store(slot.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+std::vector<SpanMetric> SpanMetrics::snapshot(void) const
+{
+    std::vector<std::shared_ptr<Local>> locals;
+    std::vector<Name *> names;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        locals = m_locals;
+        names.assign(m_indexes, m_indexes + m_size.load(std::memory_order_relaxed));
+    }
+
+    std::vector<SpanMetric> metrics;
+
+    metrics.reserve(names.size());
+
+    for (Name *name : names)
+    {
+        SpanMetric metric;
+        uint64_t sum = 0, min = std::numeric_limits<uint64_t>::max(), max = 0;
+
+        metric.service = m_conf.service;
+        metric.name = name->name;
+        metric.count = metric.errors = 0;
+        metric.buckets.assign(BUCKETS, 0);
+
+        for (auto &local : locals)
+        {
+            const Counters *counters = local->counters[name->index].load(std::memory_order_acquire);
+
+            if (!counters)
+                continue;
+
+            metric.count += counters->count.load(std::memory_order_relaxed);
+            metric.errors += counters->errors.load(std::memory_order_relaxed);
+            sum += counters->sum.load(std::memory_order_relaxed);
+            min = std::min(min, counters->min.load(std::memory_order_relaxed));
+            max = std::max(max, counters->max.load(std::memory_order_relaxed));
+
+            for (size_t i = 0; i < BUCKETS; i++)
+            {
+                metric.buckets[i] += counters->buckets[i].load(std::memory_order_relaxed);
+            }
+        }
+
+        metric.sum = duration_t(sum);
+        metric.min = duration_t(metric.count ? min : 0);
+        metric.max = duration_t(max);
+
+        metrics.push_back(std::move(metric));
+    }
+
+    return metrics;
+}
+
+void SpanMetrics::expose(std::ostream &os) const
+{
+    static const double QUANTILES[] = {0.5, 0.9, 0.99, 0.999};
+
+    std::vector<SpanMetric> metrics = snapshot();
+
+    os << "# TYPE zipkin_spans_total counter\n";
+
+    for (auto &metric : metrics)
+    {
+        os << "zipkin_spans_total{service=\"" << metric.service << "\",name=\"" << metric.name << "\"} " << metric.count << "\n";
+    }
+
+    os << "# TYPE zipkin_span_errors_total counter\n";
+
+    for (auto &metric : metrics)
+    {
+        os << "zipkin_span_errors_total{service=\"" << metric.service << "\",name=\"" << metric.name << "\"} " << metric.errors << "\n";
+    }
+
+    os << "# TYPE zipkin_span_duration_seconds summary\n";
+
+    for (auto &metric : metrics)
+    {
+        for (double quantile : QUANTILES)
+        {
+            os << "zipkin_span_duration_seconds{service=\"" << metric.service << "\",name=\"" << metric.name
+               << "\",quantile=\"" << quantile << "\"} " << metric.percentile(quantile).count() / 1e6 << "\n";
+        }
+
+        os << "zipkin_span_duration_seconds_sum{service=\"" << metric.service << "\",name=\"" << metric.name << "\"} "
+           << metric.sum.count() / 1e6 << "\n";
+        os << "zipkin_span_duration_seconds_count{service=\"" << metric.service << "\",name=\"" << metric.name << "\"} "
+           << metric.count << "\n";
+    }
+}
+
+void SpanMetrics::report(void)
+{
+    std::unique_lock<std::mutex> lock(m_reporting);
+
+    while (!m_stop.wait_for(lock, m_conf.report_interval, [this] { return m_stopped; }))
+    {
+        lock.unlock();
+
+        m_conf.reporter(snapshot());
+
+        lock.lock();
+    }
+}
+
+} // namespace zipkin
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <ostream>
+
+#include "Span.h"
+
+namespace zipkin
+{
+
+/**
+* \brief The request rate, error rate and latency distribution of the spans with a name
+*
+* The values are cumulative since the metrics were created, the rates are derived from two snapshots.
+*/
+struct SpanMetric
+{
+    std::string service;
+    std::string name;
+    uint64_t count;          ///< finished spans
+    uint64_t errors;         ///< finished spans annotated with TraceKeys#ERROR
+    duration_t sum;          ///< total duration
+    duration_t min;          ///< shortest duration
+    duration_t max;          ///< longest duration
+    std::vector<uint64_t> buckets; ///< the duration histogram, see SpanMetrics#bucket
+
+    /**
+    * \brief The duration at the percentile, within the precision of its histogram bucket
+    */
+    duration_t percentile(double pct) const;
+};
+
+std::ostream &operator<<(std::ostream &os, const SpanMetric &metric);
+
+struct MetricsConf
+{
+    /**
+    * \brief The service name of the metrics, a tracer usually traces a single service
+    *
+    * default: empty
+    */
+    std::string service;
+
+    /**
+    * \brief Called with a snapshot of the metrics every #report_interval, from a background thread
+    *
+    * default: none
+    */
+    std::function<void(const std::vector<SpanMetric> &metrics)> reporter;
+
+    /**
+    * \brief The interval between the reports
+    *
+    * default: 10 seconds
+    */
+    std::chrono::milliseconds report_interval = std::chrono::seconds(10);
+};
+
+/**
+* \brief Streaming RED metrics of all the finished spans, sampled or not
+*
+* Each thread records into its own counters and log-linear duration histograms (HDR-style, #SUB_BUCKETS per power of two),
+* which are only written by their thread, so recording takes no lock and no atomic read-modify-write.
+* The histograms of all the threads are merged on #snapshot, periodically reported through #MetricsConf::reporter,
+* or exposed in the Prometheus text format with #expose.
+*
+* The counters of an exited thread are handed over to the next new thread. Names beyond #MAX_NAMES are not tracked.
+*
+* \sa CachedTracer#set_metrics
+*/
+class SpanMetrics
+{
+  public:
+    static constexpr size_t MAX_NAMES = 256;
+    static constexpr size_t SUB_BUCKET_BITS = 4;
+    static constexpr size_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static constexpr size_t MAX_DURATION_BITS = 40; ///< about 12 days in microseconds
+    static constexpr size_t BUCKETS = (MAX_DURATION_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    /**
+    * \brief The histogram bucket of a duration in microseconds
+    */
+    static inline size_t bucket(uint64_t us)
+    {
+        if (us < SUB_BUCKETS * 2)
+            return us;
+
+        size_t shift = 63 - __builtin_clzll(us) - SUB_BUCKET_BITS;
+
+        return std::min(shift * SUB_BUCKETS + (us >> shift), BUCKETS - 1);
+    }
+
+    /**
+    * \brief The highest duration in microseconds of a histogram bucket
+    */
+    static inline uint64_t bucket_limit(size_t bucket)
+    {
+        if (bucket < SUB_BUCKETS * 2)
+            return bucket;
+
+        size_t shift = bucket / SUB_BUCKETS - 1;
+
+        return ((bucket % SUB_BUCKETS + SUB_BUCKETS + 1) << shift) - 1;
+    }
+
+  private:
+    struct Counters
+    {
+        std::atomic<uint64_t> count, errors, sum, min, max;
+        std::atomic<uint64_t> buckets[BUCKETS];
+
+        Counters();
+    };
+
+    struct Local
+    {
+        std::atomic_bool released;
+        std::atomic<Counters *> counters[MAX_NAMES];
+
+        Local();
+
+        ~Local();
+    };
+
+    struct Name
+    {
+        std::string name;
+        size_t hash;
+        size_t index;
+    };
+
+    static constexpr size_t NAME_BUCKETS = MAX_NAMES * 2;
+
+    static inline size_t hash(const char *str, size_t len)
+    {
+        size_t h = 2166136261u;
+
+        for (size_t i = 0; i < len; i++)
+        {
+            h = (h ^ static_cast<uint8_t>(str[i])) * 16777619u;
+        }
+
+        return h;
+    }
+
+    MetricsConf m_conf;
+    uint64_t m_id;
+
+    std::atomic<size_t> m_size;
+    std::atomic<Name *> m_names[NAME_BUCKETS];
+    Name *m_indexes[MAX_NAMES];
+    mutable std::mutex m_mutex;
+    std::vector<std::shared_ptr<Local>> m_locals;
+
+    std::thread m_reporter;
+    std::mutex m_reporting;
+    std::condition_variable m_stop;
+    bool m_stopped = false;
+
+    Name *find(string_view name, size_t h) const;
+
+    Name *add(string_view name, size_t h);
+
+    Local &local(void);
+
+    void report(void);
+
+  public:
+    SpanMetrics(const MetricsConf &conf = MetricsConf());
+
+    ~SpanMetrics();
+
+    SpanMetrics(const SpanMetrics &) = delete;
+    SpanMetrics &operator=(const SpanMetrics &) = delete;
+
+    const MetricsConf &conf(void) const { return m_conf; }
+
+    /**
+    * \brief Record a finished span, its duration is measured even when it isn't recording, see Span#start_timer
+    */
+    inline void record(const Span &span) { record(span.name(), span.duration(), span.failed()); }
+
+    void record(string_view name, duration_t duration, bool error);
+
+    /**
+    * \brief The merged metrics of all the threads
+    */
+    std::vector<SpanMetric> snapshot(void) const;
+
+    /**
+    * \brief Write the metrics in the Prometheus text exposition format
+    */
+    void expose(std::ostream &os) const;
+};
+
+} // namespace zipkin
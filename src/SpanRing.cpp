@@ -0,0 +1,210 @@
+#include "SpanRing.h"
+
+#include <algorithm>
+#include <climits>
+
+#ifdef ZIPKIN_HAS_FUTEX
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+namespace zipkin
+{
+
+SpanRing::SpanRing(size_t capacity) : m_enqueue_pos(0), m_dequeue_pos(0)
+{
+    size_t size = 2;
+
+    while (size < capacity)
+    {
+        size <<= 1;
+    }
+
+    m_mask = size - 1;
+    m_cells.reset(new Cell[size]);
+
+    for (size_t i = 0; i < size; i++)
+    {
+        m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        m_cells[i].span = nullptr;
+    }
+}
+
+bool SpanRing::push(Span *span, size_t &size)
+{
+    size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+    Cell *cell;
+
+    for (;;)
+    {
+        cell = &m_cells[pos & m_mask];
+
+        size_t sequence = cell->sequence.load(std::memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+
+        if (diff == 0)
+        {
+            if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+        {
+            // the cell of the previous lap is not consumed yet
+            return false;
+        }
+        else
+        {
+            pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+    cell->span = span;
+    cell->sequence.store(pos + 1, std::memory_order_release);
+
+    size_t dequeue_pos = m_dequeue_pos.load(std::memory_order_acquire);
+
+    size = pos + 1 > dequeue_pos ? pos + 1 - dequeue_pos : 0;
+
+    return true;
+}
+
+size_t SpanRing::push(Span *const *spans, size_t count, size_t &size)
+{
+    size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+    size_t claimed;
+
+    for (;;)
+    {
+        // the evicting producers may free the cells out of order, only claim the free cells in a row
+        for (claimed = 0; claimed < count && claimed <= m_mask; claimed++)
+        {
+            if (m_cells[(pos + claimed) & m_mask].sequence.load(std::memory_order_acquire) != pos + claimed)
+                break;
+        }
+
+        if (!claimed)
+        {
+            size_t current = m_enqueue_pos.load(std::memory_order_relaxed);
+
+            if (current == pos)
+                return 0;
+
+            pos = current;
+            continue;
+        }
+
+        if (m_enqueue_pos.compare_exchange_weak(pos, pos + claimed, std::memory_order_relaxed))
+            break;
+    }
+
+    for (size_t i = 0; i < claimed; i++)
+    {
+        Cell &cell = m_cells[(pos + i) & m_mask];
+
+        cell.span = spans[i];
+        cell.sequence.store(pos + i + 1, std::memory_order_release);
+    }
+
+    size_t dequeue_pos = m_dequeue_pos.load(std::memory_order_acquire);
+
+    size = pos + claimed > dequeue_pos ? pos + claimed - dequeue_pos : 0;
+
+    return claimed;
+}
+
+bool SpanRing::pop(Span *&span)
+{
+    size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+    Cell *cell;
+
+    for (;;)
+    {
+        cell = &m_cells[pos & m_mask];
+
+        size_t sequence = cell->sequence.load(std::memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+
+        if (diff == 0)
+        {
+            if (m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+        {
+            // empty, or the claimed cell is not published yet and it is taken on the next round
+            return false;
+        }
+        else
+        {
+            pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+    span = cell->span;
+
+    cell->sequence.store(pos + m_mask + 1, std::memory_order_release);
+
+    return true;
+}
+
+size_t SpanRing::pop(std::vector<Span *> &spans, size_t max)
+{
+    size_t count = 0;
+    Span *span;
+
+    while (count < max && pop(span))
+    {
+        spans.push_back(span);
+        count++;
+    }
+
+    return count;
+}
+
+void Wakeup::notify(void)
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (m_waiters.load(std::memory_order_relaxed))
+    {
+#ifdef ZIPKIN_HAS_FUTEX
+        m_sequence.fetch_add(1, std::memory_order_release);
+
+        syscall(SYS_futex, &m_sequence, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+#else
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            m_sequence.fetch_add(1, std::memory_order_release);
+        }
+
+        m_cond.notify_all();
+#endif
+    }
+}
+
+void Wakeup::sleep(uint32_t sequence, std::chrono::milliseconds timeout)
+{
+#ifdef ZIPKIN_HAS_FUTEX
+    struct timespec ts;
+
+    ts.tv_sec = timeout.count() / 1000;
+    ts.tv_nsec = (timeout.count() % 1000) * 1000000;
+
+    // returns at once when notified since the sequence was read
+    syscall(SYS_futex, &m_sequence, FUTEX_WAIT_PRIVATE, sequence, timeout.count() ? &ts : nullptr, nullptr, 0);
+#else
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    // the sequence is bumped under the lock, a notification since it was read is never missed
+    auto notified = [this, sequence] { return m_sequence.load(std::memory_order_acquire) != sequence; };
+
+    if (timeout.count())
+        m_cond.wait_for(lock, timeout, notified);
+    else
+        m_cond.wait(lock, notified);
+#endif
+}
+
+} // namespace zipkin
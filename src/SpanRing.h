@@ -0,0 +1,169 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#ifdef __linux__
+#define ZIPKIN_HAS_FUTEX 1
+#else
+#include <mutex>
+#include <condition_variable>
+#endif
+
+#include "Span.h"
+
+namespace zipkin
+{
+
+/**
+* \brief Bounded lock-free multi-producer ring of the submitted spans
+*
+* Each cell carries a sequence number, a producer claims a position with a single CAS and publishes the span
+* by advancing the sequence of its cell, so a push never takes a lock, and fails instead of waiting when the ring is full.
+* The capacity is rounded up to a power of two.
+*
+* The spans are popped by the collector thread, and by the producers evicting the oldest span of a full ring,
+* a pop claims its position with a CAS too.
+*
+* The occupancy is exact, it counts the claimed positions which were not popped yet.
+*/
+class SpanRing
+{
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        Span *span;
+    };
+
+    size_t m_mask;
+    std::unique_ptr<Cell[]> m_cells;
+
+    uint8_t m_pad0[64]; // keep the producers and the consumer positions on their own cache lines
+
+    std::atomic<size_t> m_enqueue_pos;
+
+    uint8_t m_pad1[64];
+
+    std::atomic<size_t> m_dequeue_pos;
+
+    uint8_t m_pad2[64];
+
+  public:
+    SpanRing(size_t capacity);
+
+    SpanRing(const SpanRing &) = delete;
+    SpanRing &operator=(const SpanRing &) = delete;
+
+    inline size_t capacity(void) const { return m_mask + 1; }
+
+    /**
+    * \brief Number of the spans in the ring
+    */
+    inline size_t size(void) const
+    {
+        size_t dequeue_pos = m_dequeue_pos.load(std::memory_order_acquire);
+        size_t enqueue_pos = m_enqueue_pos.load(std::memory_order_acquire);
+
+        return enqueue_pos > dequeue_pos ? enqueue_pos - dequeue_pos : 0;
+    }
+
+    inline bool empty(void) const { return size() == 0; }
+
+    /**
+    * \brief Total number of the spans pushed since the ring was created
+    */
+    inline size_t pushed(void) const { return m_enqueue_pos.load(std::memory_order_acquire); }
+
+    /**
+    * \brief Total number of the spans popped since the ring was created
+    */
+    inline size_t popped(void) const { return m_dequeue_pos.load(std::memory_order_acquire); }
+
+    /**
+    * \brief Push a span, false when the ring is full
+    *
+    * \param size the number of the spans in the ring after the push
+    */
+    bool push(Span *span, size_t &size);
+
+    inline bool push(Span *span)
+    {
+        size_t size;
+
+        return push(span, size);
+    }
+
+    /**
+    * \brief Push the spans as many as the free cells with a single claim, the rest are left to the caller
+    *
+    * \param size the number of the spans in the ring after the push
+    * \return the number of the pushed spans
+    */
+    size_t push(Span *const *spans, size_t count, size_t &size);
+
+    /**
+    * \brief Pop the oldest span, false when the ring is empty or the oldest span is not published yet
+    */
+    bool pop(Span *&span);
+
+    /**
+    * \brief Pop up to \p max spans
+    */
+    size_t pop(std::vector<Span *> &spans, size_t max = SIZE_MAX);
+};
+
+/**
+* \brief Futex based wakeup of the sleeping threads
+*
+* The notifiers only load a counter while no thread waits, the sequence is bumped and the futex woken
+* only when a waiter announced it is going to sleep. The waiter checks its condition again after the announcement,
+* so a notifier either sees it sleeping or the waiter sees the state published before the notification.
+*
+* Without futexes the sequence is bumped and waited for under a mutex and a condition variable instead.
+*/
+class Wakeup
+{
+    std::atomic<uint32_t> m_sequence;
+    std::atomic<uint32_t> m_waiters;
+#ifndef ZIPKIN_HAS_FUTEX
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+#endif
+
+  public:
+    Wakeup() : m_sequence(0), m_waiters(0) {}
+
+    /**
+    * \brief Wake up all the sleeping waiters, called after publishing the state checked by their condition
+    */
+    void notify(void);
+
+    /**
+    * \brief Sleep until notified or the timeout, unless \p ready is true once the waiter is visible to the notifiers
+    *
+    * \param timeout the maximum amount of time to sleep, zero means forever
+    */
+    template <typename Predicate>
+    void wait(std::chrono::milliseconds timeout, Predicate ready)
+    {
+        uint32_t sequence = m_sequence.load(std::memory_order_seq_cst);
+
+        m_waiters.fetch_add(1, std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (!ready())
+            sleep(sequence, timeout);
+
+        m_waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+  private:
+    void sleep(uint32_t sequence, std::chrono::milliseconds timeout);
+};
+
+} // namespace zipkin
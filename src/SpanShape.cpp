@@ -0,0 +1,217 @@
+#include "SpanShape.h"
+
+#include <cmath>
+
+#include <glog/logging.h>
+
+namespace zipkin
+{
+
+constexpr size_t SpanShapes::MAX_NAMES;
+constexpr size_t SpanShapes::HISTOGRAM_BUCKETS;
+constexpr size_t SpanShapes::DECAY_SAMPLES;
+constexpr size_t SpanShapes::DEFAULT_SAMPLE_EVERY;
+constexpr size_t SpanShapes::BUCKETS;
+
+std::ostream &operator<<(std::ostream &os, const SpanShape &shape)
+{
+    return os << shape.name << ": samples=" << shape.samples
+              << ", annotations=" << shape.annotations
+              << ", binary_annotations=" << shape.binary_annotations
+              << ", bytes=" << shape.bytes;
+}
+
+void SpanShapes::Histogram::add(size_t value)
+{
+    size_t bucket = value ? 64 - __builtin_clzll(value) : 0;
+
+    counts[std::min(bucket, HISTOGRAM_BUCKETS - 1)].fetch_add(1, std::memory_order_relaxed);
+}
+
+size_t SpanShapes::Histogram::percentile(double pct) const
+{
+    uint32_t snapshot[HISTOGRAM_BUCKETS];
+    size_t total = 0;
+
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        total += snapshot[i] = counts[i].load(std::memory_order_relaxed);
+    }
+
+    size_t rank = static_cast<size_t>(std::ceil(total * pct));
+    size_t seen = 0;
+
+    for (size_t i = 0; total && i < HISTOGRAM_BUCKETS; i++)
+    {
+        seen += snapshot[i];
+
+        if (seen >= rank)
+            return i ? (size_t(1) << i) - 1 : 0;
+    }
+
+    return 0;
+}
+
+void SpanShapes::Histogram::decay(void)
+{
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        counts[i].store(counts[i].load(std::memory_order_relaxed) / 2, std::memory_order_relaxed);
+    }
+}
+
+SpanShapes::SpanShapes(size_t sample_every) : m_sample_every(sample_every ? sample_every : 1), m_size(0)
+{
+    for (size_t i = 0; i < BUCKETS; i++)
+    {
+        m_buckets[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+SpanShapes::~SpanShapes()
+{
+    for (size_t i = 0; i < BUCKETS; i++)
+    {
+        delete m_buckets[i].load(std::memory_order_relaxed);
+    }
+}
+
+SpanShapes::Entry *SpanShapes::find(string_view name, size_t h) const
+{
+    size_t bucket = h % BUCKETS;
+    Entry *entry;
+
+    while ((entry = m_buckets[bucket].load(std::memory_order_acquire)))
+    {
+        if (entry->hash == h && entry->name.size() == name.size() && 0 == memcmp(entry->name.data(), name.data(), name.size()))
+            return entry;
+
+        bucket = (bucket + 1) % BUCKETS;
+    }
+
+    return nullptr;
+}
+
+SpanShapes::Entry *SpanShapes::add(string_view name, size_t h)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (Entry *entry = find(name, h))
+        return entry;
+
+    size_t size = m_size.load(std::memory_order_relaxed);
+
+    if (size >= MAX_NAMES)
+        return nullptr;
+
+    Entry *entry = new Entry();
+
+    entry->name.assign(name.data(), name.size());
+    entry->hash = h;
+    entry->samples.store(0, std::memory_order_relaxed);
+    entry->reserve_size.store(0, std::memory_order_relaxed);
+
+    for (Histogram *histogram : {&entry->annotations, &entry->binary_annotations, &entry->bytes})
+    {
+        for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+        {
+            histogram->counts[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    size_t bucket = h % BUCKETS;
+
+    while (m_buckets[bucket].load(std::memory_order_relaxed))
+    {
+        bucket = (bucket + 1) % BUCKETS;
+    }
+
+    m_buckets[bucket].store(entry, std::memory_order_release);
+    m_size.store(size + 1, std::memory_order_release);
+
+    VLOG(2) << "tracking the shape of `" << entry->name << "` spans";
+
+    return entry;
+}
+
+void SpanShapes::record(const Span &span)
+{
+    static thread_local size_t ticks = 0;
+
+    if (++ticks % m_sample_every)
+        return;
+
+    record(span.name(), span.annotations_size(), span.binary_annotations_size(), span.arena().allocated());
+}
+
+void SpanShapes::record(string_view name, size_t annotations, size_t binary_annotations, size_t bytes)
+{
+    size_t h = hash(name.data(), name.size());
+    Entry *entry = find(name, h);
+
+    if (!entry && !(entry = add(name, h)))
+        return;
+
+    entry->annotations.add(annotations);
+    entry->binary_annotations.add(binary_annotations);
+    entry->bytes.add(bytes);
+
+    uint32_t samples = entry->samples.fetch_add(1, std::memory_order_relaxed) + 1;
+
+    if (samples >= DECAY_SAMPLES && entry->samples.compare_exchange_strong(samples, samples / 2, std::memory_order_relaxed))
+    {
+        entry->annotations.decay();
+        entry->binary_annotations.decay();
+        entry->bytes.decay();
+    }
+
+    entry->reserve_size.store(entry->bytes.percentile(0.95), std::memory_order_relaxed);
+}
+
+size_t SpanShapes::reserve_size(string_view name) const
+{
+    if (!m_size.load(std::memory_order_relaxed))
+        return 0;
+
+    Entry *entry = find(name, hash(name.data(), name.size()));
+
+    return entry ? entry->reserve_size.load(std::memory_order_relaxed) : 0;
+}
+
+bool SpanShapes::shape(string_view name, SpanShape &shape) const
+{
+    Entry *entry = find(name, hash(name.data(), name.size()));
+
+    if (!entry)
+        return false;
+
+    size_t samples = entry->samples.load(std::memory_order_relaxed);
+
+    shape.name = entry->name;
+    shape.samples = samples;
+    shape.annotations = entry->annotations.percentile(0.95);
+    shape.binary_annotations = entry->binary_annotations.percentile(0.95);
+    shape.bytes = entry->bytes.percentile(0.95);
+
+    return true;
+}
+
+std::vector<SpanShape> SpanShapes::shapes(void) const
+{
+    std::vector<SpanShape> shapes;
+
+    for (size_t i = 0; i < BUCKETS; i++)
+    {
+        if (Entry *entry = m_buckets[i].load(std::memory_order_acquire))
+        {
+            SpanShape s;
+
+            if (shape(entry->name, s))
+                shapes.push_back(s);
+        }
+    }
+
+    return shapes;
+}
+
+} // namespace zipkin
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <ostream>
+
+#include "Span.h"
+
+namespace zipkin
+{
+
+/**
+* \brief The observed p95 shape of the spans with a name
+*
+* The values are rounded up to a power of two.
+*/
+struct SpanShape
+{
+    std::string name;
+    size_t samples;            ///< recent samples, older samples decay
+    size_t annotations;        ///< p95 of the annotation count
+    size_t binary_annotations; ///< p95 of the binary annotation count
+    size_t bytes;              ///< p95 of the bytes recorded in the Arena of span
+};
+
+std::ostream &operator<<(std::ostream &os, const SpanShape &shape);
+
+/**
+* \brief Per-span-name statistics of the span shapes
+*
+* The released spans are sampled into per-name log2 histograms, and a new span is pre-sized to the p95 bytes
+* of its name, so it doesn't grow the Arena while recording.
+*
+* Lookups are lock-free, registering a new name is serialized. Names beyond #MAX_NAMES are not tracked.
+*/
+class SpanShapes
+{
+  public:
+    static constexpr size_t MAX_NAMES = 256;
+    static constexpr size_t HISTOGRAM_BUCKETS = 24;
+    static constexpr size_t DECAY_SAMPLES = 1024;
+    static constexpr size_t DEFAULT_SAMPLE_EVERY = 16;
+
+  private:
+    static constexpr size_t BUCKETS = MAX_NAMES * 2;
+
+    struct Histogram
+    {
+        std::atomic<uint32_t> counts[HISTOGRAM_BUCKETS];
+
+        void add(size_t value);
+
+        size_t percentile(double pct) const;
+
+        void decay(void);
+    };
+
+    struct Entry
+    {
+        std::string name;
+        size_t hash;
+        std::atomic<uint32_t> samples;
+        std::atomic<size_t> reserve_size;
+        Histogram annotations, binary_annotations, bytes;
+    };
+
+    size_t m_sample_every;
+    std::atomic<size_t> m_size;
+    std::atomic<Entry *> m_buckets[BUCKETS];
+    std::mutex m_mutex;
+
+    static inline size_t hash(const char *str, size_t len)
+    {
+        size_t h = 2166136261u;
+
+        for (size_t i = 0; i < len; i++)
+        {
+            h = (h ^ static_cast<uint8_t>(str[i])) * 16777619u;
+        }
+
+        return h;
+    }
+
+    Entry *find(string_view name, size_t h) const;
+
+    Entry *add(string_view name, size_t h);
+
+  public:
+    SpanShapes(size_t sample_every = DEFAULT_SAMPLE_EVERY);
+
+    ~SpanShapes();
+
+    SpanShapes(const SpanShapes &) = delete;
+    SpanShapes &operator=(const SpanShapes &) = delete;
+
+    /**
+    * \brief Sample the shape of a finished span, one of every \p sample_every spans of a thread is recorded
+    */
+    void record(const Span &span);
+
+    /**
+    * \brief Record a shape unconditionally
+    */
+    void record(string_view name, size_t annotations, size_t binary_annotations, size_t bytes);
+
+    /**
+    * \brief The p95 bytes of the spans with the name, 0 when it is unknown
+    */
+    size_t reserve_size(string_view name) const;
+
+    /**
+    * \brief The p95 shape of the spans with the name
+    */
+    bool shape(string_view name, SpanShape &shape) const;
+
+    /**
+    * \brief The p95 shapes of all the tracked names
+    */
+    std::vector<SpanShape> shapes(void) const;
+
+    /**
+    * \brief Number of the tracked names
+    */
+    inline size_t size(void) const { return m_size.load(std::memory_order_acquire); }
+};
+
+} // namespace zipkin
@@ -0,0 +1,289 @@
+#include "TailSampler.h"
+#include "Tracer.h"
+
+#include <glog/logging.h>
+
+namespace zipkin
+{
+
+constexpr size_t TailSampler::SHARDS;
+
+size_t TailSampler::span_bytes(const Span *span)
+{
+    return sizeof(Span) + span->arena().allocated();
+}
+
+bool TailSampler::keep(const Trace &trace) const
+{
+    if (trace.sampled)
+        return true;
+
+    for (const Span *span : trace.spans)
+    {
+        if (m_conf.keep_debug && span->debug())
+            return true;
+
+        if (m_conf.keep_errors && span->annotated(TraceKeys::ERROR))
+            return true;
+
+        if (m_conf.min_duration.count() > 0 && span->duration() >= m_conf.min_duration)
+            return true;
+    }
+
+    return false;
+}
+
+void TailSampler::remove(Shard &shard, std::unordered_map<trace_id_t, Trace>::iterator it)
+{
+    Trace &trace = it->second;
+
+    m_traces.fetch_sub(1, std::memory_order_relaxed);
+    m_spans.fetch_sub(trace.spans.size(), std::memory_order_relaxed);
+    m_bytes.fetch_sub(trace.bytes, std::memory_order_relaxed);
+
+    shard.traces.erase(it);
+}
+
+void TailSampler::decide(Trace &trace, std::vector<Span *> &kept, std::vector<Span *> &dropped)
+{
+    if (keep(trace))
+    {
+        m_kept.fetch_add(1, std::memory_order_relaxed);
+
+        kept.insert(kept.end(), trace.spans.begin(), trace.spans.end());
+    }
+    else
+    {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+
+        dropped.insert(dropped.end(), trace.spans.begin(), trace.spans.end());
+    }
+}
+
+void TailSampler::evict(Shard &shard, uint64_t now, std::vector<Span *> &kept, std::vector<Span *> &dropped)
+{
+    uint64_t max_age = std::chrono::duration_cast<std::chrono::nanoseconds>(m_conf.max_age).count();
+
+    while (!shard.order.empty())
+    {
+        auto it = shard.traces.find(shard.order.front());
+
+        if (it == shard.traces.end())
+        {
+            // the trace was decided already
+            shard.order.pop_front();
+            continue;
+        }
+
+        bool expired = now > it->second.started && now - it->second.started > max_age;
+
+        if (!expired && m_bytes.load(std::memory_order_relaxed) <= m_conf.max_bytes)
+            break;
+
+        if (it->second.spans.empty() && !expired)
+            break; // nothing to free
+
+        VLOG(1) << "evict trace " << std::hex << it->first << " with " << std::dec << it->second.spans.size()
+                << " spans and " << it->second.pending << " pending spans";
+
+        m_evicted.fetch_add(1, std::memory_order_relaxed);
+
+        decide(it->second, kept, dropped);
+        remove(shard, it);
+
+        shard.order.pop_front();
+    }
+}
+
+void TailSampler::submit_spans(const std::vector<Span *> &spans)
+{
+    for (Span *span : spans)
+    {
+        Collector *collector = span->tracer() ? span->tracer()->collector() : nullptr;
+
+        if (collector)
+            collector->submit(span);
+        else
+            span->release();
+    }
+}
+
+void TailSampler::release_spans(const std::vector<Span *> &spans)
+{
+    // the spans of a trace usually belong to one tracer, and are returned to its cache at once
+    for (size_t i = 0; i < spans.size();)
+    {
+        Tracer *tracer = spans[i]->tracer();
+        size_t count = 1;
+
+        while (i + count < spans.size() && spans[i + count]->tracer() == tracer)
+        {
+            count++;
+        }
+
+        if (tracer)
+        {
+            tracer->release(&spans[i], count);
+        }
+        else
+        {
+            for (size_t j = i; j < i + count; j++)
+            {
+                spans[j]->release();
+            }
+        }
+
+        i += count;
+    }
+}
+
+void TailSampler::start(const Span *span, bool sampled)
+{
+    Shard &shard = this->shard(span->trace_id());
+    uint64_t now = Clock::get(Clock::COARSE)->ticks();
+    std::vector<Span *> kept, dropped;
+
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        evict(shard, now, kept, dropped);
+
+        auto res = shard.traces.emplace(span->trace_id(), Trace());
+        Trace &trace = res.first->second;
+
+        if (res.second)
+        {
+            trace.sampled = sampled;
+            trace.started = now;
+
+            shard.order.push_back(span->trace_id());
+
+            m_traces.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        trace.pending++;
+    }
+
+    submit_spans(kept);
+    release_spans(dropped);
+}
+
+void TailSampler::finish(Span *span)
+{
+    Shard &shard = this->shard(span->trace_id());
+    size_t bytes = span_bytes(span);
+    std::vector<Span *> kept, dropped;
+
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        auto it = shard.traces.find(span->trace_id());
+
+        if (it == shard.traces.end())
+        {
+            // a late span of an evicted trace, decided on its own
+            Trace trace;
+
+            trace.spans.push_back(span);
+
+            decide(trace, kept, dropped);
+        }
+        else
+        {
+            Trace &trace = it->second;
+
+            trace.spans.push_back(span);
+            trace.bytes += bytes;
+
+            m_spans.fetch_add(1, std::memory_order_relaxed);
+            m_bytes.fetch_add(bytes, std::memory_order_relaxed);
+
+            if (trace.pending)
+                trace.pending--;
+
+            if (!trace.pending)
+            {
+                decide(trace, kept, dropped);
+                remove(shard, it);
+            }
+            else if (m_bytes.load(std::memory_order_relaxed) > m_conf.max_bytes)
+            {
+                evict(shard, Clock::get(Clock::COARSE)->ticks(), kept, dropped);
+            }
+        }
+    }
+
+    submit_spans(kept);
+    release_spans(dropped);
+}
+
+void TailSampler::discard(const Span *span)
+{
+    Shard &shard = this->shard(span->trace_id());
+    std::vector<Span *> kept, dropped;
+
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        auto it = shard.traces.find(span->trace_id());
+
+        if (it == shard.traces.end())
+            return;
+
+        Trace &trace = it->second;
+
+        if (trace.pending)
+            trace.pending--;
+
+        if (!trace.pending)
+        {
+            decide(trace, kept, dropped);
+            remove(shard, it);
+        }
+    }
+
+    submit_spans(kept);
+    release_spans(dropped);
+}
+
+size_t TailSampler::flush(void)
+{
+    std::vector<Span *> kept, dropped;
+    size_t decided = 0;
+
+    for (Shard &shard : m_shards)
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        while (!shard.traces.empty())
+        {
+            decide(shard.traces.begin()->second, kept, dropped);
+            remove(shard, shard.traces.begin());
+
+            decided++;
+        }
+
+        shard.order.clear();
+    }
+
+    submit_spans(kept);
+    release_spans(dropped);
+
+    return decided;
+}
+
+TailSampler::Stats TailSampler::stats(void) const
+{
+    Stats stats;
+
+    stats.traces = m_traces.load(std::memory_order_relaxed);
+    stats.spans = m_spans.load(std::memory_order_relaxed);
+    stats.bytes = m_bytes.load(std::memory_order_relaxed);
+    stats.kept = m_kept.load(std::memory_order_relaxed);
+    stats.dropped = m_dropped.load(std::memory_order_relaxed);
+    stats.evicted = m_evicted.load(std::memory_order_relaxed);
+
+    return stats;
+}
+
+} // namespace zipkin
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <deque>
+#include <vector>
+#include <unordered_map>
+
+#include "Span.h"
+
+namespace zipkin
+{
+
+struct TailSamplingConf
+{
+    /**
+    * \brief Keep the traces with an TraceKeys#ERROR annotation or binary annotation.
+    *
+    * default: true
+    */
+    bool keep_errors = true;
+
+    /**
+    * \brief Keep the traces with a debug span.
+    *
+    * default: true
+    */
+    bool keep_debug = true;
+
+    /**
+    * \brief Keep the traces with a local span which lasted at least this long, zero disables it.
+    *
+    * default: 0
+    */
+    duration_t min_duration = duration_t::zero();
+
+    /**
+    * \brief The maximum bytes of the buffered spans, the oldest traces are decided early beyond it.
+    *
+    * default: 16MB
+    */
+    size_t max_bytes = 16 * 1024 * 1024;
+
+    /**
+    * \brief The maximum duration a trace is buffered, for the spans which are never submitted or released.
+    *
+    * default: 30 seconds
+    */
+    std::chrono::milliseconds max_age = std::chrono::seconds(30);
+};
+
+/**
+* \brief Buffers the spans of a trace until its local spans finished, then decides whether to report it
+*
+* A CachedTracer with a tail sampler records all the spans, and keeps the head sampling decision of a trace.
+* When the last local span of a trace is submitted or released, the whole trace is submitted to the Collector
+* if it was sampled by the head, or matches the TailSamplingConf policy, otherwise its spans are released to the cache.
+*
+* The traces are sharded by trace id, each shard is protected by its own mutex.
+*
+* \sa CachedTracer#set_tail_sampler
+*/
+class TailSampler
+{
+  public:
+    static constexpr size_t SHARDS = 16;
+
+    struct Stats
+    {
+        size_t traces;  ///< traces buffered
+        size_t spans;   ///< spans buffered
+        size_t bytes;   ///< approximate bytes of the buffered spans
+        size_t kept;    ///< traces submitted to the collector
+        size_t dropped; ///< traces released to the cache
+        size_t evicted; ///< traces decided early, beyond #TailSamplingConf::max_bytes or #TailSamplingConf::max_age
+    };
+
+  private:
+    struct Trace
+    {
+        std::vector<Span *> spans;
+        size_t pending = 0; // local spans neither submitted nor released
+        size_t bytes = 0;
+        bool sampled = false; // the head sampling decision
+        uint64_t started = 0;
+    };
+
+    struct Shard
+    {
+        std::mutex mutex;
+        std::unordered_map<trace_id_t, Trace> traces;
+        std::deque<trace_id_t> order; // the traces in their arrival order, some may be decided already
+    };
+
+    TailSamplingConf m_conf;
+    Shard m_shards[SHARDS];
+
+    std::atomic_size_t m_traces = ATOMIC_VAR_INIT(0);
+    std::atomic_size_t m_spans = ATOMIC_VAR_INIT(0);
+    std::atomic_size_t m_bytes = ATOMIC_VAR_INIT(0);
+    std::atomic_size_t m_kept = ATOMIC_VAR_INIT(0);
+    std::atomic_size_t m_dropped = ATOMIC_VAR_INIT(0);
+    std::atomic_size_t m_evicted = ATOMIC_VAR_INIT(0);
+
+    inline Shard &shard(trace_id_t trace_id) { return m_shards[(trace_id ^ (trace_id >> 32)) % SHARDS]; }
+
+    static size_t span_bytes(const Span *span);
+
+    bool keep(const Trace &trace) const;
+
+    /**
+    * \brief Remove a trace from its shard, the caller holds the lock of shard
+    */
+    void remove(Shard &shard, std::unordered_map<trace_id_t, Trace>::iterator it);
+
+    /**
+    * \brief Decide the oldest traces of a shard beyond the limits, the caller holds the lock of shard
+    */
+    void evict(Shard &shard, uint64_t now, std::vector<Span *> &kept, std::vector<Span *> &dropped);
+
+    void decide(Trace &trace, std::vector<Span *> &kept, std::vector<Span *> &dropped);
+
+    static void submit_spans(const std::vector<Span *> &spans);
+
+    static void release_spans(const std::vector<Span *> &spans);
+
+  public:
+    TailSampler(const TailSamplingConf &conf = TailSamplingConf()) : m_conf(conf) {}
+
+    /**
+    * \brief Decide the buffered traces
+    */
+    ~TailSampler() { flush(); }
+
+    TailSampler(const TailSampler &) = delete;
+    TailSampler &operator=(const TailSampler &) = delete;
+
+    const TailSamplingConf &conf(void) const { return m_conf; }
+
+    /**
+    * \brief A local span of the trace was created, with the head sampling decision of the trace
+    */
+    void start(const Span *span, bool sampled);
+
+    /**
+    * \brief A local span was submitted, the sampler owns it
+    */
+    void finish(Span *span);
+
+    /**
+    * \brief A local span was released without submitted
+    */
+    void discard(const Span *span);
+
+    /**
+    * \brief Decide all the buffered traces now, even if they have pending spans
+    *
+    * \return the number of the decided traces
+    */
+    size_t flush(void);
+
+    Stats stats(void) const;
+};
+
+} // namespace zipkin
@@ -1,4 +1,9 @@
 #include "Tracer.h"
+#include "Slab.h"
+
+#include <vector>
+#include <thread>
+#include <condition_variable>
 
 #include <glog/logging.h>
 
@@ -7,35 +12,718 @@ namespace zipkin
 constexpr size_t CachedTracer::CACHE_LINE_SIZE;
 constexpr size_t CachedTracer::DEFAULT_CACHE_MESSAGE_SIZE;
 constexpr size_t CachedTracer::DEFAULT_CACHE_MESSAGE_COUNT;
+constexpr size_t CachedTracer::SIZE_CLASSES;
+constexpr size_t CachedTracer::DEFAULT_SIZE_CLASS;
+constexpr size_t SpanCache::BATCH_SIZE;
+constexpr size_t SpanCache::MAX_THREAD_CACHES;
+constexpr size_t SpanCache::GROWTH_LIMIT;
+
+constexpr std::chrono::milliseconds SpanCache::DEFAULT_TRIM_INTERVAL;
+
+namespace __impl
+{
+
+static std::atomic<int64_t> g_trim_interval_ms(SpanCache::DEFAULT_TRIM_INTERVAL.count());
+static SpanCache *g_trimmed_caches = nullptr;
+
+static std::condition_variable &trimmer_wakeup(void)
+{
+    // never destroyed, the trimmer thread is detached and may still wait on it during the static destruction
+    static std::condition_variable *cond = new std::condition_variable();
+
+    return *cond;
+}
+
+} // namespace __impl
+
+std::mutex &SpanCache::registry(void)
+{
+    // never destroyed, the magazines of the exiting threads are returned during the static destruction
+    static std::mutex *mutex = new std::mutex();
+
+    return *mutex;
+}
+
+SpanCache::ThreadMagazines &SpanCache::thread_magazines(void)
+{
+    static thread_local ThreadMagazines magazines;
+
+    return magazines;
+}
+
+SpanCache::ThreadMagazines::~ThreadMagazines()
+{
+    std::lock_guard<std::mutex> lock(registry());
+
+    for (Magazine &mag : slots)
+    {
+        if (!mag.cache)
+            continue;
+
+        SpanCache *cache = mag.cache;
+
+        for (Magazine **p = &cache->m_magazines; *p; p = &(*p)->next)
+        {
+            if (*p == &mag)
+            {
+                *p = mag.next;
+                break;
+            }
+        }
+
+        cache->m_hits.fetch_add(mag.hits.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        cache->m_misses.fetch_add(mag.misses.load(std::memory_order_relaxed), std::memory_order_relaxed);
+
+        cache->uncount(mag);
+        cache->return_spans(mag.spans);
+
+        mag.cache = nullptr;
+        mag.spans = nullptr;
+        mag.size.store(0, std::memory_order_relaxed);
+        mag.next = nullptr;
+    }
+}
+
+SpanCache::SpanCache(size_t message_size, size_t message_capacity, Slab *slab)
+    : m_message_size(message_size), m_min_capacity(message_capacity), m_max_capacity(message_capacity * GROWTH_LIMIT),
+      m_slab(slab),
+      m_batches(std::max<size_t>(1, message_capacity / BATCH_SIZE)),
+      m_capacity(message_capacity), m_cached(0), m_low_watermark(0)
+{
+    static std::once_flag trimmer_started;
+
+    std::call_once(trimmer_started, [] { std::thread(SpanCache::run_trimmer).detach(); });
+
+    std::lock_guard<std::mutex> lock(registry());
+
+    m_next_cache = __impl::g_trimmed_caches;
+    __impl::g_trimmed_caches = this;
+}
+
+SpanCache::~SpanCache()
+{
+    std::lock_guard<std::mutex> lock(registry());
+
+    for (SpanCache **p = &__impl::g_trimmed_caches; *p; p = &(*p)->m_next_cache)
+    {
+        if (*p == this)
+        {
+            *p = m_next_cache;
+            break;
+        }
+    }
+
+    for (Magazine *mag = m_magazines; mag; mag = mag->next)
+    {
+        delete_batch(mag->spans);
+
+        mag->cache = nullptr;
+        mag->spans = nullptr;
+        mag->size.store(0, std::memory_order_relaxed);
+        mag->counted.store(0, std::memory_order_relaxed);
+    }
+
+    m_magazines = nullptr;
+
+    m_batches.consume_all([](CachedSpan *head) -> void { delete_batch(head); });
+}
+
+std::chrono::milliseconds SpanCache::trim_interval(void)
+{
+    return std::chrono::milliseconds(__impl::g_trim_interval_ms.load(std::memory_order_relaxed));
+}
+
+void SpanCache::set_trim_interval(std::chrono::milliseconds interval)
+{
+    __impl::g_trim_interval_ms.store(interval.count(), std::memory_order_relaxed);
+    __impl::trimmer_wakeup().notify_all();
+}
+
+void SpanCache::run_trimmer(void)
+{
+    std::unique_lock<std::mutex> lock(registry());
+
+    while (true)
+    {
+        std::chrono::milliseconds interval = trim_interval();
+
+        if (interval.count() <= 0)
+        {
+            __impl::trimmer_wakeup().wait(lock);
+            continue;
+        }
+
+        if (std::cv_status::no_timeout == __impl::trimmer_wakeup().wait_for(lock, interval))
+            continue;
+
+        for (SpanCache *cache = __impl::g_trimmed_caches; cache; cache = cache->m_next_cache)
+        {
+            if (size_t trimmed = cache->trim_locked())
+            {
+                VLOG(1) << "trimmed " << trimmed << " idle spans of " << cache->message_size() << " bytes";
+            }
+        }
+    }
+}
+
+SpanCache::Magazine *SpanCache::magazine(void)
+{
+    ThreadMagazines &magazines = thread_magazines();
+    Magazine *free = nullptr;
+
+    for (Magazine &mag : magazines.slots)
+    {
+        if (mag.cache == this)
+        {
+            if (mag.epoch != m_trim_epoch.load(std::memory_order_relaxed))
+                drain(mag);
+
+            return &mag;
+        }
+
+        if (!mag.cache && !free)
+            free = &mag;
+    }
+
+    if (free)
+    {
+        std::lock_guard<std::mutex> lock(registry());
+
+        free->cache = this;
+        free->spans = nullptr;
+        free->epoch = m_trim_epoch.load(std::memory_order_relaxed);
+        free->size.store(0, std::memory_order_relaxed);
+        free->counted.store(0, std::memory_order_relaxed);
+        free->next = m_magazines;
+        free->hits.store(0, std::memory_order_relaxed);
+        free->misses.store(0, std::memory_order_relaxed);
+
+        m_magazines = free;
+    }
+
+    return free;
+}
+
+const SpanCache::Magazine *SpanCache::find_magazine(void) const
+{
+    for (const Magazine &mag : thread_magazines().slots)
+    {
+        if (mag.cache == this)
+            return &mag;
+    }
+
+    return nullptr;
+}
+
+void SpanCache::drain(Magazine &mag)
+{
+    CachedSpan *spans = mag.spans;
+
+    mag.epoch = m_trim_epoch.load(std::memory_order_relaxed);
+    mag.spans = nullptr;
+    mag.size.store(0, std::memory_order_relaxed);
+
+    uncount(mag);
+    return_spans(spans);
+}
+
+void SpanCache::uncount(Magazine &mag)
+{
+    m_magazined.fetch_sub(mag.counted.exchange(0, std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+void SpanCache::return_spans(CachedSpan *spans)
+{
+    while (spans)
+    {
+        CachedSpan *head = spans, *tail = head;
+        size_t size = 1;
+
+        while (size < BATCH_SIZE && tail->m_next_cached)
+        {
+            tail = tail->m_next_cached;
+            size++;
+        }
+
+        spans = tail->m_next_cached;
+        tail->m_next_cached = nullptr;
+        head->m_cached_batch = size;
+
+        push_batch(head);
+    }
+}
+
+CachedSpan *SpanCache::pop_batch(void)
+{
+    CachedSpan *head = nullptr;
+
+    if (!m_batches.pop(head))
+        return nullptr;
+
+    size_t cached = m_cached.fetch_sub(head->m_cached_batch, std::memory_order_relaxed) - head->m_cached_batch;
+    size_t low = m_low_watermark.load(std::memory_order_relaxed);
+
+    while (cached < low && !m_low_watermark.compare_exchange_weak(low, cached, std::memory_order_relaxed))
+        ;
+
+    return head;
+}
+
+void SpanCache::push_batch(CachedSpan *head)
+{
+    size_t size = head->m_cached_batch;
+    size_t capacity = m_capacity.load(std::memory_order_relaxed);
+
+    if (m_cached.load(std::memory_order_relaxed) + m_magazined.load(std::memory_order_relaxed) + size > capacity)
+    {
+        // grow only when the cache ran out of spans, otherwise the burst is over
+        if (capacity >= m_max_capacity || !m_starved.exchange(false, std::memory_order_relaxed))
+        {
+            delete_batch(head);
+
+            return;
+        }
+
+        m_capacity.compare_exchange_strong(capacity, std::min(m_max_capacity, capacity * 2), std::memory_order_relaxed);
+    }
+
+    // count the spans before they could be popped
+    m_cached.fetch_add(size, std::memory_order_relaxed);
+
+    if (!m_batches.push(head))
+    {
+        m_cached.fetch_sub(size, std::memory_order_relaxed);
+
+        delete_batch(head);
+    }
+}
+
+void SpanCache::delete_batch(CachedSpan *head)
+{
+    while (head)
+    {
+        CachedSpan *span = head;
+
+        head = head->m_next_cached;
+
+        delete span;
+    }
+}
+
+bool SpanCache::empty(void) const
+{
+    const Magazine *mag = find_magazine();
+
+    return (!mag || !mag->spans) && m_batches.empty();
+}
+
+void SpanCache::purge_all(void)
+{
+    while (CachedSpan *head = pop_batch())
+    {
+        delete_batch(head);
+    }
+
+    std::lock_guard<std::mutex> lock(registry());
+
+    for (Magazine *mag = m_magazines; mag; mag = mag->next)
+    {
+        delete_batch(mag->spans);
+
+        mag->spans = nullptr;
+        mag->size.store(0, std::memory_order_relaxed);
+
+        uncount(*mag);
+    }
+}
+
+CachedSpan *SpanCache::get(void)
+{
+    Magazine *mag = magazine();
+    CachedSpan *head = nullptr;
+
+    if (mag && mag->spans)
+    {
+        head = mag->spans;
+    }
+    else if ((head = pop_batch()))
+    {
+        if (!mag)
+        {
+            if (CachedSpan *rest = head->m_next_cached)
+            {
+                rest->m_cached_batch = head->m_cached_batch - 1;
+
+                push_batch(rest);
+            }
+
+            head->m_next_cached = nullptr;
+
+            m_hits.fetch_add(1, std::memory_order_relaxed);
+
+            return head;
+        }
+
+        mag->size.store(head->m_cached_batch, std::memory_order_relaxed);
+    }
+    else
+    {
+        if (!m_starved.load(std::memory_order_relaxed))
+            m_starved.store(true, std::memory_order_relaxed);
+
+        if (mag)
+            mag->misses.store(mag->misses.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        else
+            m_misses.fetch_add(1, std::memory_order_relaxed);
+
+        return nullptr;
+    }
+
+    mag->spans = head->m_next_cached;
+    mag->size.store(mag->size.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+    mag->hits.store(mag->hits.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+    head->m_next_cached = nullptr;
+
+    return head;
+}
+
+void SpanCache::release(CachedSpan *span)
+{
+    Magazine *mag = magazine();
+
+    if (!mag)
+    {
+        span->m_next_cached = nullptr;
+        span->m_cached_batch = 1;
+
+        push_batch(span);
+
+        return;
+    }
+
+    span->m_next_cached = mag->spans;
+    mag->spans = span;
+
+    size_t size = mag->size.load(std::memory_order_relaxed) + 1;
+
+    mag->size.store(size, std::memory_order_relaxed);
+
+    if (size < BATCH_SIZE * 2)
+        return;
+
+    // keep the most recently released spans, which are still warm in the cache of this CPU
+    CachedSpan *tail = mag->spans;
+
+    for (size_t i = 1; i < BATCH_SIZE; i++)
+    {
+        tail = tail->m_next_cached;
+    }
+
+    CachedSpan *head = tail->m_next_cached;
+
+    tail->m_next_cached = nullptr;
+    head->m_cached_batch = size - BATCH_SIZE;
+    mag->size.store(BATCH_SIZE, std::memory_order_relaxed);
+
+    push_batch(head);
+}
+
+void SpanCache::release(CachedSpan *const *spans, size_t count)
+{
+    for (size_t i = 0; i < count; i += BATCH_SIZE)
+    {
+        size_t size = std::min(BATCH_SIZE, count - i);
+
+        for (size_t j = 0; j < size; j++)
+        {
+            spans[i + j]->m_next_cached = j + 1 < size ? spans[i + j + 1] : nullptr;
+        }
+
+        spans[i]->m_cached_batch = size;
+
+        push_batch(spans[i]);
+    }
+}
+
+void SpanCache::prewarm(Tracer *tracer, size_t count)
+{
+    std::vector<CachedSpan *> spans;
+
+    spans.reserve(count);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (CachedSpan *span = new (this) CachedSpan(this, tracer, string_view()))
+            spans.push_back(span);
+    }
+
+    m_prewarmed.fetch_add(spans.size(), std::memory_order_relaxed);
+
+    release(spans.data(), spans.size());
+
+    VLOG(1) << "prewarmed " << spans.size() << " spans of " << m_message_size << " bytes";
+}
+
+size_t SpanCache::trim(void)
+{
+    std::lock_guard<std::mutex> lock(registry());
+
+    return trim_locked();
+}
+
+size_t SpanCache::trim_locked(void)
+{
+    // count the spans of the magazines against the capacity, every add is paired with the sub of an owner
+    for (Magazine *mag = m_magazines; mag; mag = mag->next)
+    {
+        size_t size = mag->size.load(std::memory_order_relaxed);
+
+        m_magazined.fetch_add(size, std::memory_order_relaxed);
+        m_magazined.fetch_sub(mag->counted.exchange(size, std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+
+    // the owners return the spans of their magazines on the next access, the idle ones are trimmed later
+    m_trim_epoch.fetch_add(1, std::memory_order_relaxed);
+
+    // the spans which were never popped since the last trim, except the prewarmed ones
+    size_t cached = m_cached.load(std::memory_order_relaxed);
+    size_t idle = m_low_watermark.exchange(cached, std::memory_order_relaxed);
+    size_t prewarmed = m_prewarmed.load(std::memory_order_relaxed);
+    size_t trimmed = 0;
+
+    idle = std::min(idle, cached > prewarmed ? cached - prewarmed : 0);
+
+    while (trimmed < idle)
+    {
+        CachedSpan *head = pop_batch();
+
+        if (!head)
+            break;
+
+        trimmed += head->m_cached_batch;
+
+        delete_batch(head);
+    }
+
+    if (trimmed)
+    {
+        size_t capacity = m_capacity.load(std::memory_order_relaxed);
+
+        m_capacity.compare_exchange_strong(capacity, std::max(m_min_capacity, capacity > trimmed ? capacity - trimmed : 0),
+                                           std::memory_order_relaxed);
+        m_low_watermark.store(m_cached.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        m_trimmed.fetch_add(trimmed, std::memory_order_relaxed);
+    }
+
+    return trimmed;
+}
+
+SpanCache::Stats SpanCache::stats(void) const
+{
+    Stats stats;
+
+    stats.message_size = m_message_size;
+    stats.capacity = m_capacity.load(std::memory_order_relaxed);
+    stats.cached = m_cached.load(std::memory_order_relaxed);
+    stats.magazined = m_magazined.load(std::memory_order_relaxed);
+    stats.hits = m_hits.load(std::memory_order_relaxed);
+    stats.misses = m_misses.load(std::memory_order_relaxed);
+    stats.trimmed = m_trimmed.load(std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(registry());
+
+    for (Magazine *mag = m_magazines; mag; mag = mag->next)
+    {
+        stats.hits += mag->hits.load(std::memory_order_relaxed);
+        stats.misses += mag->misses.load(std::memory_order_relaxed);
+    }
+
+    return stats;
+}
+
+void CachedTracer::discard(CachedSpan *span)
+{
+    // only the spans released before they were submitted are still pending in the tail sampler
+    if (!span->m_tail_pending)
+        return;
+
+    span->m_tail_pending = false;
+
+    if (TailSampler *tail_sampler = m_tail_sampler.load(std::memory_order_acquire))
+        tail_sampler->discard(span);
+}
 
 Tracer *Tracer::create(Collector *collector, size_t sample_rate)
 {
     return new CachedTracer(collector, sample_rate);
 }
 
-Span *CachedTracer::span(const std::string &name, span_id_t parent_id, void *userdata)
+CachedTracer::CachedTracer(Collector *collector, size_t sample_rate,
+                           size_t cache_message_size, size_t cache_message_count, unsigned cache_flags)
+    : m_collector(collector), m_counting_sampler(sample_rate), m_sampler(&m_counting_sampler), m_tail_sampler(nullptr), m_metrics(nullptr), m_dependency_linker(nullptr)
+{
+    bool hugepage = cache_flags & CACHE_HUGEPAGE;
+    bool slab = hugepage || (cache_flags & CACHE_SLAB);
+
+    for (size_t i = 0; i < SIZE_CLASSES; i++)
+    {
+        size_t message_size = i < DEFAULT_SIZE_CLASS ? cache_message_size >> (DEFAULT_SIZE_CLASS - i)
+                                                     : cache_message_size << (i - DEFAULT_SIZE_CLASS);
+
+        message_size = std::max(message_size, CachedSpan::cache_offset() + CACHE_LINE_SIZE);
+
+        m_caches[i].reset(new SpanCache(message_size, cache_message_count, slab ? Slab::get(message_size, hugepage) : nullptr));
+    }
+
+    if (cache_flags & CACHE_PREWARM)
+    {
+        // the shapes are unknown yet, the new spans are taken from the default class
+        m_caches[DEFAULT_SIZE_CLASS]->prewarm(this, cache_message_count);
+    }
+}
+
+SpanCache &CachedTracer::size_class(size_t bytes)
 {
-    Span *span = m_cache.get();
+    if (!bytes)
+        return *m_caches[DEFAULT_SIZE_CLASS];
+
+    for (auto &cache : m_caches)
+    {
+        if (cache->message_size() - CachedSpan::cache_offset() >= bytes * 2)
+            return *cache;
+    }
+
+    return *m_caches[SIZE_CLASSES - 1];
+}
+
+namespace __impl
+{
+
+// a root span starts unsampled, so it doesn't read the clock before the sampling decision,
+// a child of a parent id is recorded, its parent was sampled by the caller
+
+static inline bool is_root(span_id_t parent_id) { return parent_id == 0; }
+
+static inline bool is_root(const SpanContext &) { return false; }
+
+static inline void reset_span(Span *span, string_view name, span_id_t parent_id, userdata_t userdata)
+{
+    span->reset(name, parent_id, userdata, !is_root(parent_id));
+}
+
+static inline void reset_span(Span *span, string_view name, const SpanContext &parent, userdata_t userdata)
+{
+    span->reset(name, parent, userdata);
+}
+
+static inline Span *new_cached_span(SpanCache &cache, Tracer *tracer, string_view name, span_id_t parent_id, userdata_t userdata)
+{
+    return new (&cache) CachedSpan(&cache, tracer, name, parent_id, userdata, !is_root(parent_id));
+}
+
+static inline Span *new_cached_span(SpanCache &cache, Tracer *tracer, string_view name, const SpanContext &parent, userdata_t userdata)
+{
+    return new (&cache) CachedSpan(&cache, tracer, name, parent, userdata);
+}
+
+} // namespace __impl
+
+template <typename Context>
+Span *CachedTracer::new_span(string_view name, const Context &parent, userdata_t userdata)
+{
+    size_t bytes = m_shapes.reserve_size(name);
+    SpanCache &cache = size_class(bytes);
+    Span *span = cache.get();
 
     if (span)
     {
-        span->reset(name, parent_id, userdata);
+        __impl::reset_span(span, name, parent, userdata);
 
-        VLOG(2) << "Span @ " << span << " reused, id=" << std::hex << span->id();
+        VLOG(2) << "Span @ " << span << " reused, id=" << std::hex << span->id() << ", parent_id=" << span->parent_id();
     }
     else
     {
-        span = new (this) CachedSpan(this, name, parent_id, userdata);
+        span = __impl::new_cached_span(cache, this, name, parent, userdata);
+
+        if (!span)
+        {
+            LOG_EVERY_N(WARNING, 1000) << "fail to allocate span `" << name << "`";
+
+            return nullptr;
+        }
+    }
+
+    if (__impl::is_root(parent))
+    {
+        // the trace is sampled once at its root span, the children inherit the decision from their context
+        span->with_sampled(m_sampler.load(std::memory_order_acquire)->sample(span->trace_id(), name));
+    }
+
+    if (TailSampler *tail_sampler = m_tail_sampler.load(std::memory_order_acquire))
+    {
+        // record all the spans locally, the propagated decision stays the head one, kept with the buffered trace
+        tail_sampler->start(span, span->sampled());
+
+        span->with_recorded();
+        static_cast<CachedSpan *>(span)->m_tail_pending = true;
+    }
+
+    if (DependencyLinker *linker = m_dependency_linker.load(std::memory_order_acquire))
+    {
+        // the services of the RPC annotations are only kept for a linker
+        span->with_dependency_linker(linker);
+    }
+
+    if (!span->recording() && m_metrics.load(std::memory_order_relaxed))
+    {
+        // the metrics measure the duration of all the spans
+        span->start_timer();
     }
 
-    span->with_sampled(m_total_spans++ % m_sample_rate == 0);
+    // an unsampled span records nothing, it is a handle of the trace context
+    if (bytes && span->recording())
+    {
+        span->arena().reserve(bytes);
+    }
 
     return span;
 }
 
+Span *CachedTracer::span(string_view name, span_id_t parent_id, void *userdata)
+{
+    return new_span(name, parent_id, userdata);
+}
+
+Span *CachedTracer::span(string_view name, const SpanContext &parent, userdata_t userdata)
+{
+    return new_span(name, parent, userdata);
+}
+
 void CachedTracer::submit(Span *span)
 {
-    if (m_collector && (span->sampled() || span->debug()))
+    if (SpanMetrics *metrics = m_metrics.load(std::memory_order_acquire))
+        metrics->record(*span);
+
+    if (DependencyLinker *linker = m_dependency_linker.load(std::memory_order_acquire))
+        linker->record(*span);
+
+    if (!span->recording())
+    {
+        // nothing to report, the tracer owns the submitted span
+        release(span);
+    }
+    else if (span->cached() && span->cached()->m_tail_pending)
+    {
+        span->cached()->m_tail_pending = false;
+
+        TailSampler *tail_sampler = m_tail_sampler.load(std::memory_order_acquire);
+
+        VLOG(2) << "Span @ " << span << " buffered in tail sampler @ " << tail_sampler << ", id=" << span->id();
+
+        tail_sampler->finish(span);
+    }
+    else if (m_collector)
     {
         VLOG(2) << "Span @ " << span << " submited to collector @ " << m_collector << ", id=" << span->id();
 
@@ -47,7 +735,68 @@ void CachedTracer::release(Span *span)
 {
     VLOG(2) << "Span @ " << span << " released to tracer @ " << this << ", id=" << span->id();
 
-    m_cache.release(static_cast<CachedSpan *>(span));
+    if (span->recording())
+        m_shapes.record(*span);
+
+    CachedSpan *cached = static_cast<CachedSpan *>(span);
+
+    discard(cached);
+
+    if (cached->cache())
+    {
+        cached->cache()->release(cached);
+    }
+    else
+    {
+        delete cached;
+    }
+}
+
+void CachedTracer::release(Span *const *spans, size_t count)
+{
+    CachedSpan *batches[SIZE_CLASSES][SpanCache::BATCH_SIZE];
+    size_t sizes[SIZE_CLASSES] = {0};
+
+    for (size_t i = 0; i < count; i++)
+    {
+        Span *span = spans[i];
+        CachedSpan *cached = span->tracer() == this ? span->cached() : nullptr;
+        size_t size_class = 0;
+
+        while (cached && size_class < SIZE_CLASSES && m_caches[size_class].get() != cached->cache())
+        {
+            size_class++;
+        }
+
+        if (!cached || size_class == SIZE_CLASSES)
+        {
+            span->release();
+            continue;
+        }
+
+        if (span->recording())
+            m_shapes.record(*span);
+
+        discard(cached);
+
+        batches[size_class][sizes[size_class]++] = cached;
+
+        if (sizes[size_class] == SpanCache::BATCH_SIZE)
+        {
+            m_caches[size_class]->release(batches[size_class], sizes[size_class]);
+            sizes[size_class] = 0;
+        }
+    }
+
+    for (size_t i = 0; i < SIZE_CLASSES; i++)
+    {
+        if (sizes[i])
+        {
+            m_caches[i]->release(batches[i], sizes[i]);
+        }
+    }
+
+    VLOG(2) << count << " spans released to tracer @ " << this;
 }
 
-} // namespace zipkin
\ No newline at end of file
+} // namespace zipkin
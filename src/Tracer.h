@@ -3,10 +3,19 @@
 #include <cstddef>
 #include <string>
 #include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <chrono>
+#include <memory>
 
 #include <boost/lockfree/stack.hpp>
 
 #include "Span.h"
+#include "SpanShape.h"
+#include "Sampler.h"
+#include "TailSampler.h"
+#include "SpanMetrics.h"
+#include "DependencyLinker.h"
 #include "Collector.h"
 
 namespace zipkin
@@ -24,9 +33,23 @@ struct Tracer
     */
     virtual size_t sample_rate(void) const = 0;
 
-    /** \sa Tracer#sample_rate */
+    /**
+    * \brief Sample one of every \p sample_rate traces
+    *
+    * It replaces the associated Sampler with a CountingSampler of the tracer.
+    */
     virtual void set_sample_rate(size_t sample_rate) = 0;
 
+    /**
+     * \brief Associated Sampler, which decides whether a new trace is recorded
+     *
+     * \sa Sampler#always
+     */
+    virtual Sampler *sampler(void) const = 0;
+
+    /** \sa Tracer#sampler */
+    virtual void set_sampler(Sampler *sampler) = 0;
+
     /**
      * \brief Associated user data
      */
@@ -40,13 +63,45 @@ struct Tracer
      */
     virtual Collector *collector(void) const = 0;
 
+    /**
+     * \brief Associated IdGenerator
+     *
+     * \sa IdGenerator#random
+     */
+    virtual IdGenerator *id_generator(void) const = 0;
+
+    /** \sa Tracer#id_generator */
+    virtual void set_id_generator(IdGenerator *id_generator) = 0;
+
+    /**
+     * \brief Associated Clock
+     *
+     * \sa Clock#precise
+     */
+    virtual Clock *clock(void) const = 0;
+
+    /** \sa Tracer#clock */
+    virtual void set_clock(Clock *clock) = 0;
+
     /**
      * \brief Create new Span belongs to the Tracer
      *
      * First, CachedTracer will try to get a Span from internal cache instead of allocate it.
      * It is multi-thread safe since the internal cache base on the lock free stack.
+     *
+     * \return nullptr when the Span can't be allocated
+     */
+    virtual Span *span(string_view name, span_id_t parent_id = 0, userdata_t userdata = nullptr) = 0;
+
+    /**
+     * \brief Create a child Span of the parent context
+     *
+     * The trace identifiers and sampling decision are inherited from the parent,
+     * so only the span id is generated.
+     *
+     * \return nullptr when the Span can't be allocated
      */
-    virtual Span *span(const std::string &name, span_id_t parent_id = 0, userdata_t userdata = nullptr) = 0;
+    virtual Span *span(string_view name, const SpanContext &parent, userdata_t userdata = nullptr) = 0;
 
     /**
      * \brief Submit a Span to the associated Collector
@@ -65,6 +120,19 @@ struct Tracer
      */
     virtual void release(Span *span) = 0;
 
+    /**
+     * \brief Release a batch of Spans of the Tracer at once.
+     *
+     * Collectors release the spans of a sent message with it, so the cached spans are returned in batches.
+     */
+    virtual void release(Span *const *spans, size_t count)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            release(spans[i]);
+        }
+    }
+
     /**
      * \brief Create a new Tracer.
      *
@@ -73,90 +141,330 @@ struct Tracer
     static Tracer *create(Collector *collector, size_t sample_rate = 1);
 };
 
+/**
+* \brief Cache of the spans of a CachedTracer, for one size class
+*
+* The spans are cached in two tiers. Each thread keeps a magazine of spans for the caches it uses,
+* so creating and releasing a span touches no shared cache line in the common case.
+* Magazines exchange batches of #BATCH_SIZE spans with a global lock-free stack, one CAS per batch.
+*
+* The global stack grows up to #GROWTH_LIMIT times its initial capacity when the cache runs out of spans,
+* and a background thread trims the spans which stayed idle for a whole #trim_interval.
+*/
 class SpanCache
 {
-    size_t m_message_size, m_message_capacity;
+  public:
+    static constexpr size_t BATCH_SIZE = 16;
+    static constexpr size_t MAX_THREAD_CACHES = 8;
+    static constexpr size_t GROWTH_LIMIT = 16;
 
-    boost::lockfree::stack<CachedSpan *> m_spans;
+    /**
+    * \brief Counters of a cache
+    */
+    struct Stats
+    {
+        size_t message_size; ///< bytes of a span, including the trailing buffer
+        size_t capacity;     ///< spans the global stack and the thread magazines may hold now
+        size_t cached;       ///< spans in the global stack
+        size_t magazined;    ///< spans in the thread magazines, as of the last trim
+        size_t hits;         ///< spans reused
+        size_t misses;       ///< spans allocated
+        size_t trimmed;      ///< idle spans freed by the trimmer
+    };
 
-  public:
-    SpanCache(size_t message_size, size_t message_capacity)
-        : m_message_size(message_size), m_message_capacity(message_capacity), m_spans(message_capacity)
+  private:
+    struct Magazine
     {
-    }
+        SpanCache *cache = nullptr;
+        CachedSpan *spans = nullptr;
+        Magazine *next = nullptr; // registered magazines of the cache
+        size_t epoch = 0;         // the trim epoch seen by the owner thread
 
-    ~SpanCache() { purge_all(); }
+        // written by the owner thread only
+        std::atomic<size_t> size = ATOMIC_VAR_INIT(0);
+        std::atomic<size_t> hits = ATOMIC_VAR_INIT(0);
+        std::atomic<size_t> misses = ATOMIC_VAR_INIT(0);
+
+        // the spans counted against the capacity by the trimmer
+        std::atomic<size_t> counted = ATOMIC_VAR_INIT(0);
+    };
+
+    struct ThreadMagazines
+    {
+        Magazine slots[MAX_THREAD_CACHES];
+
+        ~ThreadMagazines();
+    };
+
+    size_t m_message_size, m_min_capacity, m_max_capacity;
+    Slab *m_slab;
+
+    boost::lockfree::stack<CachedSpan *> m_batches;
+
+    std::atomic<size_t> m_capacity, m_cached, m_low_watermark;
+    std::atomic<size_t> m_magazined = ATOMIC_VAR_INIT(0);
+    std::atomic<size_t> m_trim_epoch = ATOMIC_VAR_INIT(0);
+    std::atomic<size_t> m_prewarmed = ATOMIC_VAR_INIT(0);
+    std::atomic<bool> m_starved = ATOMIC_VAR_INIT(false);
+
+    std::atomic<size_t> m_hits = ATOMIC_VAR_INIT(0);
+    std::atomic<size_t> m_misses = ATOMIC_VAR_INIT(0);
+    std::atomic<size_t> m_trimmed = ATOMIC_VAR_INIT(0);
+
+    Magazine *m_magazines = nullptr;
+    SpanCache *m_next_cache = nullptr; // registered caches of the trimmer
+
+    static std::mutex &registry(void);
+
+    static ThreadMagazines &thread_magazines(void);
+
+    static void run_trimmer(void);
+
+    /**
+    * \brief The magazine of the current thread, nullptr when the thread uses too many caches
+    */
+    Magazine *magazine(void);
+
+    const Magazine *find_magazine(void) const;
+
+    /**
+    * \brief Return the spans of the magazine to the global stack, on the first access of the owner thread after a trim
+    */
+    void drain(Magazine &mag);
+
+    /**
+    * \brief Forget the spans of the magazine which were counted against the capacity
+    */
+    void uncount(Magazine &mag);
+
+    /**
+    * \brief Push a list of spans to the global stack in batches
+    */
+    void return_spans(CachedSpan *spans);
+
+    size_t trim_locked(void);
+
+    CachedSpan *pop_batch(void);
+
+    void push_batch(CachedSpan *head);
+
+    static void delete_batch(CachedSpan *head);
+
+  public:
+    SpanCache(size_t message_size, size_t message_capacity, Slab *slab = nullptr);
+
+    ~SpanCache();
+
+    SpanCache(const SpanCache &) = delete;
+    SpanCache &operator=(const SpanCache &) = delete;
 
     size_t message_size(void) const { return m_message_size; }
 
-    size_t message_capacity(void) { return m_message_capacity; }
+    /**
+    * \brief The slab of the spans, nullptr when they are allocated on the heap
+    */
+    Slab *slab(void) const { return m_slab; }
 
-    inline bool empty(void) const { return m_spans.empty(); }
+    size_t message_capacity(void) const { return m_capacity.load(std::memory_order_relaxed); }
 
-    inline void purge_all(void)
-    {
-        m_spans.consume_all([](CachedSpan *span) -> void { delete span; });
-    }
+    /**
+    * \brief No span could be reused by the current thread
+    */
+    bool empty(void) const;
 
-    inline CachedSpan *get(void)
-    {
-        CachedSpan *span = nullptr;
+    /**
+    * \brief Delete the spans of the global stack and all the magazines
+    *
+    * The cache must not be used by other threads meanwhile.
+    */
+    void purge_all(void);
 
-        return m_spans.pop(span) ? span : nullptr;
-    }
+    CachedSpan *get(void);
 
-    inline void release(CachedSpan *span)
-    {
-        if (!m_spans.bounded_push(span))
-        {
-            delete span;
-        }
-    }
+    void release(CachedSpan *span);
+
+    /**
+    * \brief Return the spans to the global stack in batches
+    */
+    void release(CachedSpan *const *spans, size_t count);
+
+    /**
+    * \brief Allocate \p count spans of the tracer into the global stack, the trimmer keeps them
+    */
+    void prewarm(Tracer *tracer, size_t count);
+
+    /**
+    * \brief Free the spans of the global stack which stayed idle since the last trim, and shrink the capacity
+    *
+    * The prewarmed spans are kept. The spans of the thread magazines are counted against the capacity,
+    * and each thread returns them to the global stack on its next access, so they are trimmed once idle.
+    *
+    * \return the number of the freed spans
+    */
+    size_t trim(void);
+
+    Stats stats(void) const;
+
+    /**
+    * \brief Interval of the background trimmer, zero disables it
+    */
+    static std::chrono::milliseconds trim_interval(void);
+
+    static void set_trim_interval(std::chrono::milliseconds interval);
+
+    static constexpr std::chrono::milliseconds DEFAULT_TRIM_INTERVAL = std::chrono::milliseconds(10000);
 };
 
 class CachedTracer : public Tracer
 {
     Collector *m_collector;
 
-    size_t m_sample_rate = 1;
-    std::atomic_size_t m_total_spans = ATOMIC_VAR_INIT(0);
+    CountingSampler m_counting_sampler;
+    std::atomic<Sampler *> m_sampler;
+    std::atomic<TailSampler *> m_tail_sampler;
+    std::atomic<SpanMetrics *> m_metrics;
+    std::atomic<DependencyLinker *> m_dependency_linker;
 
     userdata_t m_userdata = nullptr;
 
+    IdGenerator *m_id_generator = IdGenerator::random();
+
+    Clock *m_clock = Clock::precise();
+
+  public:
+    static constexpr size_t CACHE_LINE_SIZE = 64;
+    static constexpr size_t DEFAULT_CACHE_MESSAGE_SIZE = 4096;
+    static constexpr size_t DEFAULT_CACHE_MESSAGE_COUNT = 64;
+
+    /**
+    * \brief Number of the span size classes, from 1/4 to 4 times of the default message size
+    */
+    static constexpr size_t SIZE_CLASSES = 5;
+    static constexpr size_t DEFAULT_SIZE_CLASS = 2;
+
+    /**
+    * \brief Allocation options of the span caches
+    */
+    enum CacheFlags
+    {
+        CACHE_SLAB = 1,     ///< carve the spans out of the shared slabs instead of the heap
+        CACHE_HUGEPAGE = 2, ///< back the slabs with the huge pages when available, implies #CACHE_SLAB
+        CACHE_PREWARM = 4,  ///< fill the cache of the default size class at the construction
+    };
+
   private:
-    SpanCache m_cache;
+    std::unique_ptr<SpanCache> m_caches[SIZE_CLASSES];
+    SpanShapes m_shapes;
+
+    /**
+    * \brief The smallest class which could hold the Arena and the encoded message of the p95 bytes
+    */
+    SpanCache &size_class(size_t bytes);
+
+    template <typename Context>
+    Span *new_span(string_view name, const Context &parent, userdata_t userdata);
+
+    /**
+    * \brief Tell the tail sampler a span was released before it was submitted
+    */
+    void discard(CachedSpan *span);
 
   public:
     CachedTracer(Collector *collector,
                  size_t sample_rate = 1,
                  size_t cache_message_size = DEFAULT_CACHE_MESSAGE_SIZE,
-                 size_t cache_message_count = DEFAULT_CACHE_MESSAGE_COUNT)
-        : m_collector(collector), m_sample_rate(sample_rate),
-          m_cache(cache_message_size, cache_message_count)
+                 size_t cache_message_count = DEFAULT_CACHE_MESSAGE_COUNT,
+                 unsigned cache_flags = 0);
+
+    /**
+    * \brief The cache of the default size class
+    */
+    const SpanCache &cache(void) const { return *m_caches[DEFAULT_SIZE_CLASS]; }
+
+    SpanCache &cache(void) { return *m_caches[DEFAULT_SIZE_CLASS]; }
+
+    /**
+    * \brief The cache of a size class, in the ascending order of the message size
+    */
+    const SpanCache &cache(size_t size_class) const { return *m_caches[size_class]; }
+
+    /**
+    * \brief The observed shapes of the spans, a new span is pre-sized to the p95 bytes of its name
+    */
+    const SpanShapes &shapes(void) const { return m_shapes; }
+
+    SpanShapes &shapes(void) { return m_shapes; }
+
+    // Implement Tracer
+
+    virtual size_t sample_rate(void) const override { return m_counting_sampler.sample_rate(); }
+    virtual void set_sample_rate(size_t sample_rate) override
     {
+        m_counting_sampler.set_sample_rate(sample_rate);
+        m_sampler.store(&m_counting_sampler, std::memory_order_release);
     }
 
-    static constexpr size_t CACHE_LINE_SIZE = 64;
-    static constexpr size_t DEFAULT_CACHE_MESSAGE_SIZE = 4096;
-    static constexpr size_t DEFAULT_CACHE_MESSAGE_COUNT = 64;
+    virtual Sampler *sampler(void) const override { return m_sampler.load(std::memory_order_acquire); }
+    virtual void set_sampler(Sampler *sampler) override { m_sampler.store(sampler ? sampler : &m_counting_sampler, std::memory_order_release); }
 
-    const SpanCache &cache(void) const { return m_cache; }
+    /**
+    * \brief The tail sampler which buffers the traces, nullptr when the spans are reported on submit
+    */
+    TailSampler *tail_sampler(void) const { return m_tail_sampler.load(std::memory_order_acquire); }
 
-    // Implement Tracer
+    /**
+    * \brief Buffer the traces in a tail sampler, which decides to report them when their local spans finished
+    *
+    * The spans are recorded locally regardless of the head sampling decision, which is still the one propagated
+    * to the downstream services, see Span#with_recorded. The tracer doesn't own the tail sampler.
+    * Flush the tail sampler before it is unset.
+    */
+    void set_tail_sampler(TailSampler *tail_sampler) { m_tail_sampler.store(tail_sampler, std::memory_order_release); }
+
+    /**
+    * \brief The metrics of all the submitted spans, nullptr when disabled
+    */
+    SpanMetrics *metrics(void) const { return m_metrics.load(std::memory_order_acquire); }
+
+    /**
+    * \brief Record the rate, errors and duration of all the submitted spans, before the sampling drops them
+    *
+    * The spans which aren't recording still read the clock when they start and finish, the tracer doesn't own the metrics.
+    */
+    void set_metrics(SpanMetrics *metrics) { m_metrics.store(metrics, std::memory_order_release); }
 
-    virtual size_t sample_rate(void) const override { return m_sample_rate; }
-    virtual void set_sample_rate(size_t sample_rate) override { m_sample_rate = sample_rate; }
+    /**
+    * \brief The service dependency links of all the submitted spans, nullptr when disabled
+    */
+    DependencyLinker *dependency_linker(void) const { return m_dependency_linker.load(std::memory_order_acquire); }
+
+    /**
+    * \brief Link the services of all the submitted spans, before the sampling drops them
+    *
+    * The tracer doesn't own the dependency linker.
+    */
+    void set_dependency_linker(DependencyLinker *linker) { m_dependency_linker.store(linker, std::memory_order_release); }
 
     virtual userdata_t userdata(void) const override { return m_userdata; }
     virtual void set_userdata(userdata_t userdata) override { m_userdata = userdata; }
 
     virtual Collector *collector(void) const override { return m_collector; }
 
-    virtual Span *span(const std::string &name, span_id_t parent_id = 0, void *userdata = nullptr) override;
+    virtual IdGenerator *id_generator(void) const override { return m_id_generator; }
+    virtual void set_id_generator(IdGenerator *id_generator) override { m_id_generator = id_generator ? id_generator : IdGenerator::random(); }
+
+    virtual Clock *clock(void) const override { return m_clock; }
+    virtual void set_clock(Clock *clock) override { m_clock = clock ? clock : Clock::precise(); }
+
+    virtual Span *span(string_view name, span_id_t parent_id = 0, void *userdata = nullptr) override;
+
+    virtual Span *span(string_view name, const SpanContext &parent, userdata_t userdata = nullptr) override;
 
     virtual void submit(Span *span) override;
 
     virtual void release(Span *span) override;
+
+    virtual void release(Span *const *spans, size_t count) override;
 };
 
 } // namespace zipkin
@@ -9,6 +9,8 @@ namespace zipkin
 
 std::shared_ptr<XRayCodec> XRayConf::xray(new XRayCodec());
 
+constexpr size_t XRayConf::MAX_DATAGRAM_SIZE;
+
 size_t XRayCodec::encode(boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> buf, const std::vector<Span *> &spans)
 {
     rapidjson::StringBuffer buffer;
@@ -77,8 +79,17 @@ size_t XRayCodec::encode(boost::shared_ptr<apache::thrift::transport::TMemoryBuf
     return buffer.GetSize();
 }
 
+size_t XRayCodec::estimate(const Span *span) const
+{
+    // a segment has the ids, the times and the parent of the span, its annotations are not sent,
+    // the escaped characters of the name are longer than it
+    return 224 + span->name().size() + span->name().size() / 8;
+}
+
 XRayConf::XRayConf(folly::Uri &uri)
 {
+    max_message_bytes = MAX_DATAGRAM_SIZE;
+
     host = folly::toStdString(uri.host());
 
     if (uri.port())
@@ -102,6 +113,22 @@ XRayConf::XRayConf(folly::Uri &uri)
         {
             batch_interval = std::chrono::milliseconds(folly::to<size_t>(param.second));
         }
+        else if (param.first == "max_batch_bytes")
+        {
+            max_batch_bytes = folly::to<size_t>(param.second);
+        }
+        else if (param.first == "max_message_bytes")
+        {
+            max_message_bytes = folly::to<size_t>(param.second);
+        }
+        else if (param.first == "overflow_policy")
+        {
+            overflow_policy = parse_overflow_policy(param.second);
+        }
+        else if (param.first == "block_timeout")
+        {
+            block_timeout = std::chrono::milliseconds(folly::to<size_t>(param.second));
+        }
     }
 
     message_codec = XRayConf::xray;
@@ -25,12 +25,19 @@ class XRayCodec : public MessageCodec
     virtual const std::string mime_type(void) const override { return "application/json"; }
 
     virtual size_t encode(boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> buf, const std::vector<Span *> &spans) override;
+
+    virtual size_t estimate(const Span *span) const override;
 };
 
 struct XRayConf : public BaseConf
 {
     static std::shared_ptr<XRayCodec> xray;
 
+    /**
+    * \brief the maximum UDP datagram sent to the X-Ray daemon
+    */
+    static constexpr size_t MAX_DATAGRAM_SIZE = 64 * 1024 - 512;
+
     /**
     * \breif the X-Ray daemon hostname
     */
@@ -44,6 +51,7 @@ struct XRayConf : public BaseConf
     XRayConf(const std::string &h, port_t p = 2000) : host(h), port(p)
     {
         message_codec = XRayConf::xray;
+        max_message_bytes = MAX_DATAGRAM_SIZE;
     }
 
     XRayConf(folly::Uri &uri);
@@ -19,13 +19,27 @@ public:
 
   MOCK_METHOD1(set_sample_rate, void(size_t sample_rate));
 
+  MOCK_CONST_METHOD0(sampler, zipkin::Sampler *(void));
+
+  MOCK_METHOD1(set_sampler, void(zipkin::Sampler *sampler));
+
   MOCK_CONST_METHOD0(userdata, userdata_t(void));
 
   MOCK_METHOD1(set_userdata, void(userdata_t userdata));
 
   MOCK_CONST_METHOD0(collector, zipkin::Collector *(void));
 
-  MOCK_METHOD3(span, zipkin::Span *(const std::string &, span_id_t, userdata_t));
+  MOCK_CONST_METHOD0(id_generator, zipkin::IdGenerator *(void));
+
+  MOCK_METHOD1(set_id_generator, void(zipkin::IdGenerator *id_generator));
+
+  MOCK_CONST_METHOD0(clock, zipkin::Clock *(void));
+
+  MOCK_METHOD1(set_clock, void(zipkin::Clock *clock));
+
+  MOCK_METHOD3(span, zipkin::Span *(zipkin::string_view, span_id_t, userdata_t));
+
+  MOCK_METHOD3(span, zipkin::Span *(zipkin::string_view, const zipkin::SpanContext &, userdata_t));
 
   MOCK_METHOD1(submit, void(zipkin::Span *));
 
@@ -42,6 +56,8 @@ public:
   MOCK_METHOD1(flush, bool(std::chrono::milliseconds timeout_ms));
 
   MOCK_METHOD1(shutdown, void(std::chrono::milliseconds timeout_ms));
+
+  MOCK_CONST_METHOD0(dropped_spans, size_t(void));
 };
 
 class MockProducer : public RdKafka::Producer
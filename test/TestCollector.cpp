@@ -35,4 +35,572 @@ TEST(collector, submit)
     collector.submit(span);
 
     collector.shutdown(std::chrono::milliseconds(0));
-}
\ No newline at end of file
+}
+class TestCollector : public zipkin::BaseCollector
+{
+  public:
+    std::atomic_size_t messages = ATOMIC_VAR_INIT(0);
+    std::vector<size_t> sizes;
+
+    TestCollector(zipkin::BaseConf *conf) : BaseCollector(conf) {}
+
+    virtual const char *name(void) const override { return "test"; }
+
+    virtual void send_message(const uint8_t *msg, size_t size) override
+    {
+        sizes.push_back(size);
+        messages++;
+    }
+};
+
+TEST(collector, ring)
+{
+    zipkin::BaseConf *conf = new zipkin::BaseConf();
+
+    conf->batch_size = 4;
+    conf->backlog = 8;
+    conf->batch_interval = std::chrono::seconds(10);
+    conf->thread_batch_size = 1;
+
+    TestCollector collector(conf);
+
+    std::unique_ptr<zipkin::Tracer> tracer(zipkin::Tracer::create(&collector));
+
+    // a partial batch waits for the batch interval
+    collector.submit(tracer->span("test"));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    ASSERT_EQ(collector.queued_spans(), 1);
+    ASSERT_EQ(collector.messages, 0);
+
+    // a full batch wakes up the collector thread
+    for (int i = 0; i < 3; i++)
+    {
+        collector.submit(tracer->span("test"));
+    }
+
+    for (int i = 0; i < 100 && !collector.messages; i++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    ASSERT_EQ(collector.messages, 1);
+    ASSERT_EQ(collector.queued_spans(), 0);
+
+    ASSERT_TRUE(collector.flush(std::chrono::seconds(1)));
+    ASSERT_EQ(collector.messages, 1);
+
+    collector.shutdown(std::chrono::seconds(1));
+
+    // the spans exceed the backlog are dropped after the collector thread terminated
+    for (int i = 0; i < 10; i++)
+    {
+        collector.submit(tracer->span("test"));
+    }
+
+    ASSERT_EQ(collector.queued_spans(), 8);
+    ASSERT_EQ(collector.dropped_spans(), 2);
+}
+
+TEST(collector, thread_batch)
+{
+    zipkin::BaseConf *conf = new zipkin::BaseConf();
+
+    conf->batch_size = 100;
+    conf->batch_interval = std::chrono::seconds(10);
+    conf->thread_batch_size = 4;
+    conf->thread_batch_age = std::chrono::seconds(10);
+
+    TestCollector collector(conf);
+
+    std::unique_ptr<zipkin::Tracer> tracer(zipkin::Tracer::create(&collector));
+
+    // the spans are buffered by the thread until the batch is full
+    for (int i = 0; i < 3; i++)
+    {
+        collector.submit(tracer->span("test"));
+    }
+
+    ASSERT_EQ(collector.queued_spans(), 0);
+
+    collector.submit(tracer->span("test"));
+
+    ASSERT_EQ(collector.queued_spans(), 4);
+
+    // handed over on flush
+    collector.submit(tracer->span("test"));
+
+    ASSERT_EQ(collector.queued_spans(), 4);
+    ASSERT_TRUE(collector.flush(std::chrono::seconds(1)));
+    ASSERT_EQ(collector.queued_spans(), 0);
+    ASSERT_EQ(collector.messages, 1);
+
+    // handed over at the thread exit
+    std::thread([&] {
+        collector.submit(tracer->span("test"));
+        collector.submit(tracer->span("test"));
+    }).join();
+
+    ASSERT_EQ(collector.queued_spans(), 2);
+
+    collector.shutdown(std::chrono::seconds(1));
+
+    ASSERT_EQ(collector.queued_spans(), 0);
+    ASSERT_EQ(collector.messages, 2);
+}
+
+class SpanCountingCodec : public zipkin::BinaryCodec
+{
+  public:
+    std::atomic<size_t> spans{0};
+
+    virtual size_t encode(boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> buf, const std::vector<zipkin::Span *> &spans) override
+    {
+        this->spans += spans.size();
+
+        return zipkin::BinaryCodec::encode(buf, spans);
+    }
+};
+
+TEST(collector, thread_batch_hand_over)
+{
+    SpanCountingCodec *codec = new SpanCountingCodec();
+    zipkin::BaseConf *conf = new zipkin::BaseConf();
+
+    conf->message_codec.reset(codec);
+
+    conf->backlog = 1 << 16;
+    conf->batch_size = 100;
+    conf->batch_interval = std::chrono::milliseconds(1);
+    conf->thread_batch_size = 8;
+    conf->thread_batch_age = std::chrono::seconds(10);
+
+    TestCollector collector(conf);
+
+    std::unique_ptr<zipkin::Tracer> tracer(zipkin::Tracer::create(&collector));
+    std::atomic_bool stopped(false);
+
+    // the collector thread and the flushes take the batches while the threads submit
+    std::thread flusher([&] {
+        while (!stopped)
+            collector.flush(std::chrono::milliseconds(1));
+    });
+
+    std::vector<std::thread> threads;
+
+    for (int i = 0; i < 4; i++)
+    {
+        threads.emplace_back([&] {
+            for (int j = 0; j < 10000; j++)
+                collector.submit(tracer->span("test"));
+        });
+    }
+
+    for (auto &thread : threads)
+        thread.join();
+
+    stopped = true;
+    flusher.join();
+
+    ASSERT_TRUE(collector.flush(std::chrono::seconds(1)));
+    ASSERT_EQ(collector.queued_spans(), 0);
+    ASSERT_EQ(collector.dropped_spans(), 0);
+    ASSERT_EQ(codec->spans, 40000);
+
+    collector.shutdown(std::chrono::seconds(1));
+}
+
+class BlockingCollector : public TestCollector
+{
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    bool m_blocked = true;
+
+  public:
+    std::atomic_size_t sending = ATOMIC_VAR_INIT(0);
+
+    BlockingCollector(zipkin::BaseConf *conf) : TestCollector(conf) {}
+
+    void unblock(void)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        m_blocked = false;
+        m_cond.notify_all();
+    }
+
+    virtual void send_message(const uint8_t *msg, size_t size) override
+    {
+        sending++;
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        m_cond.wait(lock, [this] { return !m_blocked; });
+
+        messages++;
+    }
+};
+
+template <typename Predicate>
+static bool wait_until(Predicate pred)
+{
+    for (int i = 0; i < 100 && !pred(); i++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    return pred();
+}
+
+TEST(collector, pipeline)
+{
+    zipkin::BaseConf *conf = new zipkin::BaseConf();
+
+    conf->batch_size = 4;
+    conf->batch_interval = std::chrono::seconds(10);
+    conf->thread_batch_size = 1;
+
+    BlockingCollector collector(conf);
+
+    std::unique_ptr<zipkin::Tracer> tracer(zipkin::Tracer::create(&collector));
+
+    auto submit_batch = [&] {
+        for (int i = 0; i < 4; i++)
+        {
+            collector.submit(tracer->span("test"));
+        }
+    };
+
+    submit_batch();
+
+    ASSERT_TRUE(wait_until([&] { return collector.sending == 1; }));
+
+    // encoded while the first message is being sent
+    submit_batch();
+
+    ASSERT_TRUE(wait_until([&] { return collector.queued_spans() == 0; }));
+
+    // encoded and waiting for the pending message
+    submit_batch();
+
+    ASSERT_TRUE(wait_until([&] { return collector.queued_spans() == 0; }));
+
+    // the collector thread is blocked by the full sending stage
+    submit_batch();
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    ASSERT_EQ(collector.queued_spans(), 4);
+    ASSERT_EQ(collector.sending, 1);
+    ASSERT_FALSE(collector.flush(std::chrono::milliseconds(10)));
+
+    collector.unblock();
+
+    ASSERT_TRUE(collector.flush(std::chrono::seconds(1)));
+    ASSERT_EQ(collector.messages, 4);
+
+    collector.shutdown(std::chrono::seconds(1));
+}
+
+class ConcurrentCodec : public zipkin::BinaryCodec
+{
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    size_t m_active = 0;
+
+  public:
+    size_t expected, max_active = 0;
+
+    ConcurrentCodec(size_t expected) : expected(expected) {}
+
+    virtual size_t encode(boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> buf, const std::vector<zipkin::Span *> &spans) override
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+
+            max_active = std::max(max_active, ++m_active);
+
+            // hold the batch until the expected encoders are busy, or give up
+            m_cond.notify_all();
+            m_cond.wait_for(lock, std::chrono::milliseconds(200), [this] { return m_active >= expected; });
+
+            m_active--;
+        }
+
+        return zipkin::BinaryCodec::encode(buf, spans);
+    }
+};
+
+TEST(collector, encode_threads)
+{
+    ConcurrentCodec *codec = new ConcurrentCodec(3);
+    zipkin::BaseConf *conf = new zipkin::BaseConf();
+
+    conf->message_codec.reset(codec);
+    conf->batch_size = 1;
+    conf->batch_interval = std::chrono::seconds(10);
+    conf->thread_batch_size = 1;
+    conf->encode_threads = 3;
+
+    TestCollector collector(conf);
+
+    std::unique_ptr<zipkin::Tracer> tracer(zipkin::Tracer::create(&collector));
+
+    // each span is a batch, encoded by as many threads as configured
+    for (int i = 0; i < 6; i++)
+    {
+        collector.submit(tracer->span("test"));
+    }
+
+    ASSERT_TRUE(collector.flush(std::chrono::seconds(5)));
+    ASSERT_EQ(codec->max_active, 3);
+    ASSERT_EQ(collector.messages, 6);
+
+    collector.shutdown(std::chrono::seconds(1));
+}
+
+class UnderestimatingCodec : public zipkin::BinaryCodec
+{
+  public:
+    virtual size_t estimate(const zipkin::Span *span) const override { return 1; }
+};
+
+class CountingCodec : public zipkin::BinaryCodec
+{
+  public:
+    mutable std::atomic<size_t> estimates{0};
+
+    virtual size_t estimate(const zipkin::Span *span) const override
+    {
+        estimates++;
+
+        return zipkin::BinaryCodec::estimate(span);
+    }
+};
+
+TEST(collector, max_bytes)
+{
+    std::unique_ptr<zipkin::Tracer> tracer(zipkin::Tracer::create(nullptr));
+    zipkin::Span *span = tracer->span("test");
+
+    span->annotate("key", "value");
+
+    size_t estimated = zipkin::MessageCodec::binary->estimate(span);
+    boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> buf(new apache::thrift::transport::TMemoryBuffer());
+
+    ASSERT_GE(estimated, zipkin::MessageCodec::binary->encode(buf, {span}));
+    ASSERT_GE(zipkin::MessageCodec::json->estimate(span), zipkin::MessageCodec::json->encode(buf, {span}));
+
+    span->release();
+
+    // a batch is closed before its estimated bytes exceed the max message bytes
+    zipkin::BaseConf *conf = new zipkin::BaseConf();
+
+    conf->batch_interval = std::chrono::seconds(10);
+    conf->thread_batch_size = 1;
+    conf->max_message_bytes = estimated * 3;
+
+    TestCollector collector(conf);
+
+    for (int i = 0; i < 10; i++)
+    {
+        span = tracer->span("test");
+        span->annotate("key", "value");
+        collector.submit(span);
+    }
+
+    ASSERT_TRUE(collector.flush(std::chrono::seconds(1)));
+    ASSERT_EQ(collector.messages, 4);
+
+    for (size_t size : collector.sizes)
+    {
+        ASSERT_LE(size, conf->max_message_bytes);
+    }
+
+    // a span exceeds the max message bytes is dropped
+    span = tracer->span("test");
+    span->annotate("key", std::string(conf->max_message_bytes, 'x'));
+    collector.submit(span);
+
+    ASSERT_TRUE(collector.flush(std::chrono::seconds(1)));
+    ASSERT_EQ(collector.messages, 4);
+    ASSERT_EQ(collector.dropped_spans(), 1);
+
+    collector.shutdown(std::chrono::seconds(1));
+
+    // the messages are split when the estimates missed
+    conf = new zipkin::BaseConf();
+
+    conf->message_codec.reset(new UnderestimatingCodec());
+    conf->batch_interval = std::chrono::seconds(10);
+    conf->thread_batch_size = 1;
+    conf->max_message_bytes = estimated * 3;
+
+    TestCollector splitting(conf);
+
+    for (int i = 0; i < 8; i++)
+    {
+        span = tracer->span("test");
+        span->annotate("key", "value");
+        splitting.submit(span);
+    }
+
+    ASSERT_TRUE(splitting.flush(std::chrono::seconds(1)));
+    ASSERT_EQ(splitting.messages, 4);
+    ASSERT_EQ(splitting.dropped_spans(), 0);
+
+    splitting.shutdown(std::chrono::seconds(1));
+
+    // the collector thread is woken up when the estimated bytes reach the max batch bytes
+    CountingCodec *codec = new CountingCodec();
+
+    conf = new zipkin::BaseConf();
+
+    conf->message_codec.reset(codec);
+    conf->batch_interval = std::chrono::seconds(10);
+    conf->thread_batch_size = 1;
+    conf->max_batch_bytes = estimated * 2;
+
+    TestCollector budgeted(conf);
+
+    for (int i = 0; i < 2; i++)
+    {
+        span = tracer->span("test");
+        span->annotate("key", "value");
+        budgeted.submit(span);
+    }
+
+    ASSERT_TRUE(wait_until([&] { return budgeted.messages == 1; }));
+
+    // the spans are estimated once, at submit
+    ASSERT_EQ(codec->estimates, 2);
+
+    budgeted.shutdown(std::chrono::seconds(1));
+}
+
+TEST(collector, overflow)
+{
+    auto overflow_conf = [](zipkin::BaseConf::OverflowPolicy policy) {
+        zipkin::BaseConf *conf = new zipkin::BaseConf();
+
+        conf->backlog = 8;
+        conf->batch_size = 4;
+        conf->thread_batch_size = 1;
+        conf->overflow_policy = policy;
+
+        return conf;
+    };
+
+    // the collector threads are terminated, the backlog stays full
+    {
+        TestCollector newest(overflow_conf(zipkin::BaseConf::DROP_NEWEST));
+        std::unique_ptr<zipkin::Tracer> tracer(zipkin::Tracer::create(&newest));
+
+        newest.shutdown(std::chrono::seconds(1));
+
+        for (int i = 0; i < 10; i++)
+        {
+            newest.submit(tracer->span("test"));
+        }
+
+        ASSERT_EQ(newest.queued_spans(), 8);
+        ASSERT_EQ(newest.drops().backlog, 2);
+        ASSERT_EQ(newest.dropped_spans(), 2);
+    }
+
+    {
+        TestCollector oldest(overflow_conf(zipkin::BaseConf::DROP_OLDEST));
+        std::unique_ptr<zipkin::Tracer> tracer(zipkin::Tracer::create(&oldest));
+
+        oldest.shutdown(std::chrono::seconds(1));
+
+        for (int i = 0; i < 10; i++)
+        {
+            oldest.submit(tracer->span("test"));
+        }
+
+        ASSERT_EQ(oldest.queued_spans(), 8);
+        ASSERT_EQ(oldest.drops().evicted, 2);
+        ASSERT_EQ(oldest.drops().backlog, 0);
+    }
+
+    {
+        zipkin::BaseConf *conf = overflow_conf(zipkin::BaseConf::SHED);
+
+        conf->shed_threshold = 0.5;
+
+        TestCollector shed(conf);
+        std::unique_ptr<zipkin::Tracer> tracer(zipkin::Tracer::create(&shed));
+
+        shed.shutdown(std::chrono::seconds(1));
+
+        // nothing is shed below the threshold, everything at the full backlog
+        for (int i = 0; i < 4; i++)
+        {
+            shed.submit(tracer->span("test"));
+        }
+
+        ASSERT_EQ(shed.dropped_spans(), 0);
+
+        for (int i = 0; i < 100; i++)
+        {
+            shed.submit(tracer->span("test"));
+        }
+
+        ASSERT_EQ(shed.queued_spans(), 8);
+        ASSERT_EQ(shed.drops().shed, 96);
+        ASSERT_EQ(shed.drops().backlog, 0);
+    }
+
+    // the collector thread is blocked by the full sending stage
+    zipkin::BaseConf *conf = overflow_conf(zipkin::BaseConf::BLOCK);
+
+    conf->backlog = 4;
+    conf->batch_interval = std::chrono::seconds(10);
+    conf->block_timeout = std::chrono::milliseconds(50);
+
+    BlockingCollector collector(conf);
+    std::unique_ptr<zipkin::Tracer> tracer(zipkin::Tracer::create(&collector));
+
+    for (int batch = 0; batch < 3; batch++)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            collector.submit(tracer->span("test"));
+        }
+
+        ASSERT_TRUE(wait_until([&] { return collector.queued_spans() == 0; }));
+    }
+
+    for (int i = 0; i < 4; i++)
+    {
+        collector.submit(tracer->span("test"));
+    }
+
+    // waits for the block timeout, then drops the span
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    collector.submit(tracer->span("test"));
+
+    ASSERT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(50));
+    ASSERT_EQ(collector.drops().timeout, 1);
+
+    // waits until the collector thread takes the backlog
+    conf->block_timeout = std::chrono::seconds(10);
+
+    std::thread unblock([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+        collector.unblock();
+    });
+
+    collector.submit(tracer->span("test"));
+
+    unblock.join();
+
+    ASSERT_EQ(collector.dropped_spans(), 1);
+    ASSERT_TRUE(collector.flush(std::chrono::seconds(1)));
+
+    collector.shutdown(std::chrono::seconds(1));
+}
@@ -2,10 +2,15 @@
 
 #include <utility>
 
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
+
 #define RAPIDJSON_HAS_STDSTRING 1
 #include <rapidjson/stringbuffer.h>
 #include <rapidjson/prettywriter.h>
 
+#include "zipkin.h"
+
 TEST(endpoint, properties)
 {
     zipkin::Endpoint endpoint("test", "127.0.0.1", 80);
@@ -46,6 +51,57 @@ TEST(endpoint, with_addr)
     ASSERT_EQ(endpoint.port(), 8006);
 }
 
+TEST(endpoint, registry)
+{
+    zipkin::EndpointRegistry &registry = zipkin::EndpointRegistry::instance();
+
+    size_t size = registry.size();
+
+    const zipkin::Endpoint *endpoint = registry.acquire(zipkin::Endpoint("registry", "127.0.0.1", 80));
+
+    ASSERT_TRUE(endpoint->registered());
+    ASSERT_EQ(endpoint->service_name(), "registry");
+    ASSERT_EQ(registry.acquire(zipkin::Endpoint("registry", "127.0.0.1", 80)), endpoint);
+    ASSERT_NE(registry.acquire(zipkin::Endpoint("registry", "127.0.0.1", 81)), endpoint);
+    ASSERT_EQ(registry.size(), size + 2);
+
+    ASSERT_FALSE(zipkin::Endpoint(*endpoint).registered());
+
+    {
+        zipkin::Span span(nullptr, "test");
+
+        span.client_send(endpoint);
+        span.annotate("key", "value", endpoint);
+
+        registry.release(endpoint);
+        registry.release(endpoint);
+
+        ASSERT_EQ(registry.size(), size + 2);
+
+        boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> buf(new apache::thrift::transport::TMemoryBuffer());
+        apache::thrift::protocol::TBinaryProtocol protocol(buf);
+
+        span.serialize_binary(protocol);
+
+        std::string data = buf->getBufferAsString();
+
+        buf->resetBuffer();
+        span.message().write(&protocol);
+
+        ASSERT_EQ(data, buf->getBufferAsString());
+        ASSERT_EQ(span.message().annotations.back().host.service_name, "registry");
+    }
+
+    ASSERT_EQ(registry.size(), size + 1);
+
+    const zipkin::Endpoint *other = registry.acquire(zipkin::Endpoint("registry", "127.0.0.1", 81));
+
+    registry.release(other);
+    registry.release(other);
+
+    ASSERT_EQ(registry.size(), size);
+}
+
 TEST(span, properties)
 {
     MockTracer tracer;
@@ -78,7 +134,12 @@ TEST(span, child_span)
 
     span.with_debug(true).with_sampled(false);
 
-    zipkin::Span *child = span.span("child");
+    EXPECT_CALL(tracer, span(_, Matcher<const zipkin::SpanContext &>(_), _))
+        .WillOnce(Invoke([&tracer](zipkin::string_view name, const zipkin::SpanContext &parent, userdata_t userdata) {
+            return new zipkin::Span(&tracer, name, parent, userdata);
+        }));
+
+    std::unique_ptr<zipkin::Span> child(span.span("child"));
 
     ASSERT_TRUE(child);
 
@@ -106,8 +167,8 @@ TEST(span, submit)
 
     span.submit();
 
-    ASSERT_NE(msg.timestamp, 0);
-    ASSERT_NE(msg.duration, 0);
+    ASSERT_NE(span.message().timestamp, 0);
+    ASSERT_NE(span.message().duration, 0);
 }
 
 TEST(span, annotate)
@@ -120,9 +181,9 @@ TEST(span, annotate)
 
     span.client_send();
 
-    ASSERT_FALSE(msg.annotations.empty());
+    ASSERT_FALSE(span.message().annotations.empty());
 
-    const ::Annotation &annotation = msg.annotations.back();
+    const ::Annotation &annotation = span.message().annotations.back();
 
     ASSERT_EQ(annotation.value, g_zipkinCore_constants.CLIENT_SEND);
     ASSERT_NE(annotation.timestamp, 0);
@@ -130,9 +191,9 @@ TEST(span, annotate)
 
     span.http_host("www.google.com");
 
-    ASSERT_FALSE(msg.binary_annotations.empty());
+    ASSERT_FALSE(span.message().binary_annotations.empty());
 
-    const ::BinaryAnnotation &binary_annotation = msg.binary_annotations.back();
+    const ::BinaryAnnotation &binary_annotation = span.message().binary_annotations.back();
 
     ASSERT_EQ(binary_annotation.key, g_zipkinCore_constants.HTTP_HOST);
     ASSERT_EQ(binary_annotation.value, "www.google.com");
@@ -140,49 +201,85 @@ TEST(span, annotate)
     ASSERT_EQ(binary_annotation.__isset.host, 0);
 
     span.annotate("bool", true);
-    ASSERT_EQ(msg.binary_annotations.back().annotation_type, AnnotationType::type::BOOL);
-    ASSERT_STREQ(msg.binary_annotations.back().value.c_str(), "\x01");
+    ASSERT_EQ(span.message().binary_annotations.back().annotation_type, AnnotationType::type::BOOL);
+    ASSERT_STREQ(span.message().binary_annotations.back().value.c_str(), "\x01");
 
     span.annotate("i16", (int16_t)-123);
-    ASSERT_EQ(msg.binary_annotations.back().annotation_type, AnnotationType::type::I16);
-    ASSERT_STREQ(msg.binary_annotations.back().value.c_str(), "\xff\x85");
+    ASSERT_EQ(span.message().binary_annotations.back().annotation_type, AnnotationType::type::I16);
+    ASSERT_STREQ(span.message().binary_annotations.back().value.c_str(), "\xff\x85");
 
     span.annotate("u16", (uint16_t)123);
-    ASSERT_EQ(msg.binary_annotations.back().annotation_type, AnnotationType::type::I16);
-    ASSERT_STREQ(msg.binary_annotations.back().value.c_str(), "\x00\x7b");
+    ASSERT_EQ(span.message().binary_annotations.back().annotation_type, AnnotationType::type::I16);
+    ASSERT_STREQ(span.message().binary_annotations.back().value.c_str(), "\x00\x7b");
 
     span.annotate("i32", (int32_t)-123);
-    ASSERT_EQ(msg.binary_annotations.back().annotation_type, AnnotationType::type::I32);
-    ASSERT_STREQ(msg.binary_annotations.back().value.c_str(), "\xff\xff\xff\x85");
+    ASSERT_EQ(span.message().binary_annotations.back().annotation_type, AnnotationType::type::I32);
+    ASSERT_STREQ(span.message().binary_annotations.back().value.c_str(), "\xff\xff\xff\x85");
 
     span.annotate("u32", (uint32_t)123);
-    ASSERT_EQ(msg.binary_annotations.back().annotation_type, AnnotationType::type::I32);
-    ASSERT_STREQ(msg.binary_annotations.back().value.c_str(), "\x00\x00\x00\x7b");
+    ASSERT_EQ(span.message().binary_annotations.back().annotation_type, AnnotationType::type::I32);
+    ASSERT_STREQ(span.message().binary_annotations.back().value.c_str(), "\x00\x00\x00\x7b");
 
     span.annotate("i64", (int64_t)-123);
-    ASSERT_EQ(msg.binary_annotations.back().annotation_type, AnnotationType::type::I64);
-    ASSERT_STREQ(msg.binary_annotations.back().value.c_str(), "\xff\xff\xff\xff\xff\xff\xff\x85");
+    ASSERT_EQ(span.message().binary_annotations.back().annotation_type, AnnotationType::type::I64);
+    ASSERT_STREQ(span.message().binary_annotations.back().value.c_str(), "\xff\xff\xff\xff\xff\xff\xff\x85");
 
     span.annotate("u64", (uint64_t)123);
-    ASSERT_EQ(msg.binary_annotations.back().annotation_type, AnnotationType::type::I64);
-    ASSERT_STREQ(msg.binary_annotations.back().value.c_str(), "\x00\x00\x00\x00\x00\x00\x00\x7b");
+    ASSERT_EQ(span.message().binary_annotations.back().annotation_type, AnnotationType::type::I64);
+    ASSERT_STREQ(span.message().binary_annotations.back().value.c_str(), "\x00\x00\x00\x00\x00\x00\x00\x7b");
 
     span.annotate("double", (double)12.3);
-    ASSERT_EQ(msg.binary_annotations.back().annotation_type, AnnotationType::type::DOUBLE);
-    ASSERT_STREQ(msg.binary_annotations.back().value.c_str(), "\x9A\x99\x99\x99\x99\x99\x28\x40");
+    ASSERT_EQ(span.message().binary_annotations.back().annotation_type, AnnotationType::type::DOUBLE);
+    ASSERT_STREQ(span.message().binary_annotations.back().value.c_str(), "\x9A\x99\x99\x99\x99\x99\x28\x40");
 
     span.annotate("string", std::wstring(L"测试"));
-    ASSERT_EQ(msg.binary_annotations.back().value, "测试");
-    ASSERT_EQ(msg.binary_annotations.back().annotation_type, AnnotationType::type::STRING);
+    ASSERT_EQ(span.message().binary_annotations.back().value, "测试");
+    ASSERT_EQ(span.message().binary_annotations.back().annotation_type, AnnotationType::type::STRING);
 
     span.annotate("string", L"测试");
-    ASSERT_EQ(msg.binary_annotations.back().value, "测试");
-    ASSERT_EQ(msg.binary_annotations.back().annotation_type, AnnotationType::type::STRING);
+    ASSERT_EQ(span.message().binary_annotations.back().value, "测试");
+    ASSERT_EQ(span.message().binary_annotations.back().annotation_type, AnnotationType::type::STRING);
 
     uint8_t bytes[] = {1, 2, 3};
 
     span.annotate("bytes", bytes);
-    ASSERT_EQ(msg.binary_annotations.back().annotation_type, AnnotationType::type::BYTES);
+    ASSERT_EQ(span.message().binary_annotations.back().annotation_type, AnnotationType::type::BYTES);
+}
+
+TEST(span, string_view)
+{
+    zipkin::Span span(nullptr, "test");
+
+    span.annotate("literal", "value");
+    ASSERT_EQ(span.message().binary_annotations.back().value, std::string("value"));
+    ASSERT_EQ(span.message().binary_annotations.back().value.size(), 5);
+
+    char buf[16] = "short";
+
+    span.annotate("buffer", buf);
+    ASSERT_EQ(span.message().binary_annotations.back().value.size(), 5);
+
+    span.annotate(zipkin::string_view("view.key.suffix", 8), zipkin::string_view("value.suffix", 5));
+    ASSERT_EQ(span.message().binary_annotations.back().key, "view.key");
+    ASSERT_EQ(span.message().binary_annotations.back().value, "value");
+
+    span.annotate("wide", L"测试");
+    ASSERT_EQ(span.message().binary_annotations.back().value, std::string("测试"));
+
+    span.annotate("moved", std::string("value")).with_value("other");
+    ASSERT_EQ(span.message().binary_annotations.back().value, std::string("other"));
+
+    span << std::make_pair(zipkin::string_view(zipkin::TraceKeys::HTTP_URL), zipkin::string_view("/"));
+    ASSERT_EQ(span.message().binary_annotations.back().key, zipkin::TraceKeys::HTTP_URL);
+    ASSERT_EQ(span.message().binary_annotations.back().value, "/");
+
+    std::string name("moved");
+
+    span.with_name(std::move(name));
+    ASSERT_EQ(span.name(), "moved");
+
+    span.with_name(zipkin::string_view("view.suffix", 4));
+    ASSERT_EQ(span.name(), "view");
 }
 
 static const char *json_template = R"###({
@@ -280,6 +377,109 @@ TEST(span, serialize_json)
     ASSERT_EQ(std::string(buffer.GetString(), buffer.GetSize()), std::string(str, str_len));
 }
 
+TEST(span, serialize_binary)
+{
+    MockTracer tracer;
+
+    zipkin::Span span(&tracer, "test", zipkin::Span::next_id());
+
+    zipkin::Endpoint host("host", "::1", 80);
+
+    span.client_send(&host);
+    span.annotate("i32", (int32_t)123, &host);
+    span.annotate("string", "hello");
+
+    boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> buf(new apache::thrift::transport::TMemoryBuffer());
+    apache::thrift::protocol::TBinaryProtocol protocol(buf);
+
+    size_t wrote = span.serialize_binary(protocol);
+
+    std::string data = buf->getBufferAsString();
+
+    ASSERT_EQ(wrote, data.size());
+
+    buf->resetBuffer();
+    span.message().write(&protocol);
+
+    ASSERT_EQ(data, buf->getBufferAsString());
+}
+
+TEST(span, arena)
+{
+    zipkin::Span span(nullptr, "test");
+
+    for (int i = 0; i < 64; i++)
+    {
+        span.annotate("key", std::string(64, 'x'));
+    }
+
+    ASSERT_EQ(span.binary_annotations_size(), 64);
+    ASSERT_GT(span.arena().reserved(), 0);
+
+    size_t reserved = span.arena().reserved();
+
+    span.reset("test");
+
+    ASSERT_EQ(span.annotations_size(), 0);
+    ASSERT_EQ(span.binary_annotations_size(), 0);
+    ASSERT_TRUE(span.message().binary_annotations.empty());
+
+    for (int i = 0; i < 64; i++)
+    {
+        span.annotate("key", std::string(64, 'x'));
+    }
+
+    ASSERT_EQ(span.arena().reserved(), reserved);
+    ASSERT_EQ(span.message().binary_annotations.back().value, std::string(64, 'x'));
+
+    zipkin::Arena arena;
+
+    arena.reserve(4096);
+
+    ASSERT_EQ(arena.reserved(), 4096);
+    ASSERT_EQ(arena.allocated(), 0);
+
+    arena.allocate(3000);
+    arena.reserve(1000);
+
+    ASSERT_EQ(arena.reserved(), 4096);
+    ASSERT_EQ(arena.allocated(), 3000);
+
+    arena.reserve(2000);
+
+    ASSERT_EQ(arena.reserved(), 4096 + 1024);
+}
+
+TEST(span, intern)
+{
+    zipkin::InternTable &table = zipkin::InternTable::instance();
+
+    zipkin::intern_t cs = table.find(zipkin::TraceKeys::CLIENT_SEND);
+
+    ASSERT_NE(cs, 0);
+    ASSERT_EQ(table.find(std::string("cs")), cs);
+    ASSERT_EQ(table.str(cs), zipkin::TraceKeys::CLIENT_SEND);
+    ASSERT_EQ(table.thrift(cs), std::string("\0\0\0\x02"
+                                            "cs",
+                                            6));
+
+    ASSERT_EQ(table.find(std::string("test.key")), 0);
+
+    zipkin::intern_t id = table.intern("test.key");
+
+    ASSERT_NE(id, 0);
+    ASSERT_EQ(table.intern("test.key"), id);
+    ASSERT_EQ(table.find(std::string("test.key")), id);
+
+    zipkin::Span span(nullptr, "test");
+
+    span.client_send();
+    span.annotate("test.key", "value");
+
+    ASSERT_EQ(span.message().annotations.back().value, "cs");
+    ASSERT_EQ(span.message().binary_annotations.back().key, "test.key");
+}
+
 TEST(span, scope)
 {
     MockTracer tracer;
@@ -327,4 +527,132 @@ TEST(span, annotate_stream)
 
     ASSERT_EQ(span.message().annotations.size(), 2);
     ASSERT_EQ(span.message().binary_annotations.size(), 8);
-}
\ No newline at end of file
+}
+
+TEST(span, unsampled)
+{
+    MockTracer tracer;
+
+    zipkin::Span span(&tracer, "test", 0, nullptr, false);
+
+    ASSERT_FALSE(span.recording());
+    ASSERT_EQ(span.timestamp().count(), 0);
+
+    zipkin::Endpoint host("host");
+
+    span << zipkin::TraceKeys::CLIENT_SEND << host
+         << std::make_pair("key", "hello") << host
+         << std::make_pair("i32", (int32_t)123);
+
+    span.annotate("key", std::string("world")).with_value("again");
+    span.client_recv().with_value("cr");
+
+    ASSERT_EQ(span.annotations_size(), 0);
+    ASSERT_EQ(span.binary_annotations_size(), 0);
+    ASSERT_EQ(span.arena().allocated(), 0);
+
+    zipkin::SpanContext context = span.context();
+
+    ASSERT_EQ(context.trace_id, span.trace_id());
+    ASSERT_EQ(context.span_id, span.id());
+    ASSERT_FALSE(context.sampled);
+
+    int evaluated = 0;
+
+    ANNOTATE(&span, (evaluated++, "cs"), nullptr);
+    ANNOTATE_STR(&span, "key", (evaluated++, "value"), -1, nullptr);
+
+    ASSERT_EQ(evaluated, 0);
+    ASSERT_EQ(span.annotations_size(), 0);
+
+    int64_t now = zipkin::Span::now().count();
+
+    span.with_sampled(true);
+
+    ASSERT_TRUE(span.recording());
+    ASSERT_NEAR(span.timestamp().count(), now, 20000);
+
+    ANNOTATE(&span, (evaluated++, "cs"), nullptr);
+
+    ASSERT_EQ(evaluated, 1);
+    ASSERT_EQ(span.annotations_size(), 1);
+}
+
+TEST(span, services_without_linker)
+{
+    MockTracer tracer;
+
+    zipkin::Endpoint host("host");
+
+    // the RPC annotations with an endpoint keep no service without a dependency linker
+    for (bool sampled : {false, true})
+    {
+        zipkin::Span span(&tracer, "test", 0, nullptr, sampled);
+
+        span.annotate(zipkin::TraceKeys::CLIENT_ADDR, true, &host);
+        span.annotate(zipkin::TraceKeys::SERVER_ADDR, std::wstring(L"addr"), &host);
+        span.client_send(&host);
+        span.server_recv(&host);
+
+        ASSERT_EQ(span.services().client_addr, 0);
+        ASSERT_EQ(span.services().server_addr, 0);
+        ASSERT_EQ(span.services().client, 0);
+        ASSERT_EQ(span.services().server, 0);
+    }
+}
+
+TEST(span, aggregate)
+{
+    MockTracer tracer;
+
+    zipkin::Span span(&tracer, "test");
+    zipkin::SpanAggregate lookups = span.aggregate("cache.get");
+
+    for (int i = 0; i < 1000; i++)
+    {
+        zipkin::SpanAggregate::Timer timer = lookups.time();
+
+        if (i == 0)
+            timer.fail();
+    }
+
+    lookups.record(std::chrono::milliseconds(5));
+
+    // the children with the same name are folded into the same aggregate
+    ASSERT_EQ(span.aggregate("cache.get").count(), 1001);
+    ASSERT_GE(lookups.total().count(), 5000);
+    ASSERT_EQ(span.annotations_size(), 0);
+
+    zipkin::Span *summary = nullptr;
+
+    EXPECT_CALL(tracer, span(_, Matcher<const zipkin::SpanContext &>(_), _))
+        .WillOnce(Invoke([&tracer](zipkin::string_view name, const zipkin::SpanContext &parent, userdata_t userdata) {
+            return new zipkin::Span(&tracer, name, parent, userdata);
+        }));
+    EXPECT_CALL(tracer, submit(_))
+        .WillOnce(SaveArg<0>(&summary))
+        .WillOnce(Return());
+
+    span.submit();
+
+    ASSERT_TRUE(summary);
+
+    std::unique_ptr<zipkin::Span> child(summary);
+
+    ASSERT_EQ(child->name(), "cache.get");
+    ASSERT_EQ(child->parent_id(), span.id());
+    ASSERT_GE(child->duration().count(), 5000);
+    ASSERT_NE(child->timestamp().count(), 0);
+    ASSERT_EQ(child->binary_annotations_size(), 6);
+    ASSERT_TRUE(child->annotated(zipkin::SpanAggregate::COUNT));
+    ASSERT_TRUE(child->annotated(zipkin::TraceKeys::ERROR));
+    ASSERT_TRUE(child->failed());
+
+    // the aggregates of a span which isn't recording are no-op
+    zipkin::Span unsampled(&tracer, "test", 0, nullptr, false);
+
+    unsampled.aggregate("cache.get").record(std::chrono::milliseconds(1));
+
+    ASSERT_EQ(unsampled.aggregate("cache.get").count(), 0);
+    ASSERT_EQ(unsampled.arena().allocated(), 0);
+}
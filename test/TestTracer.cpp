@@ -1,5 +1,16 @@
 #include "Mocks.hpp"
 
+#include <algorithm>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <fstream>
+
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "Slab.h"
+
 TEST(tracer, properties)
 {
     std::unique_ptr<zipkin::Tracer> tracer(zipkin::Tracer::create(nullptr));
@@ -56,3 +67,826 @@ TEST(tracer, cache)
     ASSERT_NE(span->id(), id);
     ASSERT_EQ(span->name(), "test2");
 }
+
+TEST(tracer, cache_batch)
+{
+    std::unique_ptr<zipkin::Tracer> tracer(zipkin::Tracer::create(nullptr));
+    std::vector<zipkin::Span *> spans;
+    std::set<zipkin::Span *> allocated;
+
+    for (int i = 0; i < 64; i++)
+    {
+        spans.push_back(tracer->span("test"));
+        allocated.insert(spans.back());
+    }
+
+    for (auto span : spans)
+    {
+        span->release();
+    }
+
+    for (auto &span : spans)
+    {
+        span = tracer->span("test");
+
+        ASSERT_EQ(allocated.count(span), 1);
+    }
+
+    tracer->release(spans.data(), spans.size());
+
+    for (auto &span : spans)
+    {
+        span = tracer->span("test");
+
+        ASSERT_EQ(allocated.count(span), 1);
+    }
+
+    tracer->release(spans.data(), spans.size());
+
+    auto t = static_cast<zipkin::CachedTracer *>(tracer.get());
+
+    while (!t->cache().empty())
+    {
+        zipkin::Span *span = tracer->span("test");
+
+        ASSERT_EQ(allocated.count(span), 1);
+
+        delete span;
+    }
+
+    zipkin::Span *span = nullptr;
+
+    std::thread([&] {
+        span = tracer->span("test");
+        span->release();
+    }).join();
+
+    ASSERT_FALSE(t->cache().empty());
+    ASSERT_EQ(tracer->span("test"), span);
+
+    span->release();
+}
+
+TEST(tracer, size_classes)
+{
+    zipkin::SpanCache::set_trim_interval(std::chrono::milliseconds(0));
+
+    std::unique_ptr<zipkin::CachedTracer> tracer(new zipkin::CachedTracer(nullptr));
+
+    for (size_t i = 1; i < zipkin::CachedTracer::SIZE_CLASSES; i++)
+    {
+        ASSERT_LT(tracer->cache(i - 1).message_size(), tracer->cache(i).message_size());
+    }
+
+    ASSERT_EQ(&tracer->cache(zipkin::CachedTracer::DEFAULT_SIZE_CLASS), &tracer->cache());
+
+    for (int i = 0; i < 64; i++)
+    {
+        tracer->shapes().record("small", 1, 1, 64);
+        tracer->shapes().record("large", 16, 16, zipkin::CachedTracer::DEFAULT_CACHE_MESSAGE_SIZE * 4);
+    }
+
+    zipkin::Span *small = tracer->span("small");
+    zipkin::Span *large = tracer->span("large");
+
+    ASSERT_EQ(small->cached()->cache(), &tracer->cache(0));
+    ASSERT_EQ(large->cached()->cache(), &tracer->cache(zipkin::CachedTracer::SIZE_CLASSES - 1));
+
+    small->release();
+    large->release();
+
+    ASSERT_EQ(tracer->span("small"), small);
+
+    zipkin::SpanCache::Stats stats = tracer->cache(0).stats();
+
+    ASSERT_EQ(stats.message_size, tracer->cache(0).message_size());
+    ASSERT_EQ(stats.hits, 1);
+    ASSERT_EQ(stats.misses, 1);
+
+    delete small;
+
+    zipkin::SpanCache::set_trim_interval(zipkin::SpanCache::DEFAULT_TRIM_INTERVAL);
+}
+
+TEST(tracer, trim)
+{
+    zipkin::SpanCache::set_trim_interval(std::chrono::milliseconds(0));
+
+    std::unique_ptr<zipkin::CachedTracer> tracer(new zipkin::CachedTracer(nullptr, 1, zipkin::CachedTracer::DEFAULT_CACHE_MESSAGE_SIZE, 16));
+    zipkin::SpanCache &cache = tracer->cache();
+    std::vector<zipkin::Span *> spans;
+
+    // a burst starves the cache, so it grows beyond the initial capacity
+    for (int round = 0; round < 4; round++)
+    {
+        for (int i = 0; i < 256; i++)
+        {
+            spans.push_back(tracer->span("test"));
+        }
+
+        tracer->release(spans.data(), spans.size());
+        spans.clear();
+    }
+
+    zipkin::SpanCache::Stats stats = cache.stats();
+
+    ASSERT_GT(stats.capacity, 16);
+    ASSERT_GT(stats.cached, 16);
+    ASSERT_EQ(stats.trimmed, 0);
+
+    ASSERT_EQ(cache.trim(), 0);
+    ASSERT_EQ(cache.trim(), stats.cached);
+
+    stats = cache.stats();
+
+    ASSERT_EQ(stats.cached, 0);
+    ASSERT_EQ(stats.capacity, 16);
+    ASSERT_GT(stats.trimmed, 16);
+
+    // the spans of the thread magazine are counted by the trim, and returned on the next access
+    zipkin::Span *span = tracer->span("test");
+
+    span->release();
+
+    ASSERT_EQ(cache.trim(), 0);
+    ASSERT_EQ(cache.stats().magazined, 1);
+
+    delete tracer->span("test");
+
+    stats = cache.stats();
+
+    ASSERT_EQ(stats.magazined, 0);
+    ASSERT_EQ(stats.cached, 0);
+
+    zipkin::SpanCache::set_trim_interval(zipkin::SpanCache::DEFAULT_TRIM_INTERVAL);
+}
+
+TEST(tracer, slab)
+{
+    zipkin::SpanCache::set_trim_interval(std::chrono::milliseconds(0));
+
+    std::unique_ptr<zipkin::CachedTracer> tracer(new zipkin::CachedTracer(
+        nullptr, 1, zipkin::CachedTracer::DEFAULT_CACHE_MESSAGE_SIZE, 32,
+        zipkin::CachedTracer::CACHE_SLAB | zipkin::CachedTracer::CACHE_PREWARM));
+    zipkin::SpanCache &cache = tracer->cache();
+    zipkin::Slab *slab = cache.slab();
+
+    ASSERT_TRUE(slab);
+    ASSERT_EQ(slab, zipkin::Slab::get(cache.message_size()));
+    ASSERT_GE(slab->chunk_size(), cache.message_size());
+    ASSERT_GE(slab->slabs(), 1);
+    ASSERT_GE(slab->allocated(), 32);
+
+    zipkin::SpanCache::Stats stats = cache.stats();
+
+    ASSERT_EQ(stats.cached, 32);
+    ASSERT_EQ(stats.misses, 0);
+
+    zipkin::Span *first = tracer->span("test");
+    zipkin::Span *second = tracer->span("test");
+
+    ASSERT_EQ(cache.stats().hits, 2);
+    ASSERT_NE(first, second);
+    ASSERT_EQ(zipkin::Slab::owner(first), slab);
+    ASSERT_EQ(zipkin::Slab::owner(&cache), nullptr);
+
+    first->release();
+    second->release();
+
+    // the prewarmed spans survive the trimming
+    ASSERT_EQ(cache.trim(), 0);
+    ASSERT_EQ(cache.trim(), 0);
+
+    size_t allocated = slab->allocated();
+
+    delete tracer->span("test");
+
+    ASSERT_EQ(slab->allocated(), allocated - 1);
+
+    zipkin::SpanCache::set_trim_interval(zipkin::SpanCache::DEFAULT_TRIM_INTERVAL);
+}
+
+TEST(tracer, slab_exhausted)
+{
+    // the address space is nearly exhausted, the slabs can't be mapped and the heap runs out soon
+    ASSERT_EXIT({
+        std::unique_ptr<zipkin::CachedTracer> tracer(new zipkin::CachedTracer(
+            nullptr, 1, zipkin::CachedTracer::DEFAULT_CACHE_MESSAGE_SIZE + 64, 0, zipkin::CachedTracer::CACHE_SLAB));
+
+        size_t pages = 0;
+        std::ifstream("/proc/self/statm") >> pages;
+
+        struct rlimit limit;
+        limit.rlim_cur = limit.rlim_max = pages * sysconf(_SC_PAGESIZE) + (1 << 20);
+        setrlimit(RLIMIT_AS, &limit);
+
+        zipkin::Span *span = tracer->span("test");
+
+        if (!span || zipkin::Slab::owner(span))
+            exit(1);
+
+        // the spans are never released, until they can't be allocated
+        for (int i = 0; i < 100000 && span; i++)
+            span = tracer->span("test");
+
+        exit(span ? 2 : 0);
+    }, ::testing::ExitedWithCode(0), "");
+}
+
+TEST(tracer, sampler)
+{
+    ASSERT_TRUE(zipkin::Sampler::always()->sample(1, "test"));
+    ASSERT_FALSE(zipkin::Sampler::never()->sample(1, "test"));
+
+    zipkin::ProbabilisticSampler probabilistic(0.25);
+    zipkin::IdGenerator *generator = zipkin::IdGenerator::random();
+    size_t sampled = 0;
+
+    for (int i = 0; i < 10000; i++)
+    {
+        trace_id_t trace_id = generator->next_id();
+        bool decision = probabilistic.sample(trace_id, "test");
+
+        ASSERT_EQ(probabilistic.sample(trace_id, "test"), decision);
+
+        if (decision)
+            sampled++;
+    }
+
+    ASSERT_GT(sampled, 2000);
+    ASSERT_LT(sampled, 3000);
+
+    zipkin::RateLimitingSampler rate_limiting(10);
+
+    for (int i = 0; i < 10; i++)
+    {
+        ASSERT_TRUE(rate_limiting.sample(i, "test"));
+    }
+
+    ASSERT_FALSE(rate_limiting.sample(10, "test"));
+
+    // the threads count in blocks of the sampler, together they sample one of every sample rate traces
+    zipkin::CountingSampler counting(4), halving(2);
+    std::atomic_size_t counted(0);
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < 4; t++)
+    {
+        threads.emplace_back([&] {
+            for (size_t i = 0; i < zipkin::CountingSampler::COUNT_BLOCK * 10; i++)
+            {
+                halving.sample(i, "test");
+
+                if (counting.sample(i, "test"))
+                    counted++;
+            }
+        });
+    }
+
+    for (auto &thread : threads)
+        thread.join();
+
+    ASSERT_EQ(counted, zipkin::CountingSampler::COUNT_BLOCK * 10);
+
+    std::unique_ptr<zipkin::Tracer> tracer(zipkin::Tracer::create(nullptr));
+
+    tracer->set_sampler(zipkin::Sampler::never());
+
+    ASSERT_EQ(tracer->sampler(), zipkin::Sampler::never());
+
+    std::unique_ptr<zipkin::Span> root(tracer->span("root"));
+    std::unique_ptr<zipkin::Span> child(root->span("child"));
+
+    ASSERT_FALSE(root->sampled());
+    ASSERT_FALSE(child->sampled());
+
+    tracer->set_sampler(zipkin::Sampler::always());
+
+    child.reset(root->span("child"));
+
+    ASSERT_FALSE(child->sampled());
+
+    // an unsampled span is released when it is submitted
+    root.release()->submit();
+
+    ASSERT_FALSE(static_cast<zipkin::CachedTracer *>(tracer.get())->cache().empty());
+
+    tracer->set_sampler(nullptr);
+    tracer->set_sample_rate(2);
+
+    ASSERT_EQ(tracer->sample_rate(), 2);
+
+    std::thread([&] {
+        for (int i = 0; i < 4; i++)
+        {
+            zipkin::Span *span = tracer->span("test");
+
+            ASSERT_EQ(span->sampled(), i % 2 == 0);
+
+            span->release();
+        }
+    }).join();
+
+    // each tracer counts its own traces, and the child of a parent id doesn't take a decision
+    std::unique_ptr<zipkin::Tracer> other(zipkin::Tracer::create(nullptr, 3));
+
+    for (int i = 0; i < 6; i++)
+    {
+        zipkin::Span *span = tracer->span("test");
+        zipkin::Span *other_span = other->span("test");
+        zipkin::Span *child = tracer->span("child", 123);
+
+        ASSERT_EQ(span->sampled(), i % 2 == 0);
+        ASSERT_EQ(other_span->sampled(), i % 3 == 0);
+        ASSERT_TRUE(child->sampled());
+        ASSERT_EQ(child->parent_id(), 123);
+
+        span->release();
+        other_span->release();
+        child->release();
+    }
+}
+
+TEST(tracer, adaptive_sampler)
+{
+    MockCollector collector;
+    zipkin::AdaptiveSamplingConf conf;
+
+    conf.adjust_interval = std::chrono::hours(1);
+
+    zipkin::AdaptiveSampler sampler(conf, &collector);
+
+    // a new operation is sampled fully until the first adjustment
+    for (trace_id_t i = 0; i < 10000; i++)
+    {
+        ASSERT_TRUE(sampler.sample(i, "busy"));
+    }
+
+    for (trace_id_t i = 0; i < 10; i++)
+    {
+        ASSERT_TRUE(sampler.sample(i, "quiet"));
+    }
+
+    ASSERT_DOUBLE_EQ(sampler.probability("busy"), 1.0);
+
+    sampler.adjust();
+
+    // the budget is split evenly between the busy operations
+    auto rates = sampler.rates();
+
+    ASSERT_EQ(rates.size(), 2);
+    ASSERT_LT(sampler.probability("busy"), sampler.probability("quiet"));
+
+    for (auto &rate : rates)
+    {
+        ASSERT_NEAR(rate.probability * rate.traces_per_second, conf.traces_per_second / 2, 1);
+    }
+
+    // the budget backs off when the collector dropped spans, and recovers gradually
+    EXPECT_CALL(collector, dropped_spans()).WillOnce(Return(5)).WillOnce(Return(5));
+
+    sampler.adjust();
+
+    ASSERT_DOUBLE_EQ(sampler.budget(), conf.traces_per_second * conf.backoff);
+
+    sampler.adjust();
+
+    ASSERT_DOUBLE_EQ(sampler.budget(), conf.traces_per_second * (conf.backoff + zipkin::AdaptiveSampler::RECOVERY));
+
+    // each operation is sampled at least at its floor
+    conf.traces_per_second = 0;
+    conf.min_traces_per_second = 100;
+
+    zipkin::AdaptiveSampler starved(conf);
+
+    ASSERT_TRUE(starved.sample(1, "rare"));
+
+    starved.adjust();
+
+    ASSERT_DOUBLE_EQ(starved.probability("rare"), 0.0);
+    ASSERT_FALSE(starved.sample(2, "rare"));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    ASSERT_TRUE(starved.sample(3, "rare"));
+    ASSERT_FALSE(starved.sample(4, "rare"));
+}
+
+TEST(tracer, tail_sampler)
+{
+    MockCollector collector;
+    std::vector<zipkin::Span *> submitted;
+
+    EXPECT_CALL(collector, submit(_)).WillRepeatedly(Invoke([&](zipkin::Span *span) { submitted.push_back(span); }));
+
+    zipkin::CachedTracer tracer(&collector);
+    zipkin::TailSamplingConf conf;
+
+    conf.min_duration = std::chrono::milliseconds(10);
+
+    std::unique_ptr<zipkin::TailSampler> tail(new zipkin::TailSampler(conf));
+
+    tracer.set_sampler(zipkin::Sampler::never());
+    tracer.set_tail_sampler(tail.get());
+
+    // the spans are recorded, and buffered until the local root finished
+    zipkin::Span *root = tracer.span("plain");
+    zipkin::Span *child = root->span("child");
+
+    ASSERT_TRUE(root->recording());
+    ASSERT_TRUE(child->recording());
+    ASSERT_EQ(tail->stats().traces, 1);
+
+    // the head decision is still the one propagated downstream
+    ASSERT_FALSE(root->sampled());
+    ASSERT_FALSE(child->sampled());
+    ASSERT_FALSE(child->context().sampled);
+
+    child->submit();
+
+    ASSERT_EQ(tail->stats().spans, 1);
+
+    root->submit();
+
+    ASSERT_TRUE(submitted.empty());
+    ASSERT_EQ(tail->stats().traces, 0);
+    ASSERT_EQ(tail->stats().spans, 0);
+    ASSERT_EQ(tail->stats().bytes, 0);
+    ASSERT_EQ(tail->stats().dropped, 1);
+
+    // a trace with an error is kept
+    root = tracer.span("error");
+    child = root->span("child");
+
+    child->annotate(zipkin::TraceKeys::ERROR, "failed");
+    child->submit();
+    root->submit();
+
+    ASSERT_EQ(submitted.size(), 2);
+    ASSERT_EQ(tail->stats().kept, 1);
+
+    // a slow trace is kept
+    root = tracer.span("slow");
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    root->submit();
+
+    ASSERT_EQ(submitted.size(), 3);
+    ASSERT_EQ(tail->stats().kept, 2);
+
+    // a released span doesn't hold the trace
+    root = tracer.span("released");
+    child = root->span("child");
+
+    child->release();
+    root->submit();
+
+    ASSERT_EQ(submitted.size(), 3);
+    ASSERT_EQ(tail->stats().dropped, 2);
+
+    // the oldest trace is decided beyond the memory limit
+    conf.max_bytes = 1;
+    tail.reset(new zipkin::TailSampler(conf));
+    tracer.set_tail_sampler(tail.get());
+
+    root = tracer.span("evicted");
+    child = root->span("child");
+
+    child->submit();
+
+    ASSERT_EQ(tail->stats().evicted, 1);
+    ASSERT_EQ(tail->stats().traces, 0);
+
+    root->submit();
+
+    ASSERT_EQ(tail->stats().dropped, 2);
+    ASSERT_EQ(submitted.size(), 3);
+
+    // the pending traces are decided on flush
+    root = tracer.span("flushed");
+    root->with_debug(true);
+
+    ASSERT_EQ(tail->flush(), 1);
+    ASSERT_EQ(tail->stats().kept, 0);
+
+    root->release();
+
+    tracer.set_tail_sampler(nullptr);
+
+    for (auto span : submitted)
+        span->release();
+}
+
+TEST(tracer, metrics)
+{
+    for (uint64_t us : {0, 1, 31, 32, 33, 100, 1000, 123456, 1000000000})
+    {
+        size_t bucket = zipkin::SpanMetrics::bucket(us);
+
+        ASSERT_GE(zipkin::SpanMetrics::bucket_limit(bucket), us);
+        ASSERT_LE(zipkin::SpanMetrics::bucket_limit(bucket), us + us / zipkin::SpanMetrics::SUB_BUCKETS);
+    }
+
+    std::atomic_size_t reports(0);
+    zipkin::MetricsConf conf;
+
+    conf.service = "test";
+    conf.report_interval = std::chrono::milliseconds(1);
+    conf.reporter = [&reports](const std::vector<zipkin::SpanMetric> &metrics) { reports++; };
+
+    zipkin::SpanMetrics metrics(conf);
+    zipkin::CachedTracer tracer(nullptr);
+
+    tracer.set_sampler(zipkin::Sampler::never());
+    tracer.set_metrics(&metrics);
+
+    // the spans which aren't recording are measured too
+    for (int i = 0; i < 10; i++)
+    {
+        zipkin::Span *span = tracer.span("get");
+
+        ASSERT_FALSE(span->recording());
+
+        if (i % 5 == 0)
+            span->annotate(zipkin::TraceKeys::ERROR);
+
+        span->submit();
+    }
+
+    std::thread([&] {
+        for (int i = 0; i < 5; i++)
+        {
+            tracer.span("get")->submit();
+        }
+    }).join();
+
+    auto snapshot = metrics.snapshot();
+
+    ASSERT_EQ(snapshot.size(), 1);
+    ASSERT_EQ(snapshot[0].service, "test");
+    ASSERT_EQ(snapshot[0].name, "get");
+    ASSERT_EQ(snapshot[0].count, 15);
+    ASSERT_EQ(snapshot[0].errors, 2);
+    ASSERT_GT(snapshot[0].min.count(), 0);
+    ASSERT_LE(snapshot[0].percentile(0.5), snapshot[0].max);
+
+    std::ostringstream oss;
+
+    metrics.expose(oss);
+
+    ASSERT_NE(oss.str().find("zipkin_spans_total{service=\"test\",name=\"get\"} 15\n"), std::string::npos);
+    ASSERT_NE(oss.str().find("zipkin_span_errors_total{service=\"test\",name=\"get\"} 2\n"), std::string::npos);
+
+    for (int i = 0; i < 1000 && !reports; i++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    ASSERT_GT(reports, 0);
+
+    tracer.set_metrics(nullptr);
+}
+
+TEST(tracer, dependency_linker)
+{
+    zipkin::DependencyConf conf;
+
+    conf.sides = zipkin::DependencyConf::CLIENT | zipkin::DependencyConf::SERVER;
+
+    zipkin::DependencyLinker linker(conf);
+    zipkin::CachedTracer tracer(nullptr);
+    zipkin::Endpoint browser("browser"), frontend("frontend"), backend("backend");
+
+    tracer.set_sampler(zipkin::Sampler::never());
+    tracer.set_dependency_linker(&linker);
+
+    // the services are kept even when the spans aren't recording
+    zipkin::Span *server = tracer.span("get");
+
+    server->server_recv(&frontend);
+    server->annotate(zipkin::TraceKeys::CLIENT_ADDR, true, &browser);
+
+    ASSERT_FALSE(server->recording());
+
+    zipkin::Span *client = server->span("call");
+
+    client->client_send(&frontend);
+    client->annotate(zipkin::TraceKeys::SERVER_ADDR, true, &backend);
+    client->annotate(zipkin::TraceKeys::ERROR);
+
+    // a server span in the same process is linked from the service of its parent
+    zipkin::Span *local = client->span("serve");
+
+    local->server_recv(&backend);
+
+    ASSERT_EQ(local->services().parent, client->services().local());
+
+    local->submit();
+    client->submit();
+    server->submit();
+
+    auto links = linker.links(true);
+
+    std::sort(links.begin(), links.end(), [](const zipkin::DependencyLink &lhs, const zipkin::DependencyLink &rhs) {
+        return lhs.parent < rhs.parent;
+    });
+
+    ASSERT_EQ(links.size(), 2);
+    ASSERT_EQ(links[0].parent, "browser");
+    ASSERT_EQ(links[0].child, "frontend");
+    ASSERT_EQ(links[0].call_count, 1);
+    ASSERT_EQ(links[0].error_count, 0);
+    ASSERT_EQ(links[1].parent, "frontend");
+    ASSERT_EQ(links[1].child, "backend");
+    ASSERT_EQ(links[1].call_count, 2);
+    ASSERT_EQ(links[1].error_count, 1);
+
+    // a new interval starts on reset
+    ASSERT_TRUE(linker.links().empty());
+
+    tracer.set_dependency_linker(nullptr);
+
+    // without a linker the services are not kept
+    zipkin::Span *unlinked = tracer.span("get");
+
+    unlinked->server_recv(&frontend);
+
+    ASSERT_EQ(unlinked->services().server, 0);
+
+    unlinked->submit();
+
+    // the service names past the limit get no id
+    ASSERT_EQ(linker.service("frontend"), linker.service("frontend"));
+
+    for (size_t i = 0; i < zipkin::DependencyLinker::MAX_SERVICES; i++)
+    {
+        linker.service("service-" + std::to_string(i));
+    }
+
+    ASSERT_EQ(linker.service("unknown"), 0);
+    ASSERT_EQ(linker.service_name(linker.service("frontend")), "frontend");
+    ASSERT_GT(linker.service_overflows(), 0);
+}
+
+TEST(tracer, child_span)
+{
+    std::unique_ptr<zipkin::Tracer> tracer(zipkin::Tracer::create(nullptr));
+    std::unique_ptr<zipkin::Span> root(tracer->span("root"));
+
+    root->with_debug(true);
+
+    std::unique_ptr<zipkin::Span> child(root->span("child"));
+
+    ASSERT_EQ(child->name(), "child");
+    ASSERT_EQ(child->tracer(), tracer.get());
+    ASSERT_EQ(child->trace_id(), root->trace_id());
+    ASSERT_EQ(child->trace_id_high(), root->trace_id_high());
+    ASSERT_EQ(child->parent_id(), root->id());
+    ASSERT_NE(child->id(), root->id());
+    ASSERT_TRUE(child->debug());
+
+    zipkin::SpanContext context(123, 456, 789, false);
+
+    std::unique_ptr<zipkin::Span> server(tracer->span("server", context));
+
+    ASSERT_EQ(server->trace_id(), 123);
+    ASSERT_EQ(server->trace_id_high(), 789);
+    ASSERT_EQ(server->parent_id(), 456);
+    ASSERT_FALSE(server->sampled());
+    ASSERT_FALSE(server->debug());
+}
+
+struct SequenceIdGenerator : public zipkin::IdGenerator
+{
+    uint64_t id = 0;
+
+    virtual uint64_t next_id(void) override { return ++id; }
+};
+
+TEST(tracer, id_generator)
+{
+    std::unique_ptr<zipkin::Tracer> tracer(zipkin::Tracer::create(nullptr));
+
+    ASSERT_EQ(tracer->id_generator(), zipkin::IdGenerator::random());
+
+    SequenceIdGenerator sequence;
+
+    tracer->set_id_generator(&sequence);
+
+    std::unique_ptr<zipkin::Span> span(tracer->span("test"));
+
+    ASSERT_EQ(span->trace_id_high(), 1);
+    ASSERT_EQ(span->trace_id(), 2);
+    ASSERT_EQ(span->id(), 3);
+
+    std::unique_ptr<zipkin::Span> child(span->span("child"));
+
+    ASSERT_EQ(child->trace_id(), 2);
+    ASSERT_EQ(child->id(), 4);
+
+    tracer->set_id_generator(zipkin::IdGenerator::timestamp());
+
+    uint64_t now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+    span.reset(tracer->span("test"));
+
+    ASSERT_NEAR(span->trace_id_high() >> 32, now, 1);
+
+    uint64_t ids[16];
+
+    zipkin::IdGenerator::random()->next_ids(ids, 16);
+
+    std::sort(std::begin(ids), std::end(ids));
+
+    ASSERT_NE(ids[0], 0);
+    ASSERT_EQ(std::unique(std::begin(ids), std::end(ids)), std::end(ids));
+}
+
+TEST(tracer, clock)
+{
+    std::unique_ptr<zipkin::Tracer> tracer(zipkin::Tracer::create(nullptr));
+
+    ASSERT_EQ(tracer->clock(), zipkin::Clock::precise());
+
+    for (auto mode : {zipkin::Clock::PRECISE, zipkin::Clock::COARSE, zipkin::Clock::TSC})
+    {
+        tracer->set_clock(zipkin::Clock::get(mode));
+
+        int64_t now = zipkin::Span::now().count();
+
+        std::unique_ptr<zipkin::Span> span(tracer->span("test"));
+
+        ASSERT_EQ(span->clock(), zipkin::Clock::get(mode));
+        ASSERT_NEAR(span->timestamp().count(), now, 20000);
+
+        span->client_send();
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+        span->client_recv();
+        span->submit();
+
+        const ::Span &msg = span->message();
+
+        ASSERT_GE(msg.annotations[0].timestamp, msg.timestamp);
+        ASSERT_GE(msg.annotations[1].timestamp - msg.annotations[0].timestamp, 10000);
+        ASSERT_GE(msg.duration, msg.annotations[1].timestamp - msg.timestamp);
+
+        // the duration of an explicit timestamp is measured with the wall clock
+        std::unique_ptr<zipkin::Span> timestamped(tracer->span("test"));
+
+        timestamped->with_timestamp(timestamp_t(tracer->clock()->wall() - 5000));
+        timestamped->submit();
+
+        ASSERT_GE(timestamped->duration().count(), 5000);
+        ASSERT_LT(timestamped->duration().count(), 5000000);
+    }
+}
+
+TEST(tracer, shapes)
+{
+    zipkin::SpanShapes shapes(1);
+
+    ASSERT_EQ(shapes.reserve_size("test"), 0);
+
+    for (int i = 0; i < 100; i++)
+    {
+        shapes.record("test", 4, 2, i < 95 ? 1000 : 100000);
+    }
+
+    zipkin::SpanShape shape;
+
+    ASSERT_TRUE(shapes.shape("test", shape));
+    ASSERT_EQ(shape.name, "test");
+    ASSERT_EQ(shape.samples, 100);
+    ASSERT_EQ(shape.annotations, 7);
+    ASSERT_EQ(shape.binary_annotations, 3);
+    ASSERT_EQ(shape.bytes, 1023);
+    ASSERT_EQ(shapes.reserve_size("test"), 1023);
+    ASSERT_EQ(shapes.size(), 1);
+    ASSERT_EQ(shapes.shapes().size(), 1);
+
+    std::unique_ptr<zipkin::Tracer> tracer(zipkin::Tracer::create(nullptr));
+    auto t = static_cast<zipkin::CachedTracer *>(tracer.get());
+
+    for (size_t i = 0; i < zipkin::SpanShapes::DEFAULT_SAMPLE_EVERY; i++)
+    {
+        zipkin::Span *span = tracer->span("big");
+
+        for (int j = 0; j < 128; j++)
+        {
+            span->annotate("key", std::string(64, 'x'));
+        }
+
+        tracer->release(span);
+    }
+
+    ASSERT_TRUE(t->shapes().shape("big", shape));
+    ASSERT_EQ(shape.binary_annotations, 255);
+    ASSERT_GE(shape.bytes, 128 * 64);
+
+    std::unique_ptr<zipkin::Span> span(tracer->span("big"));
+
+    ASSERT_GE(span->arena().available() + span->arena().reserved(), shape.bytes);
+}